@@ -4,6 +4,7 @@ module;
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/asio.hpp>
+#include <boost/crc.hpp>
 #include <boost/describe.hpp>
 #include <boost/describe/members.hpp>
 #include <boost/endian/conversion.hpp>
@@ -30,6 +31,7 @@ export module viu.boost;
 
 namespace boost {
 
+export using boost::crc_32_type;
 export using boost::lexical_cast;
 export using boost::numeric_cast;
 export using boost::sync_queue;
@@ -39,6 +41,8 @@ export using boost::sync_queue;
 namespace boost::asio {
 
 export using boost::asio::streambuf;
+export using boost::asio::async_read;
+export using boost::asio::async_write;
 export using boost::asio::buffer;
 export using boost::asio::buffers_begin;
 export using boost::asio::buffers_end;
@@ -46,6 +50,9 @@ export using boost::asio::read;
 export using boost::asio::read_until;
 export using boost::asio::write;
 export using boost::asio::io_context;
+export using boost::asio::post;
+export using boost::asio::steady_timer;
+export using boost::asio::thread_pool;
 export using boost::asio::transfer_exactly;
 
 } // namespace boost::asio
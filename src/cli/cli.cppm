@@ -16,4 +16,22 @@ export auto serialize_argv(int argc, const char* const argv[])
 export auto deserialize_argv(const char* data, std::size_t size)
     -> deserialized_args;
 
+export auto serialize_args(std::span<const std::string> args)
+    -> std::vector<char>;
+
+// Splits a command line the way a POSIX shell would for plain words,
+// 'single' and "double" quotes and backslash escapes. Nothing is expanded.
+export auto split_command_line(std::string_view line)
+    -> std::vector<std::string>;
+
+// Requests are a u32 size followed by serialize_argv() bytes. A request is
+// answered by one or more frames, each a frame_header followed by a
+// serialized response; all but the last frame carry frame_more.
+export struct frame_header {
+    std::uint32_t size{};
+    std::uint32_t flags{};
+};
+
+export constexpr auto frame_more = std::uint32_t{1};
+
 } // namespace viu::cli
@@ -67,4 +67,84 @@ auto cli::deserialize_argv(const char* data, std::size_t size)
     return result;
 }
 
+auto cli::serialize_args(std::span<const std::string> args)
+    -> std::vector<char>
+{
+    auto argv = std::vector<const char*>{};
+    argv.reserve(std::size(args));
+    for (const auto& arg : args) {
+        argv.push_back(arg.c_str());
+    }
+
+    return serialize_argv(static_cast<int>(std::size(argv)), argv.data());
+}
+
+auto cli::split_command_line(std::string_view line) -> std::vector<std::string>
+{
+    // Inside double quotes only these keep the backslash special.
+    constexpr auto escapable_in_quotes = std::string_view{"\"\\$`"};
+
+    auto words = std::vector<std::string>{};
+    auto word = std::string{};
+    auto in_word = false;
+    auto quote = char{};
+
+    for (auto i = std::size_t{}; i < std::size(line); ++i) {
+        const auto c = line[i];
+
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = {};
+            } else {
+                word += c;
+            }
+            continue;
+        }
+
+        if (c == '\\' && i + 1 < std::size(line)) {
+            const auto next = line[i + 1];
+            if (quote != '"' || escapable_in_quotes.contains(next)) {
+                word += next;
+                ++i;
+                in_word = true;
+                continue;
+            }
+        }
+
+        if (quote == '"') {
+            if (c == '"') {
+                quote = {};
+            } else {
+                word += c;
+            }
+            continue;
+        }
+
+        if (c == '\'' || c == '"') {
+            quote = c;
+            in_word = true;
+        } else if (std::isspace(static_cast<unsigned char>(c)) != 0) {
+            if (in_word) {
+                words.push_back(std::exchange(word, {}));
+                in_word = false;
+            }
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+
+    if (quote != char{}) {
+        throw std::runtime_error(
+            std::format("Unterminated {} quote in: {}", quote, line)
+        );
+    }
+
+    if (in_word) {
+        words.push_back(std::move(word));
+    }
+
+    return words;
+}
+
 } // namespace viu
@@ -0,0 +1,58 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+import std;
+
+import viu.cli;
+
+namespace viu::test {
+
+class cli_test : public testing::Test {};
+
+TEST_F(cli_test, split_command_line_words)
+{
+    EXPECT_THAT(
+        cli::split_command_line("  plug  --config dev.json\t-c catalog "),
+        testing::ElementsAre("plug", "--config", "dev.json", "-c", "catalog")
+    );
+    EXPECT_TRUE(cli::split_command_line("   ").empty());
+}
+
+TEST_F(cli_test, split_command_line_quotes)
+{
+    EXPECT_THAT(
+        cli::split_command_line(R"(plug -n "my device" -c 'a "b"' x\ y)"),
+        testing::ElementsAre("plug", "-n", "my device", "-c", "a \"b\"", "x y")
+    );
+    EXPECT_THAT(
+        cli::split_command_line(R"("a\"b\n" '' "")"),
+        testing::ElementsAre("a\"b\\n", "", "")
+    );
+    EXPECT_THROW(cli::split_command_line("plug \"oops"), std::runtime_error);
+}
+
+TEST_F(cli_test, serialize_round_trip)
+{
+    const auto args = std::array{
+        std::string{"viud"},
+        std::string{"batch"},
+        std::string{"--script"},
+        std::string{"list\nunplug -i 1\n"}
+    };
+
+    const auto payload = cli::serialize_args(args);
+    const auto parsed = cli::deserialize_argv(payload.data(), payload.size());
+
+    ASSERT_EQ(parsed.argc, std::ssize(args));
+    for (auto i = std::size_t{}; i < std::size(args); ++i) {
+        EXPECT_EQ(parsed.argv_storage[i], args[i]);
+    }
+    EXPECT_EQ(parsed.argv_storage.back(), nullptr);
+
+    EXPECT_THROW(
+        cli::deserialize_argv(payload.data(), payload.size() - 1),
+        std::runtime_error
+    );
+}
+
+} // namespace viu::test
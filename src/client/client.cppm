@@ -10,6 +10,15 @@ export class client {
 public:
     auto send_command(int argc, const char* argv[]) -> int;
     auto run(int argc, const char* argv[]) -> int;
+
+private:
+    // Sends the commands of a script file to be executed by the daemon in
+    // one request.
+    auto run_batch(int argc, const char* argv[]) -> int;
+
+    // Reads commands from stdin, one per line, and pipelines them over a
+    // single connection.
+    auto run_session(const char* argv0) -> int;
 };
 
 } // namespace viu
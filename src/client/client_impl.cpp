@@ -13,36 +13,241 @@ using boost::asio::local::stream_protocol;
 
 namespace viu {
 
-auto client::send_command(int argc, const char* argv[]) -> int
+namespace {
+
+void write_request(
+    stream_protocol::socket& socket,
+    const std::vector<char>& payload
+)
 {
-    try {
-        boost::asio::io_context io;
-        stream_protocol::socket socket(io);
-        auto path = viu::daemon::service::socket_path();
-        socket.connect(stream_protocol::endpoint(path));
+    const auto size = static_cast<std::uint32_t>(std::size(payload));
+    const auto buffers = std::array{
+        boost::asio::const_buffer{&size, sizeof(size)},
+        boost::asio::const_buffer{payload.data(), std::size(payload)}
+    };
+
+    boost::asio::write(socket, buffers);
+}
+
+// Reads and prints the frames answering one request. Returns false if any
+// of them reported a failure.
+auto read_response(stream_protocol::socket& socket) -> bool
+{
+    auto ok = true;
+    auto header = cli::frame_header{};
+
+    do {
+        boost::asio::read(socket, boost::asio::buffer(&header, sizeof(header)));
+
+        auto data = std::string(header.size, '\0');
+        boost::asio::read(socket, boost::asio::buffer(data));
+
+        const auto resp = viu::response::deserialize(data);
+        ok = ok && resp.is_success();
+
+        std::println("Response:\n{}", resp.message());
+    } while ((header.flags & cli::frame_more) != 0);
+
+    return ok;
+}
+
+// Runs a session's reads and writes on the one thread running their
+// io_context. Requests are written in the order they are sent, responses
+// come back in request order and are printed while later requests are
+// still being written.
+class session {
+public:
+    explicit session(stream_protocol::socket& socket) : socket_{socket} {}
+
+    void start() { read_header(); }
+
+    void send(std::vector<char> payload)
+    {
+        outgoing_.push_back(std::move(payload));
+        if (!writing_) {
+            write_next();
+        }
+    }
+
+    // Shuts our side down once the queued requests are written.
+    void finish()
+    {
+        finishing_ = true;
+        if (!writing_) {
+            shutdown_send();
+        }
+    }
+
+    [[nodiscard]] auto failed() const -> bool { return failed_; }
 
-        auto payload = cli::serialize_argv(argc, argv);
-        std::uint32_t size = payload.size();
+private:
+    void write_next()
+    {
+        if (outgoing_.empty()) {
+            writing_ = false;
+            if (finishing_) {
+                shutdown_send();
+            }
+            return;
+        }
 
-        boost::asio::write(socket, boost::asio::buffer(&size, sizeof(size)));
-        boost::asio::write(socket, boost::asio::buffer(payload));
+        writing_ = true;
+        size_ = static_cast<std::uint32_t>(std::size(outgoing_.front()));
+        const auto buffers = std::array{
+            boost::asio::buffer(&size_, sizeof(size_)),
+            boost::asio::buffer(outgoing_.front())
+        };
 
-        std::uint32_t msg_size = 0;
-        boost::asio::read(
-            socket,
-            boost::asio::buffer(&msg_size, sizeof(msg_size))
+        boost::asio::async_write(
+            socket_,
+            buffers,
+            [this](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
+
+                outgoing_.pop_front();
+                write_next();
+            }
         );
+    }
+
+    void read_header()
+    {
+        boost::asio::async_read(
+            socket_,
+            boost::asio::buffer(&header_, sizeof(header_)),
+            [this](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (ec == boost::asio::error::misc_errors::eof) {
+                    return;
+                }
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
 
-        std::vector<char> buffer(msg_size);
-        boost::asio::read(
-            socket,
-            boost::asio::buffer(buffer.data(), buffer.size())
+                read_data();
+            }
         );
+    }
 
-        std::string data(buffer.begin(), buffer.end());
-        viu::response resp = viu::response::deserialize(data);
+    void read_data()
+    {
+        data_.assign(header_.size, '\0');
+        boost::asio::async_read(
+            socket_,
+            boost::asio::buffer(data_),
+            [this](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
 
-        std::println("Response:\n{}", resp.message());
+                const auto resp = viu::response::deserialize(data_);
+                failed_ = failed_ || !resp.is_success();
+                std::println("Response:\n{}", resp.message());
+
+                read_header();
+            }
+        );
+    }
+
+    void shutdown_send()
+    {
+        auto ec = boost::system::error_code{};
+        socket_.shutdown(stream_protocol::socket::shutdown_send, ec);
+        if (ec) {
+            fail(ec);
+        }
+    }
+
+    // Reported once, a failed write usually fails the pending read too.
+    void fail(const boost::system::error_code& ec)
+    {
+        if (!broken_) {
+            std::println("Daemon session failed: {}", ec.message());
+        }
+        broken_ = true;
+        failed_ = true;
+    }
+
+    stream_protocol::socket& socket_;
+    std::deque<std::vector<char>> outgoing_{};
+    std::uint32_t size_{};
+    cli::frame_header header_{};
+    std::string data_{};
+    bool writing_{false};
+    bool finishing_{false};
+    bool broken_{false};
+    bool failed_{false};
+};
+
+// Reads commands from stdin and hands them to the session's thread.
+// Returns false if any line had to be skipped.
+auto post_requests(
+    boost::asio::io_context& io,
+    session& s,
+    const char* argv0
+) -> bool
+{
+    auto ok = true;
+    auto line = std::string{};
+    while (std::getline(std::cin, line)) {
+        auto words = std::vector<std::string>{};
+        try {
+            words = cli::split_command_line(line);
+        } catch (const std::exception& e) {
+            std::println("Skipping line: {}", e.what());
+            ok = false;
+            continue;
+        }
+
+        if (words.empty() || words.front().starts_with('#')) {
+            continue;
+        }
+
+        words.insert(std::begin(words), std::string{argv0});
+        boost::asio::post(
+            io,
+            [&s, payload = cli::serialize_args(words)]() mutable {
+                s.send(std::move(payload));
+            }
+        );
+    }
+
+    boost::asio::post(io, [&s] { s.finish(); });
+    return ok;
+}
+
+auto connect(boost::asio::io_context& io) -> stream_protocol::socket
+{
+    auto socket = stream_protocol::socket{io};
+    socket.connect(
+        stream_protocol::endpoint(viu::daemon::service::socket_path())
+    );
+    return socket;
+}
+
+} // namespace
+
+auto client::send_command(int argc, const char* argv[]) -> int
+{
+    try {
+        auto io = boost::asio::io_context{};
+        auto socket = connect(io);
+
+        write_request(socket, cli::serialize_argv(argc, argv));
+        read_response(socket);
     } catch (const std::exception& e) {
         std::println("Daemon command failed: {}", e.what());
         return 1;
@@ -50,8 +255,93 @@ auto client::send_command(int argc, const char* argv[]) -> int
     return 0;
 }
 
+auto client::run_batch(int argc, const char* argv[]) -> int
+{
+    const auto args = std::span{argv, static_cast<std::size_t>(argc)};
+    if (std::size(args) != 3 || std::string_view{args[2]}.starts_with('-')) {
+        return send_command(argc, argv);
+    }
+
+    auto file = std::ifstream{args[2]};
+    if (!file) {
+        std::println("Cannot open batch file: {}", args[2]);
+        return 1;
+    }
+
+    const auto script = std::string{
+        std::istreambuf_iterator<char>{file},
+        std::istreambuf_iterator<char>{}
+    };
+
+    const auto request = std::array{
+        std::string{args[0]},
+        std::string{"batch"},
+        std::string{"--script"},
+        script
+    };
+
+    try {
+        auto io = boost::asio::io_context{};
+        auto socket = connect(io);
+
+        write_request(socket, cli::serialize_args(request));
+        return read_response(socket) ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::println("Daemon command failed: {}", e.what());
+        return 1;
+    }
+}
+
+auto client::run_session(const char* argv0) -> int
+{
+    try {
+        auto io = boost::asio::io_context{};
+        auto socket = connect(io);
+        auto s = session{socket};
+        auto failed = false;
+        auto skipped = false;
+
+        // The pending read keeps the I/O thread running until the daemon
+        // closes the connection, which it does once the last request is
+        // answered after we shut down our side.
+        boost::asio::post(io, [&s] { s.start(); });
+        auto runner = std::jthread{[&io, &failed] {
+            try {
+                io.run();
+            } catch (const std::exception& e) {
+                std::println("Daemon session failed: {}", e.what());
+                failed = true;
+            }
+        }};
+
+        try {
+            skipped = !post_requests(io, s, argv0);
+        } catch (...) {
+            io.stop();
+            throw;
+        }
+
+        runner.join();
+        return failed || skipped || s.failed() ? 1 : 0;
+    } catch (const std::exception& e) {
+        std::println("Daemon command failed: {}", e.what());
+        return 1;
+    }
+}
+
 auto client::run(int argc, const char* argv[]) -> int
 {
+    const auto subcommand = argc > 1 ? std::string_view{argv[1]}
+                                     : std::string_view{};
+
+    if (subcommand == "batch") {
+        return run_batch(argc, argv);
+    }
+
+    if (subcommand == "session" && argc == 2) {
+        return run_session(argv[0]);
+    }
+
     return send_command(argc, argv);
 }
 
@@ -4,13 +4,17 @@ import std;
 
 import viu.boost;
 import viu.cli;
+import viu.daemon.registry;
 import viu.device.mock;
 import viu.device.proxy;
 import viu.error;
+import viu.metrics;
 import viu.plugin.catalog;
 import viu.plugin.interfaces;
 import viu.plugin.loader;
+import viu.usb;
 import viu.usb.descriptors;
+import viu.usb.mock.abi;
 
 export namespace viu::daemon {
 
@@ -44,17 +48,40 @@ class service {
 public:
     static auto runtime_dir() -> std::filesystem::path;
     static auto socket_path() -> std::filesystem::path;
+
+    // Set through VIUD_METRICS_SOCKET, the exporter is off without it.
+    static auto metrics_socket_path() -> std::optional<std::filesystem::path>;
     static auto is_running() -> bool;
     static auto is_service_start() -> bool;
 
     auto run() -> int;
+    using emit_type = std::function<void(const viu::response&)>;
+
     auto execute_from_argv(int argc, const char* argv[]) -> viu::response;
 
+    // Intermediate results, e.g. of every command in a batch, are handed
+    // to `emit` before the final response is returned.
+    auto execute_from_argv(
+        int argc,
+        const char* argv[],
+        const emit_type& emit
+    ) -> viu::response;
+
 private:
+    class session;
+    class scrape;
+
     struct device_info {
         std::uint32_t vid{};
         std::uint32_t pid{};
-        std::unique_ptr<viu::device::proxy> proxy{};
+        std::shared_ptr<viu::device::proxy> proxy{};
+    };
+
+    struct plug_request {
+        std::filesystem::path config_path{};
+        std::filesystem::path catalog_path{};
+        std::string device_name{};
+        std::size_t count{1};
     };
 
     auto get_subcommand(const std::span<const char*>& args) -> std::string;
@@ -70,7 +97,8 @@ private:
     auto app_save_config(
         std::uint32_t vid,
         std::uint32_t pid,
-        const std::filesystem::path& path
+        const std::filesystem::path& path,
+        viu::usb::descriptor::file_format format
     ) -> viu::response;
     auto app_save_hid_report(
         std::uint32_t vid,
@@ -79,25 +107,35 @@ private:
     ) -> viu::response;
     auto app_mock(
         const std::filesystem::path& device_config_path,
-        const std::filesystem::path& catalog_path
+        const std::filesystem::path& catalog_path,
+        viu::usb::pacing pace
     ) -> viu::response;
     auto app_list_catalogs() -> viu::response;
     auto app_plug(
-        const std::filesystem::path& config_path,
-        const std::filesystem::path& catalog_path,
-        const std::string& device_name
+        const std::vector<plug_request>& requests,
+        viu::usb::pacing pace
     ) -> viu::response;
     auto app_version() -> viu::response;
     auto app_list() -> viu::response;
-    auto app_unplug(std::uint64_t device_id) -> viu::response;
+    auto app_stats(std::optional<std::uint64_t> device_id) -> viu::response;
+    auto app_trace(
+        std::chrono::milliseconds duration,
+        const std::optional<std::filesystem::path>& output
+    ) -> viu::response;
+    auto app_unplug(std::uint64_t device_id, bool wait) -> viu::response;
+    auto app_detach(std::uint64_t device_id) -> viu::response;
+    auto app_attach(std::uint64_t device_id) -> viu::response;
+    auto app_replug(std::uint64_t device_id) -> viu::response;
 
     void handle_accept(
-        std::function<void()>& do_accept,
-        std::shared_ptr<boost::asio::local::stream_protocol::socket> socket,
         const boost::system::error_code& ec,
-        boost::asio::local::stream_protocol::acceptor& acceptor,
-        const std::filesystem::path& path
+        boost::asio::local::stream_protocol::socket socket
     );
+    auto render_metrics() -> std::string;
+    auto execute_request(
+        const std::vector<char>& payload,
+        const emit_type& emit
+    ) -> viu::response;
 
     auto run_proxydev_command(const std::span<const char*>& args)
         -> viu::response;
@@ -111,8 +149,21 @@ private:
     auto run_version_command(const std::span<const char*>& args)
         -> viu::response;
     auto run_list_command(const std::span<const char*>& args) -> viu::response;
+    auto run_stats_command(const std::span<const char*>& args)
+        -> viu::response;
+    auto run_trace_command(const std::span<const char*>& args)
+        -> viu::response;
     auto run_unplug_command(const std::span<const char*>& args)
         -> viu::response;
+    auto run_batch_command(
+        const std::span<const char*>& args,
+        const emit_type& emit
+    ) -> viu::response;
+    auto run_device_id_command(
+        const std::span<const char*>& args,
+        const std::string& caption,
+        const std::function<viu::response(std::uint64_t)>& app
+    ) -> viu::response;
 
     auto check_cli_params(
         const boost::program_options::variables_map& vm,
@@ -120,22 +171,44 @@ private:
         std::initializer_list<std::string_view> params
     ) -> viu::result<void>;
 
-    auto create_mock_device_from_catalog(
-        const std::filesystem::path& catalog_path,
-        const std::string& device_name,
-        const viu::usb::descriptor::tree& dev_desc
+    static auto parse_plug_manifest(const std::filesystem::path& path)
+        -> viu::result<std::vector<plug_request>>;
+    auto add_device(device_info info) -> std::uint64_t;
+    auto build_device(
+        std::uint64_t device_id,
+        const std::function<device_info()>& make
     ) -> void;
+    auto find_device(std::uint64_t device_id)
+        -> std::shared_ptr<viu::device::proxy>;
+    auto register_catalog(const std::filesystem::path& catalog_path)
+        -> viu::result<viu::device::plugin::catalog_interface*>;
+    auto catalog_device(
+        const std::filesystem::path& catalog_path,
+        const std::string& device_name
+    ) -> viu::result<viu::usb::mock_plugin>;
     auto create_proxy_device_from_catalog(
         std::uint32_t vid,
         std::uint32_t pid,
         const std::filesystem::path& catalog_path,
         const std::string& device_name
-    ) -> void;
+    ) -> viu::result<void>;
 
-    std::atomic<std::uint64_t> device_id_counter_{0};
     // TODO: Make them desctruction order independent
+    std::mutex catalogs_mutex_{};
     viu::device::plugin::virtual_device_manager virtual_device_manager_{};
-    std::map<std::uint64_t, device_info> virtual_devices_{};
+    registry<device_info> devices_{};
+
+    // The wait of a running trace, stopped when the daemon shuts down.
+    std::mutex trace_mutex_{};
+    boost::asio::io_context* trace_io_{};
+
+    const std::size_t worker_count_{
+        std::max(std::thread::hardware_concurrency(), 2U)
+    };
+    metrics::gauge busy_workers_{};
+
+    // Destroyed first: commands still running may use everything above.
+    boost::asio::thread_pool workers_{worker_count_};
 };
 
 } // namespace viu::daemon
@@ -5,6 +5,7 @@ module;
 #include <boost/asio.hpp>
 
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 module viu.daemon;
@@ -14,24 +15,85 @@ import std;
 import viu.assert;
 import viu.boost;
 import viu.cli;
+import viu.daemon.registry;
 import viu.error;
 import viu.device.mock;
 import viu.device.proxy;
 import viu.io;
+import viu.metrics;
 import viu.plugin.loader;
+import viu.trace;
 import viu.usb;
 import viu.usb.descriptors;
 import viu.version;
+import viu.vhci;
 
 namespace viu::daemon {
 
-enum class error : std::uint8_t { invalid_argument };
+enum class error : std::uint8_t {
+    invalid_argument,
+    no_free_port,
+    attach_failed,
+    timed_out
+};
 
 constexpr auto error_category_of(error /*unused*/) noexcept
 {
     return viu::error_category::cli;
 };
 
+namespace {
+
+auto device_not_found(const std::uint64_t device_id) -> viu::response
+{
+    auto ss = std::stringstream{};
+    std::println(ss, "Device with id {} not found", device_id);
+    return viu::response::failure(
+        ss.str(),
+        viu::make_error(error::invalid_argument, "Device not found").error()
+    );
+}
+
+auto pacing_of(const boost::program_options::variables_map& vm)
+    -> viu::usb::pacing
+{
+    return vm.count("no-pacing") != 0 ? viu::usb::pacing::none
+                                      : viu::usb::pacing::interval;
+}
+
+// A device attaches itself while it is built, unless the vhci driver turned
+// it away.
+auto state_of(viu::device::proxy& device) -> device_state
+{
+    return device.is_attached() ? device_state::attached
+                                : device_state::detached;
+}
+
+// Owns a published device. The copies the registry hands out share it and
+// the last one to go destroys the device, then runs `on_released`, which an
+// unplug sets to finish the teardown.
+struct device_owner {
+    void operator()(viu::device::proxy* /*unused*/)
+    {
+        device.reset();
+        if (on_released) {
+            on_released();
+        }
+    }
+
+    std::shared_ptr<viu::device::proxy> device;
+    std::function<void()> on_released{};
+};
+
+auto owned(std::shared_ptr<viu::device::proxy> device)
+    -> std::shared_ptr<viu::device::proxy>
+{
+    auto* const raw = device.get();
+    return {raw, device_owner{std::move(device)}};
+}
+
+} // namespace
+
 namespace args {
 
 auto operator<<(std::ostream& os, const device_id& id) -> std::ostream&
@@ -64,6 +126,16 @@ auto service::socket_path() -> std::filesystem::path
     return runtime_dir() / "viud.sock";
 }
 
+auto service::metrics_socket_path() -> std::optional<std::filesystem::path>
+{
+    const auto* path = std::getenv("VIUD_METRICS_SOCKET");
+    if (path == nullptr || *path == '\0') {
+        return std::nullopt;
+    }
+
+    return std::filesystem::path{path};
+}
+
 auto service::is_running() -> bool
 {
     return std::filesystem::exists(socket_path());
@@ -125,47 +197,98 @@ auto service::check_cli_params(
     return {};
 }
 
-void service::create_mock_device_from_catalog(
-    const std::filesystem::path& catalog_path,
-    const std::string& device_name,
-    const viu::usb::descriptor::tree& dev_desc
+auto service::add_device(device_info info) -> std::uint64_t
+{
+    const auto id = devices_.create();
+    const auto state = state_of(*info.proxy);
+    info.proxy = owned(std::move(info.proxy));
+    devices_.publish(id, std::move(info), state);
+    return id;
+}
+
+// Builds the device for an id reserved with registry::create(), the id is
+// listed as creating until then.
+void service::build_device(
+    const std::uint64_t device_id,
+    const std::function<device_info()>& make
 )
 {
+    try {
+        auto info = make();
+        const auto state = state_of(*info.proxy);
+        info.proxy = owned(std::move(info.proxy));
+        devices_.publish(device_id, std::move(info), state);
+    } catch (...) {
+        devices_.abandon(device_id);
+        throw;
+    }
+}
+
+auto service::find_device(std::uint64_t device_id)
+    -> std::shared_ptr<viu::device::proxy>
+{
+    const auto info = devices_.find(device_id);
+    return info ? info->proxy : nullptr;
+}
+
+auto service::register_catalog(const std::filesystem::path& catalog_path)
+    -> viu::result<viu::device::plugin::catalog_interface*>
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{catalogs_mutex_};
+    return virtual_device_manager_.register_catalog(catalog_path.string());
+}
+
+auto service::catalog_device(
+    const std::filesystem::path& catalog_path,
+    const std::string& device_name
+) -> viu::result<viu::usb::mock_plugin>
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{catalogs_mutex_};
+
     auto vd =
         virtual_device_manager_.device(catalog_path.string(), device_name);
+    if (!vd) {
+        return viu::make_error(
+            error::invalid_argument,
+            std::format(
+                "Catalog {} has no device '{}'",
+                catalog_path.string(),
+                device_name
+            )
+        );
+    }
 
-    viu::_assert(vd && *vd != nullptr);
+    if (vd->instance == nullptr) {
+        return viu::make_error(
+            error::attach_failed,
+            std::format(
+                "Catalog {} failed to create device '{}'",
+                catalog_path.string(),
+                device_name
+            )
+        );
+    }
 
-    const auto vid = dev_desc.device_descriptor().idVendor;
-    const auto pid = dev_desc.device_descriptor().idProduct;
-    const auto id = device_id_counter_.fetch_add(1, std::memory_order_relaxed);
-    virtual_devices_.emplace(
-        id,
-        device_info{
-            vid,
-            pid,
-            std::make_unique<viu::device::mock>(dev_desc, *vd)
-        }
-    );
+    return *vd;
 }
 
-void service::create_proxy_device_from_catalog(
+auto service::create_proxy_device_from_catalog(
     std::uint32_t vid,
     std::uint32_t pid,
     const std::filesystem::path& catalog_path,
     const std::string& device_name
-)
+) -> viu::result<void>
 {
-    auto vd =
-        virtual_device_manager_.device(catalog_path.string(), device_name);
-    viu::_assert(vd && *vd != nullptr);
+    const auto vd = catalog_device(catalog_path, device_name);
+    if (!vd) {
+        return viu::make_error(vd.error());
+    }
 
     const auto device = std::make_shared<viu::usb::device>(vid, pid, *vd);
-    const auto id = device_id_counter_.fetch_add(1, std::memory_order_relaxed);
-    virtual_devices_.emplace(
-        id,
-        device_info{vid, pid, std::make_unique<viu::device::proxy>(device)}
+    add_device(
+        device_info{vid, pid, std::make_shared<viu::device::proxy>(device)}
     );
+    return {};
 }
 
 auto service::app_proxy(
@@ -176,19 +299,14 @@ auto service::app_proxy(
 {
     if (catalog_path.empty()) {
         const auto device = std::make_shared<viu::usb::device>(vid, pid);
-        const auto id =
-            device_id_counter_.fetch_add(1, std::memory_order_relaxed);
-        virtual_devices_.emplace(
-            id,
-            device_info{vid, pid, std::make_unique<viu::device::proxy>(device)}
+        add_device(
+            device_info{vid, pid, std::make_shared<viu::device::proxy>(device)}
         );
 
         return viu::response::success("Proxy device created successfully");
     }
 
-    const auto register_result = virtual_device_manager_.register_catalog(
-        catalog_path.string()
-    );
+    const auto register_result = register_catalog(catalog_path);
 
     if (!register_result) {
         return viu::response::failure(
@@ -206,12 +324,18 @@ auto service::app_proxy(
     // TODO: support multiple devices
     viu::_assert(plugin_factory->number_of_devices() == 1);
 
-    create_proxy_device_from_catalog(
-        vid,
-        pid,
-        catalog_path,
-        plugin_factory->device_name(0)
-    );
+    if (const auto created = create_proxy_device_from_catalog(
+            vid,
+            pid,
+            catalog_path,
+            plugin_factory->device_name(0)
+        );
+        !created) {
+        return viu::response::failure(
+            std::string(created.error().message()),
+            created.error()
+        );
+    }
 
     std::println(
         ss,
@@ -225,12 +349,16 @@ auto service::app_proxy(
 auto service::app_save_config(
     std::uint32_t vid,
     std::uint32_t pid,
-    const std::filesystem::path& path
+    const std::filesystem::path& path,
+    viu::usb::descriptor::file_format format
 ) -> viu::response
 {
-    const auto device = std::make_shared<viu::usb::device>(vid, pid);
-    const auto proxy_usb_device = viu::device::proxy{device};
-    return proxy_usb_device.save_config(path);
+    const auto device = viu::usb::device{
+        vid,
+        pid,
+        viu::usb::open_mode::capture
+    };
+    return device.save_config(path, format);
 }
 
 auto service::app_save_hid_report(
@@ -239,23 +367,28 @@ auto service::app_save_hid_report(
     const std::filesystem::path& path
 ) -> viu::response
 {
-    const auto device = std::make_shared<viu::usb::device>(vid, pid);
-    const auto proxy_usb_device = viu::device::proxy{device};
-    return proxy_usb_device.save_hid_report(path);
+    const auto device = viu::usb::device{
+        vid,
+        pid,
+        viu::usb::open_mode::capture
+    };
+    return device.save_hid_report(path);
 }
 
 auto service::app_mock(
     const std::filesystem::path& device_config_path,
-    const std::filesystem::path& catalog_path
+    const std::filesystem::path& catalog_path,
+    const viu::usb::pacing pace
 ) -> viu::response
 {
-    auto dev_desc = viu::usb::descriptor::tree{};
-    dev_desc.load(device_config_path);
-
-    const auto register_result = virtual_device_manager_.register_catalog(
-        catalog_path.string()
+    auto tree = viu::usb::descriptor::tree{};
+    tree.load(device_config_path);
+    const auto dev_desc = std::make_shared<const viu::usb::descriptor::tree>(
+        std::move(tree)
     );
 
+    const auto register_result = register_catalog(catalog_path);
+
     if (!register_result) {
         return viu::response::failure(
             std::string(register_result.error().message()),
@@ -269,11 +402,83 @@ auto service::app_mock(
     auto ss = std::stringstream{};
     viu::device::plugin::print_catalog_info(ss, plugin_factory);
 
-    for (std::size_t n = 0; n < plugin_factory->number_of_devices(); n++) {
-        create_mock_device_from_catalog(
+    const auto count = plugin_factory->number_of_devices();
+    const auto speed = vhci::driver::to_speed_enum(
+        dev_desc->device_descriptor().bcdUSB
+    );
+
+    auto leases = vhci::port_manager::instance().reserve(speed, count);
+    if (!leases) {
+        const auto message = std::format(
+            "Not enough free vhci ports for {} device(s)",
+            count
+        );
+        return viu::response::failure(
+            message,
+            viu::make_error(error::no_free_port, message).error()
+        );
+    }
+
+    // Devices bring up their threads and attach to their reserved port
+    // concurrently. Their ids are listed as creating in the meantime.
+    auto failed = std::size_t{};
+    auto pending = std::vector<std::future<void>>{};
+    pending.reserve(count);
+    for (std::size_t n = 0; n < count; n++) {
+        const auto vd = catalog_device(
             catalog_path,
-            plugin_factory->device_name(n),
-            dev_desc
+            plugin_factory->device_name(n)
+        );
+        if (!vd) {
+            ++failed;
+            std::println(
+                ss,
+                "Failed to start a mock device: {}",
+                vd.error().message()
+            );
+            continue;
+        }
+
+        pending.push_back(std::async(
+            std::launch::async,
+            [this, &dev_desc, pace](
+                const std::uint64_t id,
+                const viu::usb::mock_plugin plugin,
+                vhci::port_manager::lease port_lease
+            ) {
+                build_device(id, [&] {
+                    const auto& desc = dev_desc->device_descriptor();
+                    return device_info{
+                        desc.idVendor,
+                        desc.idProduct,
+                        std::make_shared<viu::device::mock>(
+                            dev_desc,
+                            plugin,
+                            std::move(port_lease),
+                            pace
+                        )
+                    };
+                });
+            },
+            devices_.create(),
+            *vd,
+            std::move((*leases)[n])
+        ));
+    }
+
+    for (auto& device : pending) {
+        try {
+            device.get();
+        } catch (const std::exception& ex) {
+            ++failed;
+            std::println(ss, "Failed to start a mock device: {}", ex.what());
+        }
+    }
+
+    if (failed != 0) {
+        return viu::response::failure(
+            ss.str(),
+            viu::make_error(error::attach_failed, ss.str()).error()
         );
     }
 
@@ -284,25 +489,285 @@ auto service::app_mock(
 auto service::app_list_catalogs() -> viu::response
 {
     auto ss = std::stringstream{};
-    virtual_device_manager_.list_catalogs(ss);
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{catalogs_mutex_};
+        virtual_device_manager_.list_catalogs(ss);
+    }
+
     return viu::response::success(ss.str());
 }
 
 auto service::app_plug(
-    const std::filesystem::path& config_path,
-    const std::filesystem::path& catalog_path,
-    const std::string& device_name
+    const std::vector<plug_request>& requests,
+    const viu::usb::pacing pace
 ) -> viu::response
 {
-    auto dev_desc = viu::usb::descriptor::tree{};
-    dev_desc.load(config_path);
+    using tree_pointer = std::shared_ptr<const viu::usb::descriptor::tree>;
+    using lease_list = std::vector<vhci::port_manager::lease>;
+    static constexpr auto enumeration_timeout = std::chrono::seconds{10};
+    static constexpr auto max_starting = std::size_t{16};
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Every entry is checked before a port is reserved or a device started,
+    // a plug naming a device its catalog does not offer fails as a whole.
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{catalogs_mutex_};
+        for (const auto& request : requests) {
+            if (virtual_device_manager_.has_device(
+                    request.catalog_path.string(),
+                    request.device_name
+                )) {
+                continue;
+            }
+
+            const auto message = std::format(
+                "Catalog {} has no device '{}'",
+                request.catalog_path.string(),
+                request.device_name
+            );
+            return viu::response::failure(
+                message,
+                viu::make_error(error::invalid_argument, message).error()
+            );
+        }
+    }
+
+    // Every configuration is parsed once, its devices share the tree.
+    auto trees = std::map<std::filesystem::path, tree_pointer>{};
+    auto wanted = std::map<::usb_device_speed, std::size_t>{};
+    auto total = std::size_t{};
+    for (const auto& request : requests) {
+        auto [it, inserted] = trees.try_emplace(request.config_path);
+        if (inserted) {
+            auto tree = viu::usb::descriptor::tree{};
+            tree.load(request.config_path);
+            it->second = std::make_shared<const viu::usb::descriptor::tree>(
+                std::move(tree)
+            );
+        }
+
+        const auto bcd_usb = it->second->device_descriptor().bcdUSB;
+        wanted[vhci::driver::to_speed_enum(bcd_usb)] += request.count;
+        total += request.count;
+    }
+
+    // The ports of all devices are reserved before the first one starts, a
+    // plug that does not fit fails as a whole.
+    auto leases = std::map<::usb_device_speed, lease_list>{};
+    for (const auto& [speed, count] : wanted) {
+        auto batch = vhci::port_manager::instance().reserve(speed, count);
+        if (!batch) {
+            const auto message = std::format(
+                "Not enough free {} vhci ports for {} device(s)",
+                vhci::speed_name(speed),
+                count
+            );
+            return viu::response::failure(
+                message,
+                viu::make_error(error::no_free_port, message).error()
+            );
+        }
+
+        leases.emplace(speed, std::move(*batch));
+    }
+
+    using enumerated_type = std::optional<std::chrono::milliseconds>;
+
+    struct started {
+        std::uint64_t id;
+        std::string_view name;
+        std::future<enumerated_type> enumerated;
+    };
 
-    create_mock_device_from_catalog(catalog_path, device_name, dev_desc);
+    // Devices start and enumerate on a pool of their own. This command
+    // holds one of workers_ while it waits for them, enough plugs at once
+    // would leave none to run them there.
+    auto starting = boost::asio::thread_pool{std::min(total, max_starting)};
+
+    auto pending = std::vector<started>{};
+    for (const auto& request : requests) {
+        const auto& tree = trees.at(request.config_path);
+        const auto speed = vhci::driver::to_speed_enum(
+            tree->device_descriptor().bcdUSB
+        );
+
+        for (std::size_t n = 0; n < request.count; n++) {
+            auto& batch = leases.at(speed);
+            auto port_lease = std::move(batch.back());
+            batch.pop_back();
+
+            const auto id = devices_.create();
+
+            auto enumerate = std::packaged_task<enumerated_type()>{
+                [this,
+                 id,
+                 &request,
+                 tree,
+                 start,
+                 pace,
+                 port_lease = std::move(port_lease)]() mutable
+                -> enumerated_type {
+                    build_device(id, [&] {
+                        const auto vd = catalog_device(
+                            request.catalog_path,
+                            request.device_name
+                        );
+                        if (!vd) {
+                            throw std::runtime_error{
+                                std::string(vd.error().message())
+                            };
+                        }
+
+                        const auto& desc = tree->device_descriptor();
+                        return device_info{
+                            desc.idVendor,
+                            desc.idProduct,
+                            std::make_shared<viu::device::mock>(
+                                tree,
+                                *vd,
+                                std::move(port_lease),
+                                pace
+                            )
+                        };
+                    });
+
+                    // Through the registry, an unplug meanwhile finishes
+                    // once this lets go.
+                    const auto device = find_device(id);
+                    if (!device ||
+                        !device->wait_configured(enumeration_timeout)) {
+                        return std::nullopt;
+                    }
+
+                    return std::chrono::duration_cast<
+                        std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start
+                    );
+                }
+            };
+
+            pending.push_back(
+                {id, request.device_name, enumerate.get_future()}
+            );
+            boost::asio::post(starting, std::move(enumerate));
+        }
+    }
 
     auto ss = std::stringstream{};
-    std::println(ss, "Device '{}' plugged successfully", device_name);
+    auto enumerated_count = std::size_t{};
+    auto timed_out_count = std::size_t{};
+    for (auto& device : pending) {
+        try {
+            if (const auto elapsed = device.enumerated.get(); elapsed) {
+                ++enumerated_count;
+                std::println(
+                    ss,
+                    "  id: {}, '{}', enumerated in {} ms",
+                    device.id,
+                    device.name,
+                    elapsed->count()
+                );
+            } else {
+                ++timed_out_count;
+                std::println(
+                    ss,
+                    "  id: {}, '{}', not enumerated within {} s",
+                    device.id,
+                    device.name,
+                    enumeration_timeout.count()
+                );
+            }
+        } catch (const std::exception& ex) {
+            std::println(
+                ss,
+                "  id: {}, '{}', failed: {}",
+                device.id,
+                device.name,
+                ex.what()
+            );
+        }
+    }
 
-    return viu::response::success(ss.str());
+    const auto message = std::format(
+        "Plugged {} device(s), {} enumerated\n{}",
+        std::size(pending),
+        enumerated_count,
+        ss.str()
+    );
+
+    if (enumerated_count != std::size(pending)) {
+        const auto timed_out =
+            enumerated_count + timed_out_count == std::size(pending);
+        return viu::response::failure(
+            message,
+            viu::make_error(
+                timed_out ? error::timed_out : error::attach_failed,
+                message
+            )
+                .error()
+        );
+    }
+
+    return viu::response::success(message);
+}
+
+auto service::parse_plug_manifest(const std::filesystem::path& path)
+    -> viu::result<std::vector<plug_request>>
+{
+    auto file = std::ifstream{path};
+    if (!file) {
+        return viu::make_error(
+            error::invalid_argument,
+            std::format("Cannot open manifest {}", path.string())
+        );
+    }
+
+    auto requests = std::vector<plug_request>{};
+    auto line = std::string{};
+    auto line_number = std::size_t{};
+    while (std::getline(file, line)) {
+        ++line_number;
+
+        const auto invalid = [&](std::string_view reason) {
+            return viu::make_error(
+                error::invalid_argument,
+                std::format("{}:{}: {}", path.string(), line_number, reason)
+            );
+        };
+
+        auto words = std::vector<std::string>{};
+        try {
+            words = cli::split_command_line(line);
+        } catch (const std::exception& ex) {
+            return invalid(ex.what());
+        }
+
+        if (words.empty() || words.front().starts_with('#')) {
+            continue;
+        }
+
+        if (std::size(words) < 3 || std::size(words) > 4) {
+            return invalid("expected <config> <catalog> <device-name> [count]");
+        }
+
+        auto request = plug_request{words[0], words[1], words[2]};
+        if (std::size(words) == 4) {
+            const auto& count = words[3];
+            const auto parsed = std::from_chars(
+                count.data(),
+                count.data() + std::size(count),
+                request.count
+            );
+            if (parsed.ec != std::errc{} || request.count == 0) {
+                return invalid(std::format("invalid count '{}'", count));
+            }
+        }
+
+        requests.push_back(std::move(request));
+    }
+
+    return requests;
 }
 
 auto service::app_version() -> viu::response
@@ -317,33 +782,273 @@ auto service::app_list() -> viu::response
     auto ss = std::stringstream{};
     std::println(ss, "Connected Devices:");
 
-    if (virtual_devices_.empty()) {
+    auto empty = true;
+    devices_.for_each([&](auto id, auto state, const auto& info) {
+        empty = false;
+
+        if (!info) {
+            std::println(ss, "  id: {}, {}", id, state_name(state));
+            return;
+        }
+
+        const auto speed = info->proxy->link_speed();
+        std::println(
+            ss,
+            "  id: {}, {:04x}:{:04x}, {}",
+            id,
+            info->vid,
+            info->pid,
+            speed ? vhci::speed_name(*speed) : "detached"
+        );
+    });
+
+    if (empty) {
         std::println(ss, "  No devices connected");
-    } else {
-        for (const auto& [id, info] : virtual_devices_) {
-            std::println(ss, "  id: {}, {:04x}:{:04x}", id, info.vid, info.pid);
+    }
+
+    if (auto& ports = vhci::port_manager::instance(); ports.is_available()) {
+        const auto usage = ports.utilization();
+        std::println(
+            ss,
+            "VHCI ports on {} controller(s): high-speed {}/{}, "
+            "super-speed {}/{}",
+            usage.controllers,
+            usage.high_speed_used,
+            usage.high_speed_ports,
+            usage.super_speed_used,
+            usage.super_speed_ports
+        );
+    }
+
+    return viu::response::success(ss.str());
+}
+
+auto service::app_stats(const std::optional<std::uint64_t> device_id)
+    -> viu::response
+{
+    if (device_id && !find_device(*device_id)) {
+        return device_not_found(*device_id);
+    }
+
+    auto ss = std::stringstream{};
+    devices_.for_each([&](auto id, auto state, const auto& info) {
+        if ((device_id && id != *device_id) || !info) {
+            return;
         }
+
+        std::println(
+            ss,
+            "id: {}, {:04x}:{:04x}, {}",
+            id,
+            info->vid,
+            info->pid,
+            state_name(state)
+        );
+        metrics::print(
+            ss,
+            info->proxy->urb_metrics(),
+            info->proxy->transfer_metrics(),
+            info->proxy->queue_depths()
+        );
+    });
+
+    if (ss.view().empty()) {
+        std::println(ss, "No devices connected");
     }
 
     return viu::response::success(ss.str());
 }
 
-auto service::app_unplug(std::uint64_t device_id) -> viu::response
+auto service::app_trace(
+    const std::chrono::milliseconds duration,
+    const std::optional<std::filesystem::path>& output
+) -> viu::response
 {
-    auto it = virtual_devices_.find(device_id);
-    if (it == virtual_devices_.end()) {
-        auto ss = std::stringstream{};
-        std::println(ss, "Device with id {} not found", device_id);
+    static constexpr auto max_duration = std::chrono::minutes{1};
+
+    if constexpr (!trace::compiled_in) {
         return viu::response::failure(
-            ss.str(),
-            viu::make_error(error::invalid_argument, "Device not found").error()
+            "viud was built without VIU_TRACING",
+            viu::make_error(error::invalid_argument, "Not supported").error()
+        );
+    }
+
+    if (duration > max_duration) {
+        const auto message = std::format(
+            "A trace runs for at most {} ms",
+            std::chrono::milliseconds{max_duration}.count()
+        );
+        return viu::response::failure(
+            message,
+            viu::make_error(error::invalid_argument, message).error()
+        );
+    }
+
+    auto session = trace::session{};
+    if (!session.active()) {
+        return viu::response::failure(
+            "Another trace is already running",
+            viu::make_error(error::invalid_argument, "Trace busy").error()
+        );
+    }
+
+    // Only one trace runs at a time, its wait ends early when the daemon
+    // shuts down.
+    auto io = boost::asio::io_context{};
+    auto timer = boost::asio::steady_timer{io, duration};
+    timer.async_wait([](const boost::system::error_code& /*unused*/) {});
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{trace_mutex_};
+        trace_io_ = &io;
+    }
+    io.run();
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{trace_mutex_};
+        trace_io_ = nullptr;
+    }
+
+    const auto events = session.stop();
+
+    auto names = std::map<std::uint32_t, std::string>{};
+    devices_.for_each([&](auto id, auto /*unused*/, const auto& info) {
+        if (info) {
+            names[info->proxy->trace_source()] = std::format(
+                "device {} ({:04x}:{:04x})",
+                id,
+                info->vid,
+                info->pid
+            );
+        }
+    });
+
+    auto json = trace::to_chrome_json(events, names);
+    if (!output) {
+        return viu::response::success(std::move(json));
+    }
+
+    auto file = std::ofstream{*output};
+    file << json;
+    if (!file) {
+        const auto message =
+            std::format("Failed to write {}", output->string());
+        return viu::response::failure(
+            message,
+            viu::make_error(error::invalid_argument, message).error()
+        );
+    }
+
+    return viu::response::success(
+        std::format(
+            "{} events written to {}",
+            std::size(events),
+            output->string()
+        )
+    );
+}
+
+auto service::app_unplug(std::uint64_t device_id, const bool wait)
+    -> viu::response
+{
+    static constexpr auto wait_timeout = std::chrono::seconds{30};
+
+    auto info = devices_.begin_teardown(device_id);
+
+    if (!info) {
+        if (devices_.state(device_id) != device_state::draining) {
+            return device_not_found(device_id);
+        }
+
+        if (!wait) {
+            return viu::response::success("Device is already being unplugged");
+        }
+    } else {
+        // Commands and scrapes that looked the device up before it started
+        // draining may still hold it. Whoever lets go last destroys it,
+        // which detaches it and joins its threads, and finishes the
+        // teardown.
+        std::get_deleter<device_owner>(info->proxy)->on_released =
+            [this, device_id] { devices_.finish_teardown(device_id); };
+        boost::asio::post(workers_, [info = std::move(info)]() mutable {
+            info.reset();
+        });
+
+        if (!wait) {
+            return viu::response::success(
+                std::format("Device {} is being unplugged", device_id)
+            );
+        }
+    }
+
+    if (!devices_.wait_gone(device_id, wait_timeout)) {
+        const auto message = std::format(
+            "Device {} did not finish unplugging in time",
+            device_id
+        );
+        return viu::response::failure(
+            message,
+            viu::make_error(error::timed_out, message).error()
         );
     }
 
-    virtual_devices_.erase(it);
     return viu::response::success("Device unplugged successfully");
 }
 
+auto service::app_detach(std::uint64_t device_id) -> viu::response
+{
+    const auto device = find_device(device_id);
+    if (device == nullptr) {
+        return device_not_found(device_id);
+    }
+
+    if (!device->detach()) {
+        return viu::response::failure(
+            "Device is not attached",
+            viu::make_error(error::invalid_argument, "Not attached").error()
+        );
+    }
+
+    devices_.set_attached(device_id, false);
+    return viu::response::success("Device detached successfully");
+}
+
+auto service::app_attach(std::uint64_t device_id) -> viu::response
+{
+    const auto device = find_device(device_id);
+    if (device == nullptr) {
+        return device_not_found(device_id);
+    }
+
+    if (!device->reattach()) {
+        return viu::response::failure(
+            "Device is already attached",
+            viu::make_error(error::invalid_argument, "Attached").error()
+        );
+    }
+
+    devices_.set_attached(device_id, true);
+    return viu::response::success("Device attached successfully");
+}
+
+auto service::app_replug(std::uint64_t device_id) -> viu::response
+{
+    const auto device = find_device(device_id);
+    if (device == nullptr) {
+        return device_not_found(device_id);
+    }
+
+    std::ignore = device->detach();
+    if (!device->reattach()) {
+        devices_.set_attached(device_id, false);
+        return viu::response::failure(
+            "Device could not be attached",
+            viu::make_error(error::invalid_argument, "Not attached").error()
+        );
+    }
+
+    devices_.set_attached(device_id, true);
+    return viu::response::success("Device replugged successfully");
+}
+
 auto service::run_proxydev_command(const std::span<const char*>& args)
     -> viu::response
 {
@@ -402,7 +1107,8 @@ auto service::run_save_command(const std::span<const char*>& args)
         "file,f",
         po::value<std::filesystem::path>(&path),
         "Configuration path"
-    );
+    )
+    ("binary,b", "Save a binary descriptor image");
     // clang-format on
 
     const auto vm = parse_command(args, desc);
@@ -419,7 +1125,11 @@ auto service::run_save_command(const std::span<const char*>& args)
         );
     }
 
-    return app_save_config(device.vid(), device.pid(), path);
+    const auto format = vm.count("binary") != 0
+                            ? viu::usb::descriptor::file_format::binary
+                            : viu::usb::descriptor::file_format::text;
+
+    return app_save_config(device.vid(), device.pid(), path, format);
 }
 
 auto service::run_save_hid_report(const std::span<const char*>& args)
@@ -480,6 +1190,11 @@ auto service::run_mock_command(const std::span<const char*>& args)
         "catalog,m",
         po::value<std::filesystem::path>(&catalog_path),
         "Path to a device catalog"
+    )
+    (
+        "no-pacing",
+        "Complete interrupt and iso IN transfers as soon as the plugin does, "
+        "instead of once per endpoint interval"
     );
     // clang-format on
 
@@ -497,7 +1212,7 @@ auto service::run_mock_command(const std::span<const char*>& args)
         );
     }
 
-    return app_mock(device_config_path, catalog_path);
+    return app_mock(device_config_path, catalog_path, pacing_of(vm));
 }
 
 auto service::run_list_catalogs_command(const std::span<const char*>& args)
@@ -528,6 +1243,8 @@ auto service::run_plug_command(const std::span<const char*>& args)
     auto config_path = std::filesystem::path{};
     auto catalog_path = std::filesystem::path{};
     auto device_name = std::string{};
+    auto count = std::size_t{1};
+    auto manifest_path = std::filesystem::path{};
     // clang-format off
     desc.add_options()
     ("help,h", "Show this message")
@@ -545,6 +1262,22 @@ auto service::run_plug_command(const std::span<const char*>& args)
         "device-name,n",
         po::value<std::string>(&device_name),
         "Name of the device to plug"
+    )
+    (
+        "count,k",
+        po::value<std::size_t>(&count),
+        "Number of devices to plug, 1 by default"
+    )
+    (
+        "manifest,f",
+        po::value<std::filesystem::path>(&manifest_path),
+        "File listing '<config> <catalog> <device-name> [count]' per line, "
+        "used instead of the options above"
+    )
+    (
+        "no-pacing",
+        "Complete interrupt and iso IN transfers as soon as the plugin does, "
+        "instead of once per endpoint interval"
     );
     // clang-format on
 
@@ -555,6 +1288,18 @@ auto service::run_plug_command(const std::span<const char*>& args)
         return viu::response::success(ss.str());
     }
 
+    if (vm.count("manifest")) {
+        const auto requests = parse_plug_manifest(manifest_path);
+        if (!requests) {
+            return viu::response::failure(
+                std::string(requests.error().message()),
+                requests.error()
+            );
+        }
+
+        return app_plug(*requests, pacing_of(vm));
+    }
+
     if (auto res =
             check_cli_params(vm, desc, {"config", "catalog", "device-name"});
         !res) {
@@ -564,7 +1309,17 @@ auto service::run_plug_command(const std::span<const char*>& args)
         );
     }
 
-    return app_plug(config_path, catalog_path, device_name);
+    if (count == 0) {
+        return viu::response::failure(
+            "--count must be at least 1",
+            viu::make_error(error::invalid_argument, "Invalid count").error()
+        );
+    }
+
+    return app_plug(
+        {{config_path, catalog_path, device_name, count}},
+        pacing_of(vm)
+    );
 }
 
 auto service::run_version_command(const std::span<const char*>& args)
@@ -593,6 +1348,71 @@ auto service::run_list_command(const std::span<const char*>& args)
     return app_list();
 }
 
+auto service::run_stats_command(const std::span<const char*>& args)
+    -> viu::response
+{
+    namespace po = boost::program_options;
+    auto desc = po::options_description{"Show transfer counters and latencies"};
+    auto device_id = std::uint64_t{0};
+    // clang-format off
+    desc.add_options()
+    ("help,h", "Show this message")
+    (
+        "device-id,i",
+        po::value<std::uint64_t>(&device_id),
+        "Device id, all devices if omitted"
+    );
+    // clang-format on
+
+    const auto vm = parse_command(args, desc);
+    if (vm.count("help")) {
+        auto ss = std::stringstream{};
+        desc.print(ss);
+        return viu::response::success(ss.str());
+    }
+
+    return app_stats(
+        vm.count("device-id") != 0 ? std::optional{device_id} : std::nullopt
+    );
+}
+
+auto service::run_trace_command(const std::span<const char*>& args)
+    -> viu::response
+{
+    namespace po = boost::program_options;
+    auto desc = po::options_description{
+        "Trace URBs and print them as Chrome trace JSON"
+    };
+    auto duration = std::uint64_t{1000};
+    auto output = std::filesystem::path{};
+    // clang-format off
+    desc.add_options()
+    ("help,h", "Show this message")
+    (
+        "duration,d",
+        po::value<std::uint64_t>(&duration),
+        "Milliseconds to trace, 1000 if omitted and at most 60000"
+    )
+    (
+        "output,o",
+        po::value<std::filesystem::path>(&output),
+        "Write the trace to this file instead of printing it"
+    );
+    // clang-format on
+
+    const auto vm = parse_command(args, desc);
+    if (vm.count("help")) {
+        auto ss = std::stringstream{};
+        desc.print(ss);
+        return viu::response::success(ss.str());
+    }
+
+    return app_trace(
+        std::chrono::milliseconds{duration},
+        vm.count("output") != 0 ? std::optional{output} : std::nullopt
+    );
+}
+
 auto service::run_unplug_command(const std::span<const char*>& args)
     -> viu::response
 {
@@ -605,7 +1425,47 @@ auto service::run_unplug_command(const std::span<const char*>& args)
     (
         "device-id,i",
         po::value<std::uint64_t>(&device_id),
-        "Device id to unplug"
+        "Device id"
+    )
+    (
+        "wait,w",
+        "Return once the device is gone instead of when its teardown starts"
+    );
+    // clang-format on
+
+    const auto vm = parse_command(args, desc);
+    if (vm.count("help")) {
+        auto ss = std::stringstream{};
+        desc.print(ss);
+        return viu::response::success(ss.str());
+    }
+
+    if (auto res = check_cli_params(vm, desc, {"device-id"}); !res) {
+        return viu::response::failure(
+            std::string(res.error().message()),
+            res.error()
+        );
+    }
+
+    return app_unplug(device_id, vm.count("wait") != 0);
+}
+
+auto service::run_device_id_command(
+    const std::span<const char*>& args,
+    const std::string& caption,
+    const std::function<viu::response(std::uint64_t)>& app
+) -> viu::response
+{
+    namespace po = boost::program_options;
+    auto desc = po::options_description{caption};
+    auto device_id = std::uint64_t{0};
+    // clang-format off
+    desc.add_options()
+    ("help,h", "Show this message")
+    (
+        "device-id,i",
+        po::value<std::uint64_t>(&device_id),
+        "Device id"
     );
     // clang-format on
 
@@ -623,10 +1483,131 @@ auto service::run_unplug_command(const std::span<const char*>& args)
         );
     }
 
-    return app_unplug(device_id);
+    return app(device_id);
+}
+
+auto service::run_batch_command(
+    const std::span<const char*>& args,
+    const emit_type& emit
+) -> viu::response
+{
+    namespace po = boost::program_options;
+    auto desc = po::options_description{"Run a script of commands"};
+    auto script = std::string{};
+    // clang-format off
+    desc.add_options()
+    ("help,h", "Show this message")
+    (
+        "script,s",
+        po::value<std::string>(&script),
+        "Commands, one per line. Empty lines and lines starting with '#' "
+        "are skipped"
+    );
+    // clang-format on
+
+    const auto vm = parse_command(args, desc);
+    if (vm.count("help")) {
+        auto ss = std::stringstream{};
+        desc.print(ss);
+        return viu::response::success(ss.str());
+    }
+
+    if (auto res = check_cli_params(vm, desc, {"script"}); !res) {
+        return viu::response::failure(
+            std::string(res.error().message()),
+            res.error()
+        );
+    }
+
+    auto lines = std::istringstream{script};
+    auto line = std::string{};
+    auto line_number = std::size_t{};
+    auto succeeded = std::size_t{};
+    auto failed = std::size_t{};
+
+    while (std::getline(lines, line)) {
+        ++line_number;
+
+        auto words = std::vector<std::string>{};
+        try {
+            words = cli::split_command_line(line);
+        } catch (const std::exception& ex) {
+            ++failed;
+            emit(viu::response::failure(
+                std::format("[{}] {}", line_number, ex.what()),
+                viu::make_error(error::invalid_argument, ex.what()).error()
+            ));
+            continue;
+        }
+
+        if (words.empty() || words.front().starts_with('#')) {
+            continue;
+        }
+
+        words.insert(std::begin(words), std::string{args[0]});
+        auto argv = std::vector<const char*>{};
+        std::ranges::transform(
+            words,
+            std::back_inserter(argv),
+            &std::string::c_str
+        );
+
+        auto response = viu::response{};
+        try {
+            response = execute_from_argv(
+                static_cast<int>(std::size(argv)),
+                argv.data(),
+                emit
+            );
+        } catch (const std::exception& ex) {
+            response = viu::response::failure(
+                ex.what(),
+                viu::make_error(error::invalid_argument, ex.what()).error()
+            );
+        }
+
+        const auto message = std::format(
+            "[{}] {}\n{}",
+            line_number,
+            line,
+            response.message()
+        );
+
+        if (response.is_success()) {
+            ++succeeded;
+            emit(viu::response::success(message));
+        } else {
+            ++failed;
+            emit(viu::response::failure(message, *response.error_value()));
+        }
+    }
+
+    const auto summary = std::format(
+        "Batch finished: {} succeeded, {} failed",
+        succeeded,
+        failed
+    );
+
+    if (failed != 0) {
+        return viu::response::failure(
+            summary,
+            viu::make_error(error::invalid_argument, summary).error()
+        );
+    }
+
+    return viu::response::success(summary);
 }
 
 auto service::execute_from_argv(int argc, const char* argv[]) -> viu::response
+{
+    return execute_from_argv(argc, argv, [](const viu::response&) {});
+}
+
+auto service::execute_from_argv(
+    int argc,
+    const char* argv[],
+    const emit_type& emit
+) -> viu::response
 {
     namespace po = boost::program_options;
 
@@ -665,8 +1646,44 @@ auto service::execute_from_argv(int argc, const char* argv[]) -> viu::response
          [this](const std::span<const char*>& args) {
              return run_list_command(args);
          }},
-        {"unplug", [this](const std::span<const char*>& args) {
+        {"stats",
+         [this](const std::span<const char*>& args) {
+             return run_stats_command(args);
+         }},
+        {"trace",
+         [this](const std::span<const char*>& args) {
+             return run_trace_command(args);
+         }},
+        {"unplug",
+         [this](const std::span<const char*>& args) {
              return run_unplug_command(args);
+         }},
+        {"detach",
+         [this](const std::span<const char*>& args) {
+             return run_device_id_command(
+                 args,
+                 "Disconnect a virtual device, keeping it alive",
+                 [this](std::uint64_t id) { return app_detach(id); }
+             );
+         }},
+        {"attach",
+         [this](const std::span<const char*>& args) {
+             return run_device_id_command(
+                 args,
+                 "Connect a detached virtual device again",
+                 [this](std::uint64_t id) { return app_attach(id); }
+             );
+         }},
+        {"replug",
+         [this](const std::span<const char*>& args) {
+             return run_device_id_command(
+                 args,
+                 "Detach and attach a virtual device on a fresh port",
+                 [this](std::uint64_t id) { return app_replug(id); }
+             );
+         }},
+        {"batch", [this, &emit](const std::span<const char*>& args) {
+             return run_batch_command(args, emit);
          }}
     };
 
@@ -705,61 +1722,444 @@ auto service::execute_from_argv(int argc, const char* argv[]) -> viu::response
     );
 }
 
+// One client connection. Socket I/O runs on the io_context thread, the
+// commands themselves on the worker pool, so a slow command or a stalled
+// client never holds up other connections. Requests on a connection are
+// answered in order, the next request is read once every frame of the
+// previous answer is written, so clients may pipeline requests.
+class service::session : public std::enable_shared_from_this<session> {
+public:
+    session(service& owner, stream_protocol::socket socket)
+        : owner_{owner}, socket_{std::move(socket)}
+    {
+    }
+
+    void start() { read_size(); }
+
+private:
+    struct frame {
+        std::string data;
+        bool last;
+    };
+
+    void read_size()
+    {
+        boost::asio::async_read(
+            socket_,
+            boost::asio::buffer(&size_, sizeof(size_)),
+            [self = shared_from_this()](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (!ec) {
+                    self->read_payload();
+                }
+            }
+        );
+    }
+
+    void read_payload()
+    {
+        payload_.resize(size_);
+        boost::asio::async_read(
+            socket_,
+            boost::asio::buffer(payload_),
+            [self = shared_from_this()](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (ec) {
+                    std::println(std::cerr, "Daemon error: {}", ec.message());
+                    return;
+                }
+
+                self->execute();
+            }
+        );
+    }
+
+    void execute()
+    {
+        boost::asio::post(owner_.workers_, [self = shared_from_this()] {
+            self->owner_.busy_workers_.add();
+            const auto response = self->owner_.execute_request(
+                self->payload_,
+                [&self](const viu::response& partial) {
+                    self->post_frame(partial, false);
+                }
+            );
+            self->owner_.busy_workers_.sub();
+
+            self->post_frame(response, true);
+        });
+    }
+
+    void post_frame(const viu::response& response, const bool last)
+    {
+        boost::asio::post(
+            socket_.get_executor(),
+            [self = shared_from_this(), data = response.serialize(), last](
+            ) mutable { self->queue_frame({std::move(data), last}); }
+        );
+    }
+
+    void queue_frame(frame f)
+    {
+        frames_.push_back(std::move(f));
+        if (std::size(frames_) == 1) {
+            write_frame();
+        }
+    }
+
+    void write_frame()
+    {
+        const auto& f = frames_.front();
+        header_ = cli::frame_header{
+            .size = static_cast<std::uint32_t>(std::size(f.data)),
+            .flags = f.last ? 0 : cli::frame_more
+        };
+
+        const auto buffers = std::array{
+            boost::asio::const_buffer{&header_, sizeof(header_)},
+            boost::asio::const_buffer{f.data.data(), std::size(f.data)}
+        };
+
+        boost::asio::async_write(
+            socket_,
+            buffers,
+            [self = shared_from_this()](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (ec) {
+                    return;
+                }
+
+                const auto last = self->frames_.front().last;
+                self->frames_.pop_front();
+
+                if (!self->frames_.empty()) {
+                    self->write_frame();
+                } else if (last) {
+                    self->read_size();
+                }
+            }
+        );
+    }
+
+    service& owner_;
+    stream_protocol::socket socket_;
+    std::uint32_t size_{};
+    std::vector<char> payload_{};
+    cli::frame_header header_{};
+    std::deque<frame> frames_{};
+};
+
+auto service::execute_request(
+    const std::vector<char>& payload,
+    const emit_type& emit
+) -> viu::response
+{
+    try {
+        auto args = viu::cli::deserialize_argv(
+            static_cast<const char*>(payload.data()),
+            payload.size()
+        );
+
+        return execute_from_argv(
+            args.argc,
+            (const char**)(args.argv_storage.data()),
+            emit
+        );
+    } catch (const std::exception& ex) {
+        const auto message = std::format(
+            "Failed to execute command: {}",
+            ex.what()
+        );
+        std::println(std::cerr, "{}", message);
+
+        return viu::response::failure(
+            message,
+            viu::make_error(error::invalid_argument, message).error()
+        );
+    }
+}
+
 void service::handle_accept(
-    std::function<void()>& do_accept,
-    std::shared_ptr<boost::asio::local::stream_protocol::socket> socket,
     const boost::system::error_code& ec,
-    boost::asio::local::stream_protocol::acceptor& acceptor,
-    const std::filesystem::path& path
+    stream_protocol::socket socket
 )
 {
-    if (!ec) {
-        auto size = std::uint32_t{};
-        boost::asio::read(*socket, boost::asio::buffer(&size, sizeof(size)));
+    if (ec) {
+        std::println(std::cerr, "Daemon error: {}", ec.message());
+        return;
+    }
+
+    std::make_shared<session>(*this, std::move(socket))->start();
+}
+
+// One scrape of the metrics exporter: a minimal HTTP/1.0 exchange, so that
+// `curl --unix-socket` or a scraper behind a socket proxy can read it.
+class service::scrape : public std::enable_shared_from_this<scrape> {
+public:
+    scrape(service& owner, stream_protocol::socket socket)
+        : owner_{owner}, socket_{std::move(socket)}
+    {
+    }
 
-        auto payload = std::vector<char>(size);
-        boost::asio::read(
-            *socket,
-            boost::asio::buffer(payload.data(), payload.size())
+    void start()
+    {
+        boost::asio::async_read_until(
+            socket_,
+            request_,
+            "\r\n\r\n",
+            [self = shared_from_this()](
+                const boost::system::error_code& ec,
+                std::size_t /*unused*/
+            ) {
+                if (!ec) {
+                    self->respond();
+                }
+            }
         );
+    }
 
-        if (!ec) {
-            try {
-                auto args = viu::cli::deserialize_argv(
-                    static_cast<const char*>(payload.data()),
-                    payload.size()
-                );
+private:
+    void respond()
+    {
+        const auto body = owner_.render_metrics();
+        response_ = std::format(
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; "
+            "charset=utf-8\r\n"
+            "Content-Length: {}\r\n"
+            "\r\n"
+            "{}",
+            std::size(body),
+            body
+        );
 
-                auto response = execute_from_argv(
-                    args.argc,
-                    (const char**)(args.argv_storage.data())
+        boost::asio::async_write(
+            socket_,
+            boost::asio::buffer(response_),
+            [self = shared_from_this()](
+                const boost::system::error_code& /*unused*/,
+                std::size_t /*unused*/
+            ) {
+                auto ec = boost::system::error_code{};
+                self->socket_.shutdown(
+                    stream_protocol::socket::shutdown_both,
+                    ec
                 );
+            }
+        );
+    }
 
-                std::string serialized = response.serialize();
+    service& owner_;
+    stream_protocol::socket socket_;
+    boost::asio::streambuf request_{};
+    std::string response_{};
+};
 
-                auto size = static_cast<std::uint32_t>(std::size(serialized));
-                boost::asio::write(
-                    *socket,
-                    boost::asio::buffer(&size, sizeof(size))
-                );
+// Reads only atomics of the devices, a scrape never waits for a lock that
+// the transfer path takes. The registry lock is held just long enough to
+// copy the device list.
+auto service::render_metrics() -> std::string
+{
+    using metrics::openmetrics;
+    using metrics::urb_counters;
+
+    auto devices = std::vector<std::pair<std::string, device_info>>{};
+    auto states = std::map<device_state, std::size_t>{};
+    devices_.for_each([&](auto id, auto state, const auto& info) {
+        ++states[state];
+        if (info) {
+            devices.emplace_back(std::to_string(id), *info);
+        }
+    });
 
-                boost::asio::write(*socket, boost::asio::buffer(serialized));
+    // Calls visit(device, ep, urbs, transfers) for endpoints with traffic.
+    const auto for_each_endpoint = [&](const auto& visit) {
+        for (const auto& [id, info] : devices) {
+            const auto& urbs = info.proxy->urb_metrics();
+            const auto& transfers = info.proxy->transfer_metrics();
+            for (auto ep = std::size_t{0}; ep < metrics::max_endpoints; ++ep) {
+                if (urbs[ep].submitted.value() == 0 &&
+                    transfers[ep].submitted.value() == 0) {
+                    continue;
+                }
+
+                visit(id, std::to_string(ep), urbs[ep], transfers[ep]);
+            }
+        }
+    };
 
-            } catch (const std::exception& ex) {
-                std::println(
-                    std::cerr,
-                    "Failed to execute command: {}",
-                    ex.what()
+    const auto seconds = [](const std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double>(ns).count();
+    };
+
+    auto om = openmetrics{};
+
+    om.family("viud_devices", "gauge", "Devices by lifecycle state");
+    for (const auto state :
+         {device_state::creating,
+          device_state::attached,
+          device_state::detached,
+          device_state::draining}) {
+        om.sample(
+            "viud_devices",
+            {{"state", state_name(state)}},
+            states[state]
+        );
+    }
+
+    // clang-format off
+    const auto urb_families = std::array{
+        std::tuple{"viud_urbs_submitted", "URBs read from usbip", &urb_counters::submitted},
+        std::tuple{"viud_urbs_completed", "URB replies sent to usbip", &urb_counters::completed},
+        std::tuple{"viud_urb_errors", "URBs completed with an error status", &urb_counters::errors},
+        std::tuple{"viud_urb_unlinks", "URBs unlinked by the host", &urb_counters::unlinks},
+        std::tuple{"viud_urbs_dropped", "URB replies that were not sent", &urb_counters::dropped},
+    };
+    // clang-format on
+
+    for (const auto& [name, help, member] : urb_families) {
+        om.family(name, "counter", help);
+
+        const auto total = std::format("{}_total", name);
+        for_each_endpoint([&](const auto& id,
+                              const auto& ep,
+                              const auto& urb,
+                              const auto& /*unused*/) {
+            om.sample(
+                total,
+                {{"device", id}, {"ep", ep}},
+                (urb.*member).value()
+            );
+        });
+    }
+
+    om.family("viud_urb_bytes", "counter", "URB payload bytes");
+    for_each_endpoint([&](const auto& id,
+                          const auto& ep,
+                          const auto& urb,
+                          const auto& /*unused*/) {
+        const auto sample = [&](std::string_view direction, const auto& c) {
+            om.sample(
+                "viud_urb_bytes_total",
+                {{"device", id}, {"ep", ep}, {"direction", direction}},
+                c.value()
+            );
+        };
+
+        sample("in", urb.bytes_in);
+        sample("out", urb.bytes_out);
+    });
+
+    om.family(
+        "viud_urb_reply_latency_seconds",
+        "histogram",
+        "Time from reading a URB to sending its reply"
+    );
+    for_each_endpoint([&](const auto& id,
+                          const auto& ep,
+                          const auto& urb,
+                          const auto& /*unused*/) {
+        om.sample(
+            "viud_urb_reply_latency_seconds",
+            {{"device", id}, {"ep", ep}},
+            urb.reply_latency
+        );
+    });
+
+    om.family("viud_transfers", "counter", "Transfers handed to the device");
+    for_each_endpoint([&](const auto& id,
+                          const auto& ep,
+                          const auto& /*unused*/,
+                          const auto& xfer) {
+        const auto sample = [&](std::string_view result, const auto& c) {
+            om.sample(
+                "viud_transfers_total",
+                {{"device", id}, {"ep", ep}, {"result", result}},
+                c.value()
+            );
+        };
+
+        sample("submitted", xfer.submitted);
+        sample("completed", xfer.completed);
+        sample("failed", xfer.failed);
+    });
+
+    om.family("viud_queue_depth", "gauge", "Items waiting in device queues");
+    for (const auto& [id, info] : devices) {
+        const auto depths = info.proxy->queue_depths();
+        const auto sample = [&](std::string_view queue,
+                                const std::size_t depth,
+                                const std::string_view ep = {}) {
+            if (ep.empty()) {
+                om.sample(
+                    "viud_queue_depth",
+                    {{"device", id}, {"queue", queue}},
+                    depth
+                );
+            } else {
+                om.sample(
+                    "viud_queue_depth",
+                    {{"device", id}, {"queue", queue}, {"ep", ep}},
+                    depth
                 );
             }
-        } else {
-            std::println(std::cerr, "Daemon error: {}", ec.message());
+        };
+
+        sample("commands", depths.commands);
+        sample("replies", depths.replies);
+        for (auto ep = std::size_t{0}; ep < metrics::max_endpoints; ++ep) {
+            if (depths.in_commands[ep] == 0 && depths.in_data[ep] == 0) {
+                continue;
+            }
+
+            const auto ep_label = std::to_string(ep);
+            sample("in_commands", depths.in_commands[ep], ep_label);
+            sample("in_data", depths.in_data[ep], ep_label);
         }
     }
 
-    if (acceptor.is_open()) {
-        do_accept();
+    om.family(
+        "viud_device_cpu_seconds",
+        "counter",
+        "CPU time of the device threads"
+    );
+    for (const auto& [id, info] : devices) {
+        om.sample(
+            "viud_device_cpu_seconds_total",
+            {{"device", id}},
+            seconds(info.proxy->thread_cpu_time())
+        );
+    }
+
+    auto ts = timespec{};
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        om.family("viud_process_cpu_seconds", "counter", "CPU time of viud");
+        om.sample(
+            "viud_process_cpu_seconds_total",
+            {},
+            seconds(
+                std::chrono::seconds{ts.tv_sec} +
+                std::chrono::nanoseconds{ts.tv_nsec}
+            )
+        );
     }
+
+    om.family("viud_workers", "gauge", "Command worker threads");
+    om.sample("viud_workers", {}, worker_count_);
+    om.family("viud_workers_busy", "gauge", "Workers running a command");
+    om.sample(
+        "viud_workers_busy",
+        {},
+        std::max(busy_workers_.value(), std::int64_t{0})
+    );
+
+    return std::move(om).finish();
 }
 
 auto service::run() -> int
@@ -771,28 +2171,72 @@ auto service::run() -> int
         stream_protocol::acceptor{io, stream_protocol::endpoint{path}};
     chmod(path.c_str(), 0777);
 
+    // The exporter shares the io_context, a scrape is a few atomic reads.
+    const auto metrics_path = metrics_socket_path();
+    auto metrics_acceptor = std::optional<stream_protocol::acceptor>{};
+    if (metrics_path) {
+        std::filesystem::remove(*metrics_path);
+        metrics_acceptor.emplace(io, stream_protocol::endpoint{*metrics_path});
+        chmod(metrics_path->c_str(), 0777);
+    }
+
     boost::asio::signal_set signals(io, SIGTERM, SIGINT);
     signals.async_wait([&](const boost::system::error_code&, int sig) {
         std::println("Received signal {}. Shutting down", sig);
         unlink(path.c_str());
         acceptor.close();
+        if (metrics_acceptor) {
+            unlink(metrics_path->c_str());
+            metrics_acceptor->close();
+        }
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{trace_mutex_};
+            if (trace_io_ != nullptr) {
+                trace_io_->stop();
+            }
+        }
+        io.stop();
     });
 
-    auto io_ptr = &io;
     std::function<void()> do_accept;
-    do_accept = [this, io_ptr, &acceptor, &do_accept, &path]() {
-        auto socket = std::make_shared<stream_protocol::socket>(*io_ptr);
-        acceptor.async_accept(
-            *socket,
-            [this, &do_accept, socket, &acceptor, &path](
-                boost::system::error_code ec
-            ) { handle_accept(do_accept, socket, ec, acceptor, path); }
-        );
+    do_accept = [this, &acceptor, &do_accept]() {
+        acceptor.async_accept([this, &acceptor, &do_accept](
+                                  const boost::system::error_code& ec,
+                                  stream_protocol::socket socket
+                              ) {
+            handle_accept(ec, std::move(socket));
+
+            if (acceptor.is_open()) {
+                do_accept();
+            }
+        });
+    };
+
+    std::function<void()> do_accept_scrape;
+    do_accept_scrape = [this, &metrics_acceptor, &do_accept_scrape]() {
+        metrics_acceptor->async_accept([this, &do_accept_scrape](
+                                           const boost::system::error_code& ec,
+                                           stream_protocol::socket socket
+                                       ) {
+            if (ec) {
+                return;
+            }
+
+            std::make_shared<scrape>(*this, std::move(socket))->start();
+            do_accept_scrape();
+        });
     };
 
     do_accept();
+    if (metrics_acceptor) {
+        do_accept_scrape();
+    }
+
     io.run();
 
+    // Let commands that are still running finish before the devices go.
+    workers_.join();
+
     return 0;
 }
 
@@ -0,0 +1,194 @@
+export module viu.daemon.registry;
+
+import std;
+
+namespace viu::daemon {
+
+export enum class device_state : std::uint8_t {
+    creating,
+    attached,
+    detached,
+    draining,
+    gone
+};
+
+export constexpr auto state_name(const device_state state) -> std::string_view
+{
+    switch (state) {
+        case device_state::creating:
+            return "creating";
+        case device_state::attached:
+            return "attached";
+        case device_state::detached:
+            return "detached";
+        case device_state::draining:
+            return "draining";
+        case device_state::gone:
+            return "gone";
+    }
+
+    return "unknown";
+}
+
+// Devices owned by the daemon, keyed by id. Every device moves through
+// creating -> attached -> draining -> gone, and between attached and
+// detached while it lives. Only live devices are handed out. Lookups
+// share the lock, so commands on different devices do not serialize
+// behind a device that is still being built or torn down: the expensive
+// parts run outside of the lock between the transitions.
+export template <typename T>
+class registry {
+public:
+    using id_type = std::uint64_t;
+
+    // Reserves an id for a device that is about to be built.
+    auto create() -> id_type
+    {
+        const auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+
+        [[maybe_unused]] const std::unique_lock<std::shared_mutex> _{mutex_};
+        entries_.emplace(id, entry{});
+        return id;
+    }
+
+    // Hands out a built device, `state` tells whether it made it onto the
+    // bus, attached or detached.
+    auto publish(
+        const id_type id,
+        T value,
+        const device_state state = device_state::attached
+    ) -> bool
+    {
+        [[maybe_unused]] const std::unique_lock<std::shared_mutex> _{mutex_};
+
+        const auto it = entries_.find(id);
+        if (it == std::end(entries_) ||
+            it->second.state != device_state::creating) {
+            return false;
+        }
+
+        it->second.value = std::move(value);
+        it->second.state = state;
+        return true;
+    }
+
+    // Records that a live device was attached to or detached from the bus.
+    auto set_attached(const id_type id, const bool attached) -> bool
+    {
+        [[maybe_unused]] const std::unique_lock<std::shared_mutex> _{mutex_};
+
+        const auto it = entries_.find(id);
+        if (it == std::end(entries_) || !is_live(it->second.state)) {
+            return false;
+        }
+
+        it->second.state = attached ? device_state::attached
+                                     : device_state::detached;
+        return true;
+    }
+
+    // Drops an id whose device failed to build.
+    void abandon(const id_type id)
+    {
+        erase_if(id, device_state::creating);
+    }
+
+    auto find(const id_type id) const -> std::optional<T>
+    {
+        [[maybe_unused]] const std::shared_lock<std::shared_mutex> _{mutex_};
+
+        const auto it = entries_.find(id);
+        if (it == std::end(entries_) || !is_live(it->second.state)) {
+            return std::nullopt;
+        }
+
+        return it->second.value;
+    }
+
+    // Ids that were never handed out or are already erased report `gone`.
+    auto state(const id_type id) const -> device_state
+    {
+        [[maybe_unused]] const std::shared_lock<std::shared_mutex> _{mutex_};
+
+        const auto it = entries_.find(id);
+        return it == std::end(entries_) ? device_state::gone
+                                        : it->second.state;
+    }
+
+    // Moves a live device to draining and hands its value to the
+    // caller, who destroys it and then calls finish_teardown().
+    auto begin_teardown(const id_type id) -> std::optional<T>
+    {
+        [[maybe_unused]] const std::unique_lock<std::shared_mutex> _{mutex_};
+
+        const auto it = entries_.find(id);
+        if (it == std::end(entries_) || !is_live(it->second.state)) {
+            return std::nullopt;
+        }
+
+        it->second.state = device_state::draining;
+        return std::exchange(it->second.value, std::nullopt);
+    }
+
+    void finish_teardown(const id_type id)
+    {
+        erase_if(id, device_state::draining);
+    }
+
+    auto wait_gone(const id_type id, const std::chrono::milliseconds timeout)
+        -> bool
+    {
+        auto lock = std::shared_lock<std::shared_mutex>{mutex_};
+        return gone_cv_.wait_for(lock, timeout, [&] {
+            return !entries_.contains(id);
+        });
+    }
+
+    // Visits every entry under the shared lock. Entries that are still
+    // being created or drained carry no value.
+    void for_each(const auto& visitor) const
+    {
+        [[maybe_unused]] const std::shared_lock<std::shared_mutex> _{mutex_};
+
+        for (const auto& [id, e] : entries_) {
+            visitor(id, e.state, e.value);
+        }
+    }
+
+private:
+    static constexpr auto is_live(const device_state state) -> bool
+    {
+        return state == device_state::attached ||
+               state == device_state::detached;
+    }
+
+    struct entry {
+        device_state state{device_state::creating};
+        std::optional<T> value{};
+    };
+
+    void erase_if(const id_type id, const device_state expected)
+    {
+        {
+            [[maybe_unused]] const std::unique_lock<std::shared_mutex> _{
+                mutex_
+            };
+
+            const auto it = entries_.find(id);
+            if (it == std::end(entries_) || it->second.state != expected) {
+                return;
+            }
+
+            entries_.erase(it);
+        }
+
+        gone_cv_.notify_all();
+    }
+
+    std::atomic<id_type> next_id_{0};
+    mutable std::shared_mutex mutex_{};
+    std::condition_variable_any gone_cv_{};
+    std::map<id_type, entry> entries_{};
+};
+
+} // namespace viu::daemon
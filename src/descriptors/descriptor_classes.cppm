@@ -7,6 +7,7 @@ export module viu.usb.descriptors:descriptor_classes;
 
 import std;
 
+import viu.io;
 import viu.types;
 import viu.vector;
 
@@ -34,18 +35,25 @@ struct libusb_wrap {
 
     virtual void wrap(const T& w) noexcept { wrapped_ = w; };
 
-    [[nodiscard]] auto extra() const -> extra_type;
+    [[nodiscard]] auto extra() const noexcept -> const extra_type&;
     [[nodiscard]] auto extra_length() const -> extra_type::size_type;
-    void fill_extra(const extra_type& extra);
+    void fill_extra(extra_type extra);
 
 protected:
     void stream_out_wrapped(std::ostream& os) const;
+    void stream_out_wrapped(io::bin::writer& out) const;
     void stream_in_wrapped(std::stringstream& is);
+    void stream_in_wrapped(io::bin::reader& in);
     void pack_wrapped(vector_type& out) const;
     void stream_in_extra(std::stringstream& is);
+    void stream_in_extra(io::bin::reader& in);
     void stream_out_extra(std::ostream& os) const;
+    void stream_out_extra(io::bin::writer& out) const;
     void pack_extra(vector_type& out) const;
-    [[nodiscard]] auto wrapped() const noexcept { return wrapped_; }
+    [[nodiscard]] auto wrapped() const noexcept -> const T&
+    {
+        return wrapped_;
+    }
     [[nodiscard]] auto wrapped() noexcept -> T& { return wrapped_; }
 
 private:
@@ -61,7 +69,9 @@ template <
     typename V>
 struct basic_descriptor : libusb_wrap<W, extra>, viu::vector::plugin<K, V> {
     void stream_out(std::ostream& os) const;
+    void stream_out(io::bin::writer& out) const;
     void stream_in(std::stringstream& is);
+    void stream_in(io::bin::reader& in);
     void pack(vector_type& out) const;
 };
 
@@ -108,6 +118,11 @@ export struct endpoint final : basic_descriptor<
     {
         return wrapped().bmAttributes;
     }
+
+    [[nodiscard]] auto interval() const noexcept
+    {
+        return wrapped().bInterval;
+    }
 };
 
 export struct interface final : basic_descriptor<
@@ -135,7 +150,12 @@ export struct config final : basic_descriptor<
 > {
     static constexpr auto self_powered_mask = std::uint8_t{0b10000000};
 
-    [[nodiscard]] auto is_self_powered() -> bool
+    [[nodiscard]] auto configuration_value() const noexcept
+    {
+        return wrapped().bConfigurationValue;
+    }
+
+    [[nodiscard]] auto is_self_powered() const noexcept -> bool
     {
         return (wrapped().bmAttributes & self_powered_mask) != 0;
     }
@@ -0,0 +1,118 @@
+module;
+
+#include <boost/describe.hpp>
+#include <boost/mp11.hpp>
+
+export module viu.usb.descriptors:layout;
+
+import std;
+
+import :traits;
+import :types;
+
+namespace viu::usb::descriptor {
+
+template <typename T>
+using public_members_of =
+    boost::describe::describe_members<T, boost::describe::mod_public>;
+
+template <typename... M>
+consteval auto sum_of_member_sizes(boost::mp11::mp_list<M...> /*unused*/)
+{
+    return (
+        std::size_t{0} + ... + sizeof(member_type_t<decltype(M::pointer)>)
+    );
+}
+
+// Wire layout of a boost described descriptor: every public member in
+// declaration order, little-endian, without padding.
+export template <described_integral_pod T>
+struct layout {
+    using members = public_members_of<T>;
+
+    static constexpr auto size = sum_of_member_sizes(members{});
+
+    using bytes_type = std::array<packing_type, size>;
+
+    [[nodiscard]] static constexpr auto pack(const T& described) -> bytes_type
+    {
+        auto bytes = bytes_type{};
+
+        if !consteval {
+            if constexpr (std::endian::native == std::endian::little) {
+                if (is_contiguous()) {
+                    std::memcpy(bytes.data(), &described, size);
+                    return bytes;
+                }
+            }
+        }
+
+        auto offset = std::size_t{};
+        boost::mp11::mp_for_each<members>([&](auto member_descriptor) {
+            const auto number = described.*member_descriptor.pointer;
+            for (std::size_t i = 0; i < sizeof(number); ++i) {
+                bytes[offset++] = packing_type((number >> 8 * i) & 0xff);
+            }
+        });
+
+        return bytes;
+    }
+
+    // Overwrites the described members only, anything else in T (pointers
+    // to nested descriptors or extra data) is left untouched.
+    static constexpr void unpack(
+        std::span<const packing_type, size> bytes,
+        T& described
+    )
+    {
+        if !consteval {
+            if constexpr (std::endian::native == std::endian::little) {
+                if (is_contiguous()) {
+                    std::memcpy(&described, bytes.data(), size);
+                    return;
+                }
+            }
+        }
+
+        auto offset = std::size_t{};
+        boost::mp11::mp_for_each<members>([&](auto member_descriptor) {
+            auto& member = described.*member_descriptor.pointer;
+            using M = std::remove_cvref_t<decltype(member)>;
+
+            auto number = std::uint64_t{};
+            for (std::size_t i = 0; i < sizeof(M); ++i) {
+                const auto byte = bytes[offset++];
+                number |= std::to_integer<std::uint64_t>(byte) << 8 * i;
+            }
+
+            member = static_cast<M>(number);
+        });
+    }
+
+    // True when the in-memory representation of the described members is
+    // the wire layout, i.e. members are laid out back to back from offset 0.
+    [[nodiscard]] static auto is_contiguous() noexcept -> bool
+    {
+        static const auto contiguous = [] {
+            const auto probe = T{};
+            const auto* const base = reinterpret_cast<const std::byte*>(&probe);
+
+            auto offset = std::ptrdiff_t{};
+            auto result = true;
+            boost::mp11::mp_for_each<members>([&](auto member_descriptor) {
+                const auto& member = probe.*member_descriptor.pointer;
+                const auto* const at =
+                    reinterpret_cast<const std::byte*>(&member);
+
+                result = result && (at - base == offset);
+                offset += sizeof(member);
+            });
+
+            return result;
+        }();
+
+        return contiguous;
+    }
+};
+
+} // namespace viu::usb::descriptor
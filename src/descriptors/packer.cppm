@@ -17,7 +17,15 @@ import :types;
 namespace viu::usb::descriptor {
 
 export struct packer {
-    [[nodiscard]] auto data() const { return packed_data_; }
+    [[nodiscard]] auto data() const& noexcept -> const vector_type&
+    {
+        return packed_data_;
+    }
+
+    [[nodiscard]] auto data() && noexcept -> vector_type
+    {
+        return std::move(packed_data_);
+    }
 
     void pack(const libusb_device_descriptor& device_descriptor);
     void pack(const libusb_config_descriptor& config_descriptor);
@@ -26,47 +26,117 @@ export using language_id_type = std::uint16_t;
 export using string_descriptor_map =
     std::map<language_id_type, string_descriptor_type>;
 
+export enum class file_format : std::uint8_t { text, binary };
+
+// Thrown by tree::load for a descriptor image that cannot be read back.
+export struct image_error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct endpoint_entry {
+    std::uint8_t attributes{};
+    std::uint8_t interval{};
+};
+
+// Indexed by endpoint number, IN endpoints in the upper half.
+using endpoint_table = std::array<std::optional<endpoint_entry>, 32>;
+
 export struct tree {
     tree() = default;
 
     explicit tree(
         libusb_device_descriptor device_desc,
-        const config_descriptor_pointer& config_desc,
+        std::span<const config_descriptor_pointer> config_descs,
         string_descriptor_map string_descs,
         const bos_descriptor_pointer& bos_desc,
         std::vector<std::uint8_t> report_desc
     );
 
     [[nodiscard]] auto device_descriptor() const noexcept
+        -> const libusb_device_descriptor&
     {
         return device_desc_;
     }
-    [[nodiscard]] auto device_config() const { return wrapped_config_desc_; }
-    [[nodiscard]] auto bos_descriptor() const { return wrapped_bos_desc_; }
-    [[nodiscard]] auto string_descriptors() const { return string_descs_; }
-    [[nodiscard]] auto report_descriptor() const { return report_desc_; }
 
-    void save(const std::filesystem::path& path) const;
+    [[nodiscard]] auto configs() const noexcept -> const std::vector<config>&
+    {
+        return wrapped_config_descs_;
+    }
+
+    [[nodiscard]] auto device_config(std::size_t index = 0) const
+        -> const config&;
+
+    [[nodiscard]] auto config_index(std::uint8_t configuration_value) const
+        -> std::optional<std::size_t>;
+
+    // bmAttributes of an endpoint in the given configuration, looked up in
+    // a table built when the tree is loaded from the first altsetting that
+    // declares the endpoint.
+    [[nodiscard]] auto ep_attributes(
+        std::size_t config_index,
+        std::uint8_t ep_address
+    ) const -> std::optional<std::uint8_t>;
+
+    // bInterval of an endpoint in the given configuration.
+    [[nodiscard]] auto ep_interval(
+        std::size_t config_index,
+        std::uint8_t ep_address
+    ) const -> std::optional<std::uint8_t>;
+
+    [[nodiscard]] auto bos_descriptor() const noexcept -> const bos&
+    {
+        return wrapped_bos_desc_;
+    }
+
+    [[nodiscard]] auto string_descriptors() const noexcept
+        -> const string_descriptor_map&
+    {
+        return string_descs_;
+    }
+
+    [[nodiscard]] auto report_descriptor() const noexcept
+        -> const std::vector<std::uint8_t>&
+    {
+        return report_desc_;
+    }
+
+    void save(
+        const std::filesystem::path& path,
+        file_format format = file_format::text
+    ) const;
     void load(const std::filesystem::path& path);
 
 private:
+    void stream_out(auto& os) const;
+    void stream_in(auto& is);
+
     [[nodiscard]] static auto vector_of_extra(
         const descriptor_with_extra auto& desc
     );
     [[nodiscard]] auto build(const libusb_endpoint_descriptor& ep);
     [[nodiscard]] auto build(libusb_interface_descriptor iface_desc);
     [[nodiscard]] auto build(const libusb_interface& usb_iface);
-    void build(const config_descriptor_pointer& config_desc);
+    [[nodiscard]] auto build(const config_descriptor_pointer& config_desc)
+        -> config;
     [[nodiscard]] auto build(
         const libusb_bos_dev_capability_descriptor* dev_cap_desc
     );
     void build(const bos_descriptor_pointer& bos_desc);
+    void index_endpoints();
+    [[nodiscard]] static auto endpoint_slot(std::uint8_t ep_address) noexcept
+        -> std::size_t;
+    [[nodiscard]] auto endpoint_entry_of(
+        std::size_t config_index,
+        std::uint8_t ep_address
+    ) const -> std::optional<endpoint_entry>;
 
     libusb_device_descriptor device_desc_{};
-    config wrapped_config_desc_{};
+    std::vector<config> wrapped_config_descs_ = std::vector<config>(1);
     string_descriptor_map string_descs_;
     bos wrapped_bos_desc_{};
     std::vector<std::uint8_t> report_desc_;
+    std::vector<endpoint_table> endpoint_tables_ =
+        std::vector<endpoint_table>(1);
 };
 
 } // namespace viu::usb::descriptor
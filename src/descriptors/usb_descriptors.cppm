@@ -1,6 +1,7 @@
 export module viu.usb.descriptors;
 
 export import :descriptor_classes;
+export import :layout;
 export import :packer;
 export import :structs;
 export import :traits;
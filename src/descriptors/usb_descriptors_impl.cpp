@@ -42,29 +42,20 @@ constexpr void pack(
     vector_type& descriptor_data
 )
 {
-    const auto to_le_bytes = [&](auto member_descriptor) {
-        const auto number = boost_described.*member_descriptor.pointer;
-        for (std::size_t i = 0; i < sizeof(number); ++i) {
-            const auto byte = packing_type((number >> 8 * i) & 0xff);
-            descriptor_data.push_back(byte);
-        }
-    };
-
     using T = decltype(boost_described);
-    for_each_public_member<T>(to_le_bytes);
+    const auto bytes = layout<T>::pack(boost_described);
+    descriptor_data.insert(
+        std::end(descriptor_data),
+        std::begin(bytes),
+        std::end(bytes)
+    );
 }
 
 constexpr auto packed_size(described_integral_pod auto boost_described)
 {
-    auto length = std::uint8_t{};
-    const auto sum_lengths = [&](auto member_descriptor) {
-        length += sizeof(boost_described.*member_descriptor.pointer);
-    };
-
     using T = decltype(boost_described);
-    for_each_public_member<T>(sum_lengths);
-
-    return length;
+    static_assert(layout<T>::size <= std::numeric_limits<std::uint8_t>::max());
+    return static_cast<std::uint8_t>(layout<T>::size);
 }
 
 constexpr void stream_out(
@@ -102,6 +93,29 @@ constexpr void stream_in(
     for_each_public_member<std::remove_reference_t<T>>(from_stream);
 }
 
+void stream_out(
+    const described_integral_pod auto& boost_described,
+    io::bin::writer& out
+)
+{
+    using T = std::remove_cvref_t<decltype(boost_described)>;
+    out.out(layout<T>::pack(boost_described));
+}
+
+void stream_in(
+    described_integral_pod auto& boost_described,
+    io::bin::reader& in
+)
+{
+    using T = std::remove_cvref_t<decltype(boost_described)>;
+    constexpr auto size = layout<T>::size;
+
+    const auto bytes = in.take(size);
+    if (std::size(bytes) == size) {
+        layout<T>::unpack(bytes.template first<size>(), boost_described);
+    }
+}
+
 void pack(
     libusb_endpoint_descriptor ep_descriptor,
     vector_type& descriptor_data
@@ -129,7 +143,7 @@ auto packed_size(libusb_endpoint_descriptor ep_descriptor)
 }
 
 template <typename T, attribute extra_attr>
-auto libusb_wrap<T, extra_attr>::extra() const -> extra_type
+auto libusb_wrap<T, extra_attr>::extra() const noexcept -> const extra_type&
 {
     static_assert(extra_attr == attribute::with_extra);
     return extra_vector_;
@@ -143,10 +157,10 @@ auto libusb_wrap<T, extra_attr>::extra_length() const -> extra_type::size_type
 }
 
 template <typename T, attribute extra_attr>
-void libusb_wrap<T, extra_attr>::fill_extra(const extra_type& extra)
+void libusb_wrap<T, extra_attr>::fill_extra(extra_type extra)
 {
     static_assert(extra_attr == attribute::with_extra);
-    extra_vector_ = extra;
+    extra_vector_ = std::move(extra);
 }
 
 template <typename T, attribute extra_attr>
@@ -155,12 +169,24 @@ void libusb_wrap<T, extra_attr>::stream_out_wrapped(std::ostream& os) const
     usb::descriptor::stream_out(wrapped(), os);
 }
 
+template <typename T, attribute extra_attr>
+void libusb_wrap<T, extra_attr>::stream_out_wrapped(io::bin::writer& out) const
+{
+    usb::descriptor::stream_out(wrapped(), out);
+}
+
 template <typename T, attribute extra_attr>
 void libusb_wrap<T, extra_attr>::stream_in_wrapped(std::stringstream& is)
 {
     usb::descriptor::stream_in(wrapped(), is);
 }
 
+template <typename T, attribute extra_attr>
+void libusb_wrap<T, extra_attr>::stream_in_wrapped(io::bin::reader& in)
+{
+    usb::descriptor::stream_in(wrapped(), in);
+}
+
 template <typename T, attribute extra_attr>
 void libusb_wrap<T, extra_attr>::pack_wrapped(vector_type& out) const
 {
@@ -181,6 +207,29 @@ void libusb_wrap<T, extra_attr>::stream_in_extra(std::stringstream& is)
     }
 }
 
+template <typename T, attribute extra_attr>
+void libusb_wrap<T, extra_attr>::stream_in_extra(io::bin::reader& in)
+{
+    static_assert(extra_attr == attribute::with_extra);
+
+    auto size = std::size_t{};
+    in.in_size(size);
+    const auto bytes = in.take(size);
+    extra_vector_.resize(std::size(bytes));
+    std::ranges::transform(bytes, std::begin(extra_vector_), [](auto b) {
+        return std::to_integer<extra_type::value_type>(b);
+    });
+}
+
+template <typename T, attribute extra_attr>
+void libusb_wrap<T, extra_attr>::stream_out_extra(io::bin::writer& out) const
+{
+    static_assert(extra_attr == attribute::with_extra);
+
+    out.out_size(std::size(extra_vector_));
+    out.out(std::as_bytes(std::span{extra_vector_}));
+}
+
 template <typename T, attribute extra_attr>
 void libusb_wrap<T, extra_attr>::stream_out_extra(std::ostream& os) const
 {
@@ -292,6 +341,72 @@ void basic_descriptor<W, wrapped, extra, K, V>::stream_in(std::stringstream& is)
     }
 }
 
+template <
+    typename W,
+    attribute wrapped,
+    attribute extra,
+    typename K,
+    typename V>
+void basic_descriptor<W, wrapped, extra, K, V>::stream_out(
+    io::bin::writer& out
+) const
+{
+    if constexpr (wrapped == attribute::with_wrapped) {
+        libusb_wrap<W, extra>::stream_out_wrapped(out);
+    }
+
+    viu::vector::plugin<K, V>::for_each([&out](const auto& p) {
+        using T =
+            typename std::remove_reference_t<decltype(p.vec())>::value_type;
+        out.out_size(std::size(p.vec()));
+        std::ranges::for_each(p.vec(), [&out](const auto& e) {
+            if constexpr (holds_wrapped_type<T>) {
+                e.stream_out(out);
+            } else {
+                out.out(e);
+            }
+        });
+    });
+
+    if constexpr (extra == attribute::with_extra) {
+        libusb_wrap<W, extra>::stream_out_extra(out);
+    }
+}
+
+template <
+    typename W,
+    attribute wrapped,
+    attribute extra,
+    typename K,
+    typename V>
+void basic_descriptor<W, wrapped, extra, K, V>::stream_in(io::bin::reader& in)
+{
+    if constexpr (wrapped == attribute::with_wrapped) {
+        libusb_wrap<W, extra>::stream_in_wrapped(in);
+    }
+
+    viu::vector::plugin<K, V>::for_each([&in](auto& p) {
+        using T =
+            typename std::remove_reference_t<decltype(p.vec())>::value_type;
+        auto size = std::size_t{};
+        in.in_size(size);
+        p.vec().reserve(size);
+        for (std::size_t i = 0; i < size && in.good(); ++i) {
+            auto e = T{};
+            if constexpr (holds_wrapped_type<T>) {
+                e.stream_in(in);
+            } else {
+                in.in(e);
+            }
+            p.vec().push_back(std::move(e));
+        }
+    });
+
+    if constexpr (extra == attribute::with_extra) {
+        libusb_wrap<W, extra>::stream_in_extra(in);
+    }
+}
+
 template <
     typename W,
     attribute wrapped,
@@ -454,6 +569,9 @@ void packer::pack_bos_dev_capability_descriptor(
 
 namespace streamer {
 
+// The text format predates multi-configuration support. The first
+// configuration keeps its original position and any further ones follow the
+// BOS descriptor, so files written before still load and vice versa.
 struct out {
     explicit out(const std::filesystem::path& path)
         : os_{path, std::ios_base::binary}
@@ -466,6 +584,13 @@ struct out {
         device_config.stream_out(os_);
     }
 
+    void stream(const std::vector<config>& configs)
+    {
+        viu::_assert(!configs.empty());
+        stream(configs.front());
+        trailing_configs_ = std::span{configs}.subspan(1);
+    }
+
     void stream(const libusb_device_descriptor& device_descriptor)
     {
         viu::_assert(os_.is_open());
@@ -504,26 +629,52 @@ struct out {
     {
         viu::_assert(os_.is_open());
         bos_descriptor.stream_out(os_);
+
+        if (!trailing_configs_.empty()) {
+            io::text::stream::out(os_, std::size(trailing_configs_));
+            std::ranges::for_each(trailing_configs_, [this](const auto& c) {
+                stream(c);
+            });
+        }
     }
 
 private:
     std::ofstream os_{};
+    std::span<const config> trailing_configs_;
 };
 
 struct in {
     explicit in(const std::filesystem::path& path)
     {
-        if (path.extension() == ".json") {
-            from_json(path);
-        } else {
-            auto in = std::ifstream{path, std::ios_base::binary};
-            viu::_assert(in.is_open());
-            is_ << in.rdbuf();
-        }
+        auto in = std::ifstream{path, std::ios_base::binary};
+        viu::_assert(in.is_open());
+        is_ << in.rdbuf();
     }
 
     void stream(config& config_desc) { config_desc.stream_in(is_); }
-    void stream(bos& bos_desc) { bos_desc.stream_in(is_); }
+
+    void stream(std::vector<config>& configs)
+    {
+        configs.assign(1, config{});
+        stream(configs.front());
+        configs_ = &configs;
+    }
+
+    void stream(bos& bos_desc)
+    {
+        bos_desc.stream_in(is_);
+
+        if (configs_ == nullptr || (is_ >> std::ws).eof()) {
+            return;
+        }
+
+        using vector_size_type = std::vector<config>::size_type;
+        auto size = vector_size_type{};
+        io::text::stream::in(is_, size);
+        for (auto i = vector_size_type{0}; i < size; ++i) {
+            stream(configs_->emplace_back());
+        }
+    }
 
     void stream(string_descriptor_map& string_descs)
     {
@@ -579,31 +730,542 @@ struct in {
     }
 
 private:
-    void from_json(const std::filesystem::path& path)
+    std::stringstream is_{};
+    std::vector<config>* configs_{nullptr};
+};
+
+// Builds the descriptor classes straight from the parsed json document.
+// Schema violations throw viu::json::schema_error naming the offending
+// member with a JSON pointer.
+struct json_in {
+    explicit json_in(const std::filesystem::path& path)
+        : root_{viu::json::parse_file(path)}
     {
-        try {
-            std::stringstream ss;
-            std::ifstream file(path);
+    }
+
+    void stream(libusb_device_descriptor& device_descriptor)
+    {
+        const auto dd = device().at("Device Descriptor");
+
+        device_descriptor = libusb_device_descriptor{
+            .bLength = dd.number<std::uint8_t>("bLength"),
+            .bDescriptorType = dd.number<std::uint8_t>("bDescriptorType"),
+            .bcdUSB = dd.number<std::uint16_t>("bcdUSB"),
+            .bDeviceClass = dd.number<std::uint8_t>("bDeviceClass"),
+            .bDeviceSubClass = dd.number<std::uint8_t>("bDeviceSubClass"),
+            .bDeviceProtocol = dd.number<std::uint8_t>("bDeviceProtocol"),
+            .bMaxPacketSize0 = dd.number<std::uint8_t>("bMaxPacketSize0"),
+            .idVendor = dd.number<std::uint16_t>("idVendor"),
+            .idProduct = dd.number<std::uint16_t>("idProduct"),
+            .bcdDevice = dd.number<std::uint16_t>("bcdDevice"),
+            .iManufacturer = dd.number<std::uint8_t>("iManufacturer"),
+            .iProduct = dd.number<std::uint8_t>("iProduct"),
+            .iSerialNumber = dd.number<std::uint8_t>("iSerial"),
+            .bNumConfigurations =
+                dd.number<std::uint8_t>("bNumConfigurations")
+        };
+    }
+
+    void stream(std::vector<config>& configs)
+    {
+        const auto cfgs =
+            device().at("Device Descriptor").at("aofConfigurations");
+        if (cfgs.size() == 0) {
+            cfgs.fail("expected at least one configuration");
+        }
+
+        configs.clear();
+        configs.reserve(cfgs.size());
+        for (std::size_t i = 0; i < cfgs.size(); ++i) {
+            configs.push_back(make_config(cfgs.at(i)));
+        }
+    }
+
+    void stream(string_descriptor_map& string_descs)
+    {
+        const auto langs = device().at("aofStringDescriptors");
+        for (std::size_t i = 0; i < langs.size(); ++i) {
+            const auto lang = langs.at(i);
+            const auto strings = lang.at("aofStrings");
+
+            auto sd = string_descriptor_type{};
+            sd.reserve(strings.size());
+            for (std::size_t j = 0; j < strings.size(); ++j) {
+                sd.push_back(
+                    make_string_descriptor(strings.at(j).at("StringDescriptor"))
+                );
+            }
+
+            string_descs.try_emplace(language_id(lang), std::move(sd));
+        }
+    }
+
+    void stream(std::vector<std::uint8_t>& report_descriptor)
+    {
+        report_descriptor = device().at("daReportDescriptor").bytes();
+    }
+
+    void stream(bos& bos_desc)
+    {
+        const auto bd = device().at("BOS Descriptor");
+
+        auto wrapped = libusb_bos_descriptor{};
+        wrapped.bLength = bd.number<std::uint8_t>("bLength");
+        wrapped.bDescriptorType = bd.number<std::uint8_t>("bDescriptorType");
+        wrapped.wTotalLength = bd.number<std::uint16_t>("wTotalLength");
+        wrapped.bNumDeviceCaps = bd.number<std::uint8_t>("bNumDeviceCaps");
+        bos_desc.wrap(wrapped);
+
+        const auto caps = bd.at("aofDeviceCaps");
+        auto dev_caps = std::vector<bos_dev_capability_descriptor>{};
+        dev_caps.reserve(caps.size());
+        for (std::size_t i = 0; i < caps.size(); ++i) {
+            dev_caps.push_back(make_dev_capability(caps.at(i)));
+        }
+
+        bos_desc.fill(key::dev_capability, std::move(dev_caps));
+    }
 
-            std::string data(
-                (std::istreambuf_iterator<char>(file)),
-                std::istreambuf_iterator<char>()
+private:
+    [[nodiscard]] auto device() const -> viu::json::node
+    {
+        return viu::json::node{root_}.at("aofDevices").at(0);
+    }
+
+    // Endpoint companion and class specific descriptors that follow a
+    // descriptor in the configuration.
+    [[nodiscard]] static auto extra_of(const viu::json::node& n)
+        -> std::vector<std::uint8_t>
+    {
+        auto extra = std::vector<std::uint8_t>{};
+
+        if (n.contains("Endpoint Companion")) {
+            const auto ec = n.at("Endpoint Companion");
+            const auto bytes_per_interval =
+                ec.number<std::uint16_t>("wBytesPerInterval");
+
+            extra.insert(
+                std::end(extra),
+                {ec.number<std::uint8_t>("bLength"),
+                 ec.number<std::uint8_t>("bDescriptorType"),
+                 ec.number<std::uint8_t>("bMaxBurst"),
+                 ec.number<std::uint8_t>("bmAttributes"),
+                 viu::format::integral<std::uint8_t>::at<0>(bytes_per_interval),
+                 viu::format::integral<std::uint8_t>::at<1>(bytes_per_interval)}
             );
+        }
 
-            viu::json::parser{is_}.parse(data);
-        } catch (std::exception const& e) {
-            std::println(std::cerr, "Failed to parse json: {}", e.what());
+        if (n.contains("daExtra")) {
+            const auto da_extra = n.at("daExtra").bytes();
+            extra.insert(
+                std::end(extra),
+                std::begin(da_extra),
+                std::end(da_extra)
+            );
         }
+
+        return extra;
     }
 
-    std::stringstream is_{};
+    [[nodiscard]] static auto make_endpoint(const viu::json::node& ep)
+        -> endpoint
+    {
+        const auto ed = ep.at("Endpoint Descriptor");
+
+        auto wrapped_ep = endpoint{};
+        wrapped_ep.wrap(libusb_endpoint_descriptor{
+            .bLength = ed.number<std::uint8_t>("bLength"),
+            .bDescriptorType = ed.number<std::uint8_t>("bDescriptorType"),
+            .bEndpointAddress = ed.number<std::uint8_t>("bEndpointAddress"),
+            .bmAttributes = ed.number<std::uint8_t>("bmAttributes"),
+            .wMaxPacketSize = ed.number<std::uint16_t>("wMaxPacketSize"),
+            .bInterval = ed.number<std::uint8_t>("bInterval"),
+            .bRefresh = ed.number<std::uint8_t>("bRefresh"),
+            .bSynchAddress = ed.number<std::uint8_t>("bSynchAddress"),
+            .extra = nullptr,
+            .extra_length = 0
+        });
+        wrapped_ep.fill_extra(extra_of(ep));
+
+        return wrapped_ep;
+    }
+
+    [[nodiscard]] static auto make_interface(const viu::json::node& iface)
+        -> interface
+    {
+        const auto id = iface.at("Interface Descriptor");
+
+        auto wrapped_iface = interface{};
+        wrapped_iface.wrap(libusb_interface_descriptor{
+            .bLength = id.number<std::uint8_t>("bLength"),
+            .bDescriptorType = id.number<std::uint8_t>("bDescriptorType"),
+            .bInterfaceNumber = id.number<std::uint8_t>("bInterfaceNumber"),
+            .bAlternateSetting = id.number<std::uint8_t>("bAlternateSetting"),
+            .bNumEndpoints = id.number<std::uint8_t>("bNumEndpoints"),
+            .bInterfaceClass = id.number<std::uint8_t>("bInterfaceClass"),
+            .bInterfaceSubClass =
+                id.number<std::uint8_t>("bInterfaceSubClass"),
+            .bInterfaceProtocol =
+                id.number<std::uint8_t>("bInterfaceProtocol"),
+            .iInterface = id.number<std::uint8_t>("iInterface"),
+            .endpoint = nullptr,
+            .extra = nullptr,
+            .extra_length = 0
+        });
+
+        const auto eps = id.at("aofEndpoints");
+        auto ep_vector = std::vector<endpoint>{};
+        ep_vector.reserve(eps.size());
+        for (std::size_t i = 0; i < eps.size(); ++i) {
+            ep_vector.push_back(make_endpoint(eps.at(i)));
+        }
+
+        wrapped_iface.fill(key::ep, std::move(ep_vector));
+        wrapped_iface.fill_extra(extra_of(id));
+
+        return wrapped_iface;
+    }
+
+    [[nodiscard]] static auto make_config(const viu::json::node& cfg)
+        -> config
+    {
+        const auto cd = cfg.at("Configuration Descriptor");
+
+        auto config_desc = config{};
+        config_desc.wrap(libusb_config_descriptor{
+            .bLength = cd.number<std::uint8_t>("bLength"),
+            .bDescriptorType = cd.number<std::uint8_t>("bDescriptorType"),
+            .wTotalLength = cd.number<std::uint16_t>("wTotalLength"),
+            .bNumInterfaces = cd.number<std::uint8_t>("bNumInterfaces"),
+            .bConfigurationValue =
+                cd.number<std::uint8_t>("bConfigurationValue"),
+            .iConfiguration = cd.number<std::uint8_t>("iConfiguration"),
+            .bmAttributes = cd.number<std::uint8_t>("bmAttributes"),
+            .MaxPower = cd.number<std::uint8_t>("MaxPower"),
+            .interface = nullptr,
+            .extra = nullptr,
+            .extra_length = 0
+        });
+
+        const auto alts = cd.at("aofAltsettings");
+        auto interface_vector = std::vector<usb_interface>(alts.size());
+        for (std::size_t i = 0; i < std::size(interface_vector); ++i) {
+            const auto ifaces = alts.at(i).at("aofInterfaces");
+
+            auto altsetting_vector = std::vector<interface>{};
+            altsetting_vector.reserve(ifaces.size());
+            for (std::size_t j = 0; j < ifaces.size(); ++j) {
+                altsetting_vector.push_back(make_interface(ifaces.at(j)));
+            }
+
+            interface_vector[i].fill(
+                key::altsetting,
+                std::move(altsetting_vector)
+            );
+        }
+
+        config_desc.fill(key::interface, std::move(interface_vector));
+        config_desc.fill_extra(extra_of(cfg));
+
+        return config_desc;
+    }
+
+    // Either a number or the little-endian bytes of the language id.
+    [[nodiscard]] static auto language_id(const viu::json::node& lang)
+        -> language_id_type
+    {
+        const auto id = lang.at("wLanguageId");
+        if (!id.is_array()) {
+            return id.number<language_id_type>();
+        }
+
+        const auto bytes = id.bytes();
+        if (std::size(bytes) > sizeof(language_id_type)) {
+            id.fail("expected at most two bytes");
+        }
+
+        auto lang_id = language_id_type{};
+        for (std::size_t i = 0; i < std::size(bytes); ++i) {
+            lang_id |= static_cast<language_id_type>(bytes[i] << 8 * i);
+        }
+
+        return lang_id;
+    }
+
+    [[nodiscard]] static auto make_string_descriptor(const viu::json::node& sd)
+        -> std::vector<std::uint8_t>
+    {
+        const auto length = sd.number<std::uint8_t>("bLength");
+
+        auto desc = std::vector<std::uint8_t>{};
+        desc.reserve(length);
+        desc.push_back(length);
+        desc.push_back(sd.number<std::uint8_t>("bDescriptorType"));
+
+        const auto str = sd.at("string");
+        if (str.is_array()) {
+            const auto bytes = str.bytes();
+            desc.insert(std::end(desc), std::begin(bytes), std::end(bytes));
+        } else {
+            for (const auto c : str.string()) {
+                desc.push_back(static_cast<std::uint8_t>(c));
+                desc.push_back(0);
+            }
+        }
+
+        if (std::size(desc) != length) {
+            sd.at("bLength").fail(
+                std::format("string descriptor is {} bytes", std::size(desc))
+            );
+        }
+
+        return desc;
+    }
+
+    [[nodiscard]] static auto make_dev_capability(const viu::json::node& cap)
+        -> bos_dev_capability_descriptor
+    {
+        auto wrapped = libusb_bos_dev_capability_descriptor{};
+        wrapped.bLength = cap.number<std::uint8_t>("bLength");
+        wrapped.bDescriptorType = cap.number<std::uint8_t>("bDescriptorType");
+        wrapped.bDevCapabilityType =
+            cap.number<std::uint8_t>("bDevCapabilityType");
+
+        auto data = std::vector<std::uint8_t>{};
+        const auto le_bytes = [&data](std::uint32_t v, std::size_t size) {
+            for (std::size_t i = 0; i < size; ++i) {
+                data.push_back(static_cast<std::uint8_t>(v >> 8 * i));
+            }
+        };
+
+        if (wrapped.bDevCapabilityType == LIBUSB_BT_USB_2_0_EXTENSION &&
+            cap.contains("USB 2.0 Extension")) {
+            const auto ext = cap.at("USB 2.0 Extension");
+            le_bytes(ext.number<std::uint32_t>("bmAttributes"), 4);
+        } else if (wrapped.bDevCapabilityType ==
+                       LIBUSB_BT_SS_USB_DEVICE_CAPABILITY &&
+                   cap.contains("SuperSpeed USB")) {
+            const auto ss = cap.at("SuperSpeed USB");
+            le_bytes(ss.number<std::uint8_t>("bmAttributes"), 1);
+            le_bytes(ss.number<std::uint16_t>("wSpeedSupported"), 2);
+            le_bytes(ss.number<std::uint8_t>("bFunctionalitySupport"), 1);
+            le_bytes(ss.number<std::uint8_t>("bU1DevExitLat"), 1);
+            le_bytes(ss.number<std::uint16_t>("bU2DevExitLat"), 2);
+        } else if (cap.contains("daDevCapability")) {
+            data = cap.at("daDevCapability").bytes();
+        }
+
+        auto dev_cap = bos_dev_capability_descriptor{};
+        dev_cap.wrap(wrapped);
+        dev_cap.fill(key::dev_capability_data, std::move(data));
+
+        return dev_cap;
+    }
+
+    boost::json::value root_;
+};
+
+struct bin_out {
+    void stream(const libusb_device_descriptor& device_descriptor)
+    {
+        usb::descriptor::stream_out(device_descriptor, out_);
+    }
+
+    void stream(const std::vector<config>& configs)
+    {
+        out_.out_size(std::size(configs));
+        std::ranges::for_each(configs, [this](const auto& c) {
+            c.stream_out(out_);
+        });
+    }
+
+    void stream(const string_descriptor_map& string_descs)
+    {
+        out_.out_size(std::size(string_descs));
+        for (const auto& [lang_id, strings] : string_descs) {
+            out_.out(lang_id);
+            out_.out_size(std::size(strings));
+            std::ranges::for_each(strings, [this](const auto& s) {
+                stream(s);
+            });
+        }
+    }
+
+    void stream(const std::vector<std::uint8_t>& v)
+    {
+        out_.out_size(std::size(v));
+        out_.out(std::as_bytes(std::span{v}));
+    }
+
+    void stream(const bos& bos_descriptor) { bos_descriptor.stream_out(out_); }
+
+    [[nodiscard]] auto payload() const noexcept -> std::span<const std::byte>
+    {
+        return out_.data();
+    }
+
+private:
+    io::bin::writer out_{};
+};
+
+struct bin_in {
+    bin_in(std::span<const std::byte> payload, std::uint16_t version)
+        : in_{payload}, version_{version}
+    {
+    }
+
+    void stream(libusb_device_descriptor& device_descriptor)
+    {
+        usb::descriptor::stream_in(device_descriptor, in_);
+    }
+
+    // Version 1 images hold exactly one configuration.
+    void stream(std::vector<config>& configs)
+    {
+        auto size = std::size_t{1};
+        if (version_ > 1) {
+            in_.in_size(size);
+        }
+
+        configs.assign(size, config{});
+        std::ranges::for_each(configs, [this](auto& c) { c.stream_in(in_); });
+    }
+
+    void stream(bos& bos_desc) { bos_desc.stream_in(in_); }
+
+    void stream(string_descriptor_map& string_descs)
+    {
+        auto map_size = std::size_t{};
+        in_.in_size(map_size);
+        for (std::size_t i = 0; i < map_size && in_.good(); ++i) {
+            auto lang_id = string_descriptor_map::key_type{};
+            in_.in(lang_id);
+
+            auto size = std::size_t{};
+            in_.in_size(size);
+            auto strings = string_descriptor_type(size);
+            std::ranges::for_each(strings, [this](auto& s) { stream(s); });
+
+            string_descs.insert_or_assign(lang_id, std::move(strings));
+        }
+    }
+
+    void stream(std::vector<std::uint8_t>& v)
+    {
+        auto size = std::size_t{};
+        in_.in_size(size);
+        const auto bytes = in_.take(size);
+        v.resize(std::size(bytes));
+        std::ranges::transform(bytes, std::begin(v), [](auto b) {
+            return std::to_integer<std::uint8_t>(b);
+        });
+    }
+
+    [[nodiscard]] auto good() const noexcept
+    {
+        return in_.good() && in_.remaining() == 0;
+    }
+
+private:
+    io::bin::reader in_;
+    std::uint16_t version_;
 };
 
 } // namespace streamer
 
+// Binary descriptor image: a fixed little-endian header followed by the
+// payload written by streamer::bin_out.
+//
+//   u32 magic "VIUD" | u16 version | u16 header size | u32 payload size
+//   u32 payload crc32
+//
+// Version 2 stores every configuration, version 1 only a single one.
+namespace image {
+
+constexpr auto magic = std::uint32_t{0x44554956};
+constexpr auto version = std::uint16_t{2};
+constexpr auto header_size = std::uint16_t{16};
+
+auto crc32(std::span<const std::byte> bytes) -> std::uint32_t
+{
+    auto crc = boost::crc_32_type{};
+    crc.process_bytes(bytes.data(), std::size(bytes));
+    return crc.checksum();
+}
+
+auto is_image(std::span<const std::byte> bytes) -> bool
+{
+    auto in = io::bin::reader{bytes};
+    auto image_magic = std::uint32_t{};
+    in.in(image_magic);
+    return in.good() && image_magic == magic;
+}
+
+auto make(std::span<const std::byte> payload) -> std::vector<std::byte>
+{
+    auto out = io::bin::writer{};
+    out.out(magic);
+    out.out(version);
+    out.out(header_size);
+    out.out_size(std::size(payload));
+    out.out(crc32(payload));
+    out.out(payload);
+    return std::move(out).data();
+}
+
+struct view {
+    std::uint16_t version;
+    std::span<const std::byte> payload;
+};
+
+auto view_of(std::span<const std::byte> bytes)
+    -> std::expected<view, std::string>
+{
+    auto in = io::bin::reader{bytes};
+    auto image_magic = std::uint32_t{};
+    auto image_version = std::uint16_t{};
+    auto image_header_size = std::uint16_t{};
+    auto payload_size = io::bin::size_type{};
+    auto payload_crc = std::uint32_t{};
+
+    in.in(image_magic);
+    in.in(image_version);
+    in.in(image_header_size);
+    in.in(payload_size);
+    in.in(payload_crc);
+
+    if (!in.good() || image_magic != magic) {
+        return std::unexpected{"not a descriptor image"};
+    }
+
+    if (image_version == 0 || image_version > version) {
+        return std::unexpected{
+            std::format("unsupported image version {}", image_version)
+        };
+    }
+
+    if (image_header_size < header_size ||
+        image_header_size > std::size(bytes)) {
+        return std::unexpected{"invalid image header"};
+    }
+
+    const auto payload = bytes.subspan(image_header_size);
+    if (std::size(payload) != payload_size) {
+        return std::unexpected{"image payload size mismatch"};
+    }
+
+    if (crc32(payload) != payload_crc) {
+        return std::unexpected{"image checksum mismatch"};
+    }
+
+    return view{.version = image_version, .payload = payload};
+}
+
+} // namespace image
+
 tree::tree(
     libusb_device_descriptor device_desc,
-    const config_descriptor_pointer& config_desc,
+    std::span<const config_descriptor_pointer> config_descs,
     string_descriptor_map string_descs,
     const bos_descriptor_pointer& bos_desc,
     std::vector<std::uint8_t> report_desc
@@ -612,28 +1274,179 @@ tree::tree(
       string_descs_{std::move(string_descs)},
       report_desc_{std::move(report_desc)}
 {
-    build(config_desc);
+    viu::_assert(!config_descs.empty());
+
+    wrapped_config_descs_.clear();
+    std::ranges::for_each(config_descs, [this](const auto& config_desc) {
+        wrapped_config_descs_.push_back(build(config_desc));
+    });
+
     build(bos_desc);
+    index_endpoints();
 }
 
-void tree::save(const std::filesystem::path& path) const
+auto tree::device_config(std::size_t index) const -> const config&
+{
+    viu::_assert(index < std::size(wrapped_config_descs_));
+    return wrapped_config_descs_[index];
+}
+
+auto tree::config_index(std::uint8_t configuration_value) const
+    -> std::optional<std::size_t>
+{
+    const auto it = std::ranges::find(
+        wrapped_config_descs_,
+        configuration_value,
+        &config::configuration_value
+    );
+
+    if (it == std::end(wrapped_config_descs_)) {
+        return std::nullopt;
+    }
+
+    return static_cast<std::size_t>(
+        std::distance(std::begin(wrapped_config_descs_), it)
+    );
+}
+
+auto tree::endpoint_entry_of(
+    std::size_t config_index,
+    std::uint8_t ep_address
+) const -> std::optional<endpoint_entry>
+{
+    if (config_index >= std::size(endpoint_tables_)) {
+        return std::nullopt;
+    }
+
+    return endpoint_tables_[config_index][endpoint_slot(ep_address)];
+}
+
+auto tree::ep_attributes(std::size_t config_index, std::uint8_t ep_address)
+    const -> std::optional<std::uint8_t>
+{
+    return endpoint_entry_of(config_index, ep_address)
+        .transform(&endpoint_entry::attributes);
+}
+
+auto tree::ep_interval(std::size_t config_index, std::uint8_t ep_address)
+    const -> std::optional<std::uint8_t>
+{
+    return endpoint_entry_of(config_index, ep_address)
+        .transform(&endpoint_entry::interval);
+}
+
+auto tree::endpoint_slot(std::uint8_t ep_address) noexcept -> std::size_t
+{
+    constexpr auto number_mask = std::uint8_t{0x0f};
+    const auto is_in = (ep_address & LIBUSB_ENDPOINT_DIR_MASK) != 0;
+    return (ep_address & number_mask) + (is_in ? 16 : 0);
+}
+
+// An endpoint address is indexed with the first altsetting that declares
+// it. Altsettings that reuse an address with another type or interval are
+// not told apart, lookups do not follow SET_INTERFACE.
+void tree::index_endpoints()
+{
+    endpoint_tables_.assign(std::size(wrapped_config_descs_), {});
+
+    for (auto [config_desc, table] :
+         std::views::zip(wrapped_config_descs_, endpoint_tables_)) {
+        const auto usb_ifaces =
+            config_desc.view<usb_interface>(key::interface);
+        for (const auto& usb_iface : usb_ifaces) {
+            for (const auto& altsetting :
+                 usb_iface.view<interface>(key::altsetting)) {
+                for (const auto& ep : altsetting.view<endpoint>(key::ep)) {
+                    auto& slot = table[endpoint_slot(ep.address())];
+                    if (!slot.has_value()) {
+                        slot = endpoint_entry{
+                            .attributes = ep.attributes(),
+                            .interval = ep.interval()
+                        };
+                    }
+                }
+            }
+        }
+    }
+}
+
+void tree::stream_out(auto& os) const
 {
-    auto os = streamer::out{path};
     os.stream(device_descriptor());
-    os.stream(device_config());
+    os.stream(configs());
     os.stream(string_descriptors());
     os.stream(report_descriptor());
     os.stream(bos_descriptor());
 }
 
-void tree::load(const std::filesystem::path& path)
+void tree::stream_in(auto& is)
 {
-    auto is = streamer::in{path};
     is.stream(device_desc_);
-    is.stream(wrapped_config_desc_);
+    is.stream(wrapped_config_descs_);
     is.stream(string_descs_);
     is.stream(report_desc_);
     is.stream(wrapped_bos_desc_);
+
+    index_endpoints();
+}
+
+void tree::save(const std::filesystem::path& path, file_format format) const
+{
+    if (format == file_format::binary) {
+        auto os = streamer::bin_out{};
+        stream_out(os);
+        viu::_assert(io::bin::file::save(path, image::make(os.payload())));
+        return;
+    }
+
+    auto os = streamer::out{path};
+    stream_out(os);
+}
+
+// Loads into a temporary, the tree is left as it was if the file is bad.
+void tree::load(const std::filesystem::path& path)
+{
+    auto loaded = tree{};
+
+    if (path.extension() != ".json") {
+        const auto file = io::bin::file::mapped{path};
+        if (image::is_image(file.bytes())) {
+            const auto view = image::view_of(file.bytes());
+            if (!view) {
+                throw image_error{
+                    std::format("{}: {}", path.string(), view.error())
+                };
+            }
+
+            auto is = streamer::bin_in{view->payload, view->version};
+            loaded.stream_in(is);
+            if (!is.good()) {
+                throw image_error{
+                    std::format("{}: truncated image payload", path.string())
+                };
+            }
+
+            *this = std::move(loaded);
+            return;
+        }
+    }
+
+    if (path.extension() == ".json") {
+        try {
+            auto is = streamer::json_in{path};
+            loaded.stream_in(is);
+        } catch (const std::exception& e) {
+            std::println(std::cerr, "Failed to parse json: {}", e.what());
+            throw;
+        }
+
+        *this = std::move(loaded);
+        return;
+    }
+
+    auto is = streamer::in{path};
+    loaded.stream_in(is);
+    *this = std::move(loaded);
 }
 
 auto tree::vector_of_extra(const descriptor_with_extra auto& desc)
@@ -664,7 +1477,7 @@ auto tree::build(const libusb_interface_descriptor iface_desc)
         ep_vector.push_back(build(ep));
     });
 
-    wrapped_iface_desc.fill(usb::descriptor::key::ep, ep_vector);
+    wrapped_iface_desc.fill(usb::descriptor::key::ep, std::move(ep_vector));
     wrapped_iface_desc.wrap(iface_desc);
 
     return wrapped_iface_desc;
@@ -686,16 +1499,21 @@ auto tree::build(const libusb_interface& usb_iface)
         }
     );
 
-    wrapped_usb_iface.fill(usb::descriptor::key::altsetting, altsetting_vector);
+    wrapped_usb_iface.fill(
+        usb::descriptor::key::altsetting,
+        std::move(altsetting_vector)
+    );
     wrapped_usb_iface.wrap(usb_iface);
 
     return wrapped_usb_iface;
 }
 
-void tree::build(const config_descriptor_pointer& config_desc)
+auto tree::build(const config_descriptor_pointer& config_desc) -> config
 {
     viu::_assert(config_desc != nullptr);
-    wrapped_config_desc_.fill_extra(vector_of_extra(*config_desc));
+
+    auto wrapped_config_desc = config{};
+    wrapped_config_desc.fill_extra(vector_of_extra(*config_desc));
 
     viu::_assert(config_desc->interface != nullptr);
     const auto ifaces = viu::format::unsafe::vectorize(
@@ -708,8 +1526,10 @@ void tree::build(const config_descriptor_pointer& config_desc)
         interface_vector.push_back(build(iface));
     });
 
-    wrapped_config_desc_.fill(key::interface, interface_vector);
-    wrapped_config_desc_.wrap(*config_desc);
+    wrapped_config_desc.fill(key::interface, std::move(interface_vector));
+    wrapped_config_desc.wrap(*config_desc);
+
+    return wrapped_config_desc;
 }
 
 auto tree::build(const libusb_bos_dev_capability_descriptor* const dev_cap_desc)
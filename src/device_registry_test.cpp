@@ -0,0 +1,119 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+import std;
+
+import viu.daemon.registry;
+
+namespace viu::test {
+
+using viu::daemon::device_state;
+
+class device_registry_test : public testing::Test {
+protected:
+    viu::daemon::registry<std::shared_ptr<int>> registry_{};
+};
+
+TEST_F(device_registry_test, lifecycle)
+{
+    const auto id = registry_.create();
+    EXPECT_EQ(registry_.state(id), device_state::creating);
+    EXPECT_FALSE(registry_.find(id));
+    EXPECT_FALSE(registry_.begin_teardown(id));
+
+    ASSERT_TRUE(registry_.publish(id, std::make_shared<int>(7)));
+    EXPECT_FALSE(registry_.publish(id, std::make_shared<int>(8)));
+    EXPECT_EQ(registry_.state(id), device_state::attached);
+    ASSERT_TRUE(registry_.find(id));
+    EXPECT_EQ(**registry_.find(id), 7);
+
+    const auto value = registry_.begin_teardown(id);
+    ASSERT_TRUE(value);
+    EXPECT_EQ(**value, 7);
+    EXPECT_EQ(registry_.state(id), device_state::draining);
+    EXPECT_FALSE(registry_.find(id));
+    EXPECT_FALSE(registry_.begin_teardown(id));
+
+    registry_.finish_teardown(id);
+    EXPECT_EQ(registry_.state(id), device_state::gone);
+    EXPECT_TRUE(registry_.wait_gone(id, std::chrono::milliseconds{0}));
+}
+
+TEST_F(device_registry_test, abandon)
+{
+    const auto first = registry_.create();
+    const auto second = registry_.create();
+    EXPECT_NE(first, second);
+
+    registry_.abandon(first);
+    EXPECT_EQ(registry_.state(first), device_state::gone);
+    EXPECT_FALSE(registry_.publish(first, std::make_shared<int>(1)));
+    EXPECT_EQ(registry_.state(second), device_state::creating);
+}
+
+TEST_F(device_registry_test, attach_and_detach)
+{
+    const auto id = registry_.create();
+    EXPECT_FALSE(registry_.set_attached(id, true));
+
+    ASSERT_TRUE(registry_.publish(
+        id,
+        std::make_shared<int>(3),
+        device_state::detached
+    ));
+    EXPECT_EQ(registry_.state(id), device_state::detached);
+    EXPECT_TRUE(registry_.find(id));
+
+    EXPECT_TRUE(registry_.set_attached(id, true));
+    EXPECT_EQ(registry_.state(id), device_state::attached);
+    EXPECT_TRUE(registry_.set_attached(id, false));
+    EXPECT_EQ(registry_.state(id), device_state::detached);
+
+    ASSERT_TRUE(registry_.begin_teardown(id));
+    EXPECT_FALSE(registry_.set_attached(id, true));
+    EXPECT_EQ(registry_.state(id), device_state::draining);
+}
+
+TEST_F(device_registry_test, wait_gone)
+{
+    const auto id = registry_.create();
+    registry_.publish(id, std::make_shared<int>(1));
+    ASSERT_TRUE(registry_.begin_teardown(id));
+
+    EXPECT_FALSE(registry_.wait_gone(id, std::chrono::milliseconds{1}));
+
+    auto teardown = std::jthread{[&] { registry_.finish_teardown(id); }};
+    EXPECT_TRUE(registry_.wait_gone(id, std::chrono::seconds{10}));
+}
+
+TEST_F(device_registry_test, concurrent_create_and_teardown)
+{
+    constexpr auto threads = 8;
+    constexpr auto per_thread = 64;
+
+    {
+        auto workers = std::vector<std::jthread>{};
+        for (auto t = 0; t < threads; ++t) {
+            workers.emplace_back([&] {
+                for (auto n = 0; n < per_thread; ++n) {
+                    const auto id = registry_.create();
+                    registry_.publish(id, std::make_shared<int>(n));
+                    if (n % 2 == 0 && registry_.begin_teardown(id)) {
+                        registry_.finish_teardown(id);
+                    }
+                }
+            });
+        }
+    }
+
+    auto ids = std::set<std::uint64_t>{};
+    registry_.for_each([&](auto id, auto state, const auto& value) {
+        EXPECT_EQ(state, device_state::attached);
+        EXPECT_TRUE(value);
+        ids.insert(id);
+    });
+
+    EXPECT_EQ(std::ssize(ids), threads * per_thread / 2);
+}
+
+} // namespace viu::test
@@ -1,5 +1,10 @@
 module;
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 import std;
 
 import viu.boost;
@@ -37,8 +42,159 @@ export void in(std::istream& is, std::integral auto& v)
 
 } // namespace text::stream
 
+namespace bin {
+
+export using size_type = std::uint32_t;
+
+export struct writer {
+    void out(const std::integral auto& v)
+    {
+        const auto le = boost::endian::native_to_little(v);
+        out(std::as_bytes(std::span{&le, 1}));
+    }
+
+    void out(std::span<const std::byte> bytes)
+    {
+        buffer_.insert(std::end(buffer_), std::begin(bytes), std::end(bytes));
+    }
+
+    void out_size(std::size_t size)
+    {
+        out(boost::numeric_cast<size_type>(size));
+    }
+
+    [[nodiscard]] auto data() const& noexcept -> const std::vector<std::byte>&
+    {
+        return buffer_;
+    }
+
+    [[nodiscard]] auto data() && noexcept -> std::vector<std::byte>
+    {
+        return std::move(buffer_);
+    }
+
+private:
+    std::vector<std::byte> buffer_;
+};
+
+// Bounds checked little-endian reader. A failed read puts the reader in a
+// sticky failed state, so callers check good() once after a sequence.
+export struct reader {
+    explicit reader(std::span<const std::byte> bytes) noexcept : bytes_{bytes}
+    {
+    }
+
+    void in(std::integral auto& v)
+    {
+        using T = std::remove_cvref_t<decltype(v)>;
+        const auto chunk = take(sizeof(T));
+        if (chunk.size() != sizeof(T)) {
+            return;
+        }
+
+        auto le = T{};
+        std::memcpy(&le, chunk.data(), sizeof(T));
+        v = boost::endian::little_to_native(le);
+    }
+
+    // Every element takes at least one byte, so a size larger than what is
+    // left cannot be valid.
+    void in_size(std::size_t& size)
+    {
+        auto encoded = size_type{};
+        in(encoded);
+        if (encoded > remaining()) {
+            failed_ = true;
+            encoded = 0;
+        }
+
+        size = encoded;
+    }
+
+    [[nodiscard]] auto take(std::size_t size) -> std::span<const std::byte>
+    {
+        if (failed_ || size > remaining()) {
+            failed_ = true;
+            return {};
+        }
+
+        const auto chunk = bytes_.first(size);
+        bytes_ = bytes_.subspan(size);
+        return chunk;
+    }
+
+    [[nodiscard]] auto remaining() const noexcept { return bytes_.size(); }
+    [[nodiscard]] auto good() const noexcept { return !failed_; }
+
+private:
+    std::span<const std::byte> bytes_;
+    bool failed_{false};
+};
+
+} // namespace bin
+
 namespace bin::file {
 
+// Read-only private mapping of a whole file.
+export struct mapped {
+    mapped() = default;
+
+    explicit mapped(const std::filesystem::path& path)
+    {
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            const auto size = static_cast<std::size_t>(st.st_size);
+            auto* const address =
+                ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                address_ = address;
+                size_ = size;
+            }
+        }
+
+        ::close(fd);
+    }
+
+    ~mapped()
+    {
+        if (address_ != nullptr) {
+            ::munmap(address_, size_);
+        }
+    }
+
+    mapped(const mapped&) = delete;
+    auto operator=(const mapped&) -> mapped& = delete;
+
+    mapped(mapped&& other) noexcept
+        : address_{std::exchange(other.address_, nullptr)},
+          size_{std::exchange(other.size_, 0)}
+    {
+    }
+
+    auto operator=(mapped&& other) noexcept -> mapped&
+    {
+        std::swap(address_, other.address_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    [[nodiscard]] auto is_open() const noexcept { return address_ != nullptr; }
+
+    [[nodiscard]] auto bytes() const noexcept -> std::span<const std::byte>
+    {
+        return {static_cast<const std::byte*>(address_), size_};
+    }
+
+private:
+    void* address_{nullptr};
+    std::size_t size_{0};
+};
+
 export template <typename T>
 bool save(const std::filesystem::path& path, const std::vector<T>& data)
 {
@@ -6,30 +6,74 @@ import viu.boost;
 
 namespace viu::json {
 
-export struct parser {
-public:
-    parser(std::stringstream& out) : out_{out} {};
+export struct schema_error : std::runtime_error {
+    schema_error(std::string pointer, const std::string& what);
 
-    auto parse(const std::string& data) -> std::string;
+    [[nodiscard]] auto pointer() const noexcept -> std::string_view
+    {
+        return pointer_;
+    }
 
-    static auto read_u32(const boost::json::value& v) -> std::uint32_t;
-    static auto read_u32(
-        const boost::json::object& jobject,
-        const std::string_view& key
-    ) -> std::uint32_t;
+private:
+    std::string pointer_;
+};
+
+// A parsed json value together with its JSON pointer (RFC 6901), so that
+// schema errors can name the offending member.
+export struct node {
+    explicit node(const boost::json::value& value, std::string pointer = {});
+
+    [[nodiscard]] auto value() const noexcept -> const boost::json::value&
+    {
+        return *value_;
+    }
+
+    [[nodiscard]] auto pointer() const noexcept -> std::string_view
+    {
+        return pointer_;
+    }
+
+    [[nodiscard]] auto is_array() const noexcept -> bool;
+    [[nodiscard]] auto is_string() const noexcept -> bool;
+
+    [[nodiscard]] auto contains(std::string_view key) const -> bool;
+    [[nodiscard]] auto at(std::string_view key) const -> node;
+    [[nodiscard]] auto at(std::size_t index) const -> node;
+    [[nodiscard]] auto size() const -> std::size_t;
+    [[nodiscard]] auto string() const -> std::string_view;
+
+    // Integer or integer literal string, e.g. "0x0409".
+    [[nodiscard]] auto u32() const -> std::uint32_t;
+
+    template <std::unsigned_integral T>
+    [[nodiscard]] auto number() const -> T
+    {
+        const auto v = u32();
+        if (v > std::numeric_limits<T>::max()) {
+            fail(std::format("value {} exceeds {} byte(s)", v, sizeof(T)));
+        }
+
+        return static_cast<T>(v);
+    }
+
+    // Absent descriptor fields read as zero.
+    template <std::unsigned_integral T>
+    [[nodiscard]] auto number(std::string_view key) const -> T
+    {
+        return contains(key) ? at(key).number<T>() : T{};
+    }
+
+    // Array of byte values.
+    [[nodiscard]] auto bytes() const -> std::vector<std::uint8_t>;
+
+    [[noreturn]] void fail(const std::string& what) const;
 
 private:
-    void write_num(std::uint32_t v);
-    void write_da(const boost::json::array& a);
-    void build_extra(const boost::json::object& jobject);
-    void build_endpoint(const boost::json::object& ep);
-    void build_interface(const boost::json::object& iface);
-    void build_configuration(const boost::json::object& cfg);
-    void build_string_descriptors(const boost::json::object& dev);
-    void build_bos(const boost::json::object& bos);
-    void build_descriptor(const std::string& data);
-
-    std::stringstream& out_;
+    const boost::json::value* value_;
+    std::string pointer_;
 };
 
+export [[nodiscard]] auto parse_file(const std::filesystem::path& path)
+    -> boost::json::value;
+
 } // namespace viu::json
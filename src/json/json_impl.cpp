@@ -6,277 +6,209 @@ import viu.boost;
 
 namespace viu::json {
 
-void parser::write_num(std::uint32_t v) { out_ << v << " "; }
+namespace {
 
-void parser::write_da(const boost::json::array& a)
+auto escape(std::string_view token) -> std::string
 {
-    std::ranges::for_each(a, [&](const auto& v) { write_num(read_u32(v)); });
+    auto escaped = std::string{};
+    escaped.reserve(std::size(token));
+
+    for (const auto c : token) {
+        if (c == '~') {
+            escaped += "~0";
+        } else if (c == '/') {
+            escaped += "~1";
+        } else {
+            escaped += c;
+        }
+    }
+
+    return escaped;
 }
 
-void parser::build_extra(const boost::json::object& jobject)
+auto to_u32(std::string_view literal) -> std::optional<std::uint32_t>
 {
-    std::uint32_t total_bytes = 0;
-
-    if (jobject.contains("Endpoint Companion")) {
-        total_bytes += 6;
+    auto base = 10;
+    if (literal.starts_with("0x") || literal.starts_with("0X")) {
+        literal.remove_prefix(2);
+        base = 16;
+    } else if (std::size(literal) > 1 && literal.starts_with('0')) {
+        literal.remove_prefix(1);
+        base = 8;
     }
 
-    if (jobject.contains("daExtra")) {
-        const auto& extra = jobject.at("daExtra").as_array();
-        total_bytes += extra.size();
+    auto v = std::uint32_t{};
+    const auto* const last = literal.data() + std::size(literal);
+    const auto [ptr, ec] = std::from_chars(literal.data(), last, v, base);
+    if (literal.empty() || ec != std::errc{} || ptr != last) {
+        return std::nullopt;
     }
 
-    if (total_bytes != 0) {
-        write_num(total_bytes);
-
-        if (jobject.contains("Endpoint Companion")) {
-            const auto& ec = jobject.at("Endpoint Companion").as_object();
-            write_num(read_u32(ec, "bLength"));
-            write_num(read_u32(ec, "bDescriptorType"));
-            write_num(read_u32(ec, "bMaxBurst"));
-            write_num(read_u32(ec, "bmAttributes"));
-            std::uint16_t wBytes = static_cast<std::uint16_t>(
-                read_u32(ec, "wBytesPerInterval")
-            );
-            write_num(wBytes & 0xFF);
-            write_num((wBytes >> 8) & 0xFF);
-        }
+    return v;
+}
 
-        if (jobject.contains("daExtra")) {
-            const auto& extra = jobject.at("daExtra").as_array();
-            write_da(extra);
+auto to_u32(const boost::json::value& v) -> std::optional<std::uint32_t>
+{
+    if (v.is_int64()) {
+        const auto i = v.get_int64();
+        if (!std::in_range<std::uint32_t>(i)) {
+            return std::nullopt;
         }
 
-        return;
+        return static_cast<std::uint32_t>(i);
     }
 
-    write_num(0);
-}
+    if (v.is_uint64()) {
+        const auto u = v.get_uint64();
+        if (!std::in_range<std::uint32_t>(u)) {
+            return std::nullopt;
+        }
 
-void parser::build_endpoint(const boost::json::object& ep)
-{
-    const auto& d = ep.at("Endpoint Descriptor").as_object();
+        return static_cast<std::uint32_t>(u);
+    }
 
-    write_num(read_u32(d, "bLength"));
-    write_num(read_u32(d, "bDescriptorType"));
-    write_num(read_u32(d, "bEndpointAddress"));
+    if (v.is_string()) {
+        const auto& s = v.get_string();
+        return to_u32(std::string_view{s.data(), s.size()});
+    }
+
+    return std::nullopt;
+}
 
-    write_num(read_u32(d, "bmAttributes"));
-    write_num(read_u32(d, "wMaxPacketSize"));
-    write_num(read_u32(d, "bInterval"));
-    write_num(read_u32(d, "bRefresh"));
-    write_num(read_u32(d, "bSynchAddress"));
+} // namespace
 
-    build_extra(ep);
+schema_error::schema_error(std::string pointer, const std::string& what)
+    : std::runtime_error{std::format(
+          "{}: {}",
+          pointer.empty() ? std::string_view{"(root)"} : pointer,
+          what
+      )},
+      pointer_{std::move(pointer)}
+{
 }
 
-void parser::build_interface(const boost::json::object& iface)
+node::node(const boost::json::value& value, std::string pointer)
+    : value_{&value}, pointer_{std::move(pointer)}
 {
-    const auto& iface_desc = iface.at("Interface Descriptor").as_object();
-
-    write_num(read_u32(iface_desc, "bLength"));
-    write_num(read_u32(iface_desc, "bDescriptorType"));
-    write_num(read_u32(iface_desc, "bInterfaceNumber"));
-    write_num(read_u32(iface_desc, "bAlternateSetting"));
-    write_num(read_u32(iface_desc, "bNumEndpoints"));
-    write_num(read_u32(iface_desc, "bInterfaceClass"));
-    write_num(read_u32(iface_desc, "bInterfaceSubClass"));
-    write_num(read_u32(iface_desc, "bInterfaceProtocol"));
-    write_num(read_u32(iface_desc, "iInterface"));
-
-    const auto& eps = iface_desc.at("aofEndpoints").as_array();
-    write_num(eps.size());
-    std::ranges::for_each(eps, [&](const auto& ep) {
-        build_endpoint(ep.as_object());
-    });
-
-    build_extra(iface_desc);
 }
 
-void parser::build_configuration(const boost::json::object& cfg)
+auto node::is_array() const noexcept -> bool { return value_->is_array(); }
+
+auto node::is_string() const noexcept -> bool { return value_->is_string(); }
+
+auto node::contains(std::string_view key) const -> bool
 {
-    const auto& config_desc = cfg.at("Configuration Descriptor").as_object();
-
-    write_num(read_u32(config_desc, "bLength"));
-    write_num(read_u32(config_desc, "bDescriptorType"));
-    write_num(read_u32(config_desc, "wTotalLength"));
-    write_num(read_u32(config_desc, "bNumInterfaces"));
-    write_num(read_u32(config_desc, "bConfigurationValue"));
-    write_num(read_u32(config_desc, "iConfiguration"));
-    write_num(read_u32(config_desc, "bmAttributes"));
-    write_num(read_u32(config_desc, "MaxPower"));
-
-    const auto& alts = config_desc.at("aofAltsettings").as_array();
-    write_num(alts.size());
-
-    std::ranges::for_each(alts, [&](const auto alt) {
-        const auto& ifs = alt.at("aofInterfaces").as_array();
-        write_num(ifs.size());
-        std::ranges::for_each(ifs, [&](const auto& iface) {
-            build_interface(iface.as_object());
-        });
-    });
-
-    build_extra(cfg);
+    const auto* const object = value_->if_object();
+    if (object == nullptr) {
+        fail("expected an object");
+    }
+
+    return object->contains(key);
 }
 
-void parser::build_string_descriptors(const boost::json::object& dev)
+auto node::at(std::string_view key) const -> node
 {
-    const auto& langs = dev.at("aofStringDescriptors").as_array();
-    write_num(langs.size());
+    const auto* const object = value_->if_object();
+    if (object == nullptr) {
+        fail("expected an object");
+    }
 
-    std::ranges::for_each(langs, [&](const auto& lang) {
-        const auto& lang_id = lang.at("wLanguageId");
-        if (lang_id.is_array()) {
-            write_da(lang_id.as_array());
-        } else {
-            write_num(read_u32(lang_id));
-        }
+    auto child_pointer = std::format("{}/{}", pointer_, escape(key));
+    const auto* const child = object->if_contains(key);
+    if (child == nullptr) {
+        throw schema_error{std::move(child_pointer), "missing member"};
+    }
 
-        const auto& strings = lang.at("aofStrings").as_array();
-        write_num(strings.size());
-
-        std::ranges::for_each(strings, [&](const auto& s) {
-            const auto& string_desc = s.at("StringDescriptor").as_object();
-
-            // TODO: Remove double length from serialized configurations
-            write_num(read_u32(string_desc, "bLength"));
-            write_num(read_u32(string_desc, "bLength"));
-            write_num(read_u32(string_desc, "bDescriptorType"));
-
-            const auto& str = string_desc.at("string");
-            if (str.is_array()) {
-                std::ranges::for_each(str.as_array(), [&](const auto& v) {
-                    write_num(read_u32(v));
-                });
-            } else {
-                std::ranges::for_each(str.as_string(), [&](char c) {
-                    write_num(static_cast<std::uint8_t>(c));
-                    write_num(0);
-                });
-            }
-        });
-    });
+    return node{*child, std::move(child_pointer)};
 }
 
-void parser::build_bos(const boost::json::object& bos)
+auto node::at(std::size_t index) const -> node
 {
-    write_num(read_u32(bos, "bLength"));
-    write_num(read_u32(bos, "bDescriptorType"));
-    write_num(read_u32(bos, "wTotalLength"));
-    write_num(read_u32(bos, "bNumDeviceCaps"));
-
-    const auto& caps = bos.at("aofDeviceCaps").as_array();
-    write_num(caps.size());
-
-    std::ranges::for_each(caps, [&](const auto& cap) {
-        const auto& c = cap.as_object();
-        write_num(read_u32(c, "bLength"));
-        write_num(read_u32(c, "bDescriptorType"));
-
-        auto dev_cap_type = read_u32(c, "bDevCapabilityType");
-        write_num(dev_cap_type);
-
-        if (dev_cap_type == 2 && c.contains("USB 2.0 Extension")) {
-            const auto& usb2_ext = c.at("USB 2.0 Extension").as_object();
-            auto bm_attr = read_u32(usb2_ext, "bmAttributes");
-            write_num(4); // TODO: set to packed size of the descriptors
-            write_num(bm_attr & 0xFF);
-            write_num((bm_attr >> 8) & 0xFF);
-            write_num((bm_attr >> 16) & 0xFF);
-            write_num((bm_attr >> 24) & 0xFF);
-        } else if (dev_cap_type == 3 && c.contains("SuperSpeed USB")) {
-            const auto& ss_usb = c.at("SuperSpeed USB").as_object();
-            const auto bm_attr = read_u32(ss_usb, "bmAttributes");
-            const auto w_speed = read_u32(ss_usb, "wSpeedSupported");
-            const auto b_func = read_u32(ss_usb, "bFunctionalitySupport");
-            const auto b_u1_lat = read_u32(ss_usb, "bU1DevExitLat");
-            const auto w_u2_lat = read_u32(ss_usb, "bU2DevExitLat");
-
-            write_num(7);
-            write_num(bm_attr & 0xFF);
-            write_num(w_speed & 0xFF);
-            write_num((w_speed >> 8) & 0xFF);
-            write_num(b_func & 0xFF);
-            write_num(b_u1_lat & 0xFF);
-            write_num(w_u2_lat & 0xFF);
-            write_num((w_u2_lat >> 8) & 0xFF);
-        } else if (c.contains("daDevCapability")) {
-            const auto& d = c.at("daDevCapability").as_array();
-            write_num(d.size());
-            write_da(d);
-        } else {
-            write_num(0);
-        }
-    });
+    const auto* const array = value_->if_array();
+    if (array == nullptr) {
+        fail("expected an array");
+    }
+
+    auto child_pointer = std::format("{}/{}", pointer_, index);
+    if (index >= array->size()) {
+        throw schema_error{std::move(child_pointer), "missing element"};
+    }
+
+    return node{(*array)[index], std::move(child_pointer)};
 }
 
-void parser::build_descriptor(const std::string& data)
+auto node::size() const -> std::size_t
 {
-    boost::json::value root = boost::json::parse(data);
-
-    const auto& dev = root.at("aofDevices").as_array()[0].as_object();
-    const auto& dd = dev.at("Device Descriptor").as_object();
-
-    write_num(read_u32(dd, "bLength"));
-    write_num(read_u32(dd, "bDescriptorType"));
-    write_num(read_u32(dd, "bcdUSB"));
-    write_num(read_u32(dd, "bDeviceClass"));
-    write_num(read_u32(dd, "bDeviceSubClass"));
-    write_num(read_u32(dd, "bDeviceProtocol"));
-    write_num(read_u32(dd, "bMaxPacketSize0"));
-    write_num(read_u32(dd, "idVendor"));
-    write_num(read_u32(dd, "idProduct"));
-    write_num(read_u32(dd, "bcdDevice"));
-    write_num(read_u32(dd, "iManufacturer"));
-    write_num(read_u32(dd, "iProduct"));
-    write_num(read_u32(dd, "iSerial"));
-    write_num(read_u32(dd, "bNumConfigurations"));
-
-    std::ranges::for_each(
-        dd.at("aofConfigurations").as_array(),
-        [&](const auto& cfg) { build_configuration(cfg.as_object()); }
-    );
-
-    build_string_descriptors(dev);
-
-    const auto& report = dev.at("daReportDescriptor").as_array();
-    write_num(report.size());
-    write_da(report);
-
-    build_bos(dev.at("BOS Descriptor").as_object());
+    const auto* const array = value_->if_array();
+    if (array == nullptr) {
+        fail("expected an array");
+    }
+
+    return array->size();
 }
 
-auto parser::read_u32(const boost::json::value& v) -> std::uint32_t
+auto node::string() const -> std::string_view
 {
-    if (v.is_int64()) {
-        return static_cast<std::uint32_t>(v.as_int64());
+    const auto* const s = value_->if_string();
+    if (s == nullptr) {
+        fail("expected a string");
     }
 
-    if (v.is_string()) {
-        return std::stoul(std::string(v.as_string()), nullptr, 0);
+    return {s->data(), s->size()};
+}
+
+auto node::u32() const -> std::uint32_t
+{
+    const auto v = to_u32(*value_);
+    if (!v.has_value()) {
+        fail("expected an unsigned 32-bit integer or integer string");
     }
 
-    throw std::runtime_error("Expected int or hex string");
+    return *v;
 }
 
-auto parser::read_u32(
-    const boost::json::object& jobject,
-    const std::string_view& key
-) -> std::uint32_t
+auto node::bytes() const -> std::vector<std::uint8_t>
 {
-    if (jobject.contains(key)) {
-        const auto& v = jobject.at(key);
-        return read_u32(v);
+    const auto* const array = value_->if_array();
+    if (array == nullptr) {
+        fail("expected an array");
+    }
+
+    auto out = std::vector<std::uint8_t>{};
+    out.reserve(array->size());
+
+    for (const auto& element : *array) {
+        const auto v = to_u32(element);
+        if (!v.has_value() || *v > std::numeric_limits<std::uint8_t>::max()) {
+            at(std::size(out)).fail("expected a byte value");
+        }
+
+        out.push_back(static_cast<std::uint8_t>(*v));
     }
 
-    return 0;
+    return out;
 }
 
-auto parser::parse(const std::string& data) -> std::string
+void node::fail(const std::string& what) const
 {
-    build_descriptor(data);
-    return out_.str();
+    throw schema_error{pointer_, what};
+}
+
+auto parse_file(const std::filesystem::path& path) -> boost::json::value
+{
+    auto file = std::ifstream{path, std::ios_base::binary};
+    if (!file.is_open()) {
+        throw std::runtime_error{
+            std::format("Cannot open {}", path.string())
+        };
+    }
+
+    const auto data = std::string{
+        std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>()
+    };
+
+    return boost::json::parse(data);
 }
 
 } // namespace viu::json
@@ -0,0 +1,324 @@
+export module viu.metrics;
+
+import std;
+
+namespace viu::metrics {
+
+// Updated from the data path with relaxed atomics, readers only need a
+// recent value, not one consistent with the other counters.
+export class counter {
+public:
+    void add(const std::uint64_t n = 1) noexcept
+    {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto value() const noexcept -> std::uint64_t
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> value_{0};
+};
+
+// A level that goes up and down, e.g. the number of queued items.
+export class gauge {
+public:
+    void add(const std::int64_t n = 1) noexcept
+    {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void sub(const std::int64_t n = 1) noexcept
+    {
+        value_.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto value() const noexcept -> std::int64_t
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::int64_t> value_{0};
+};
+
+// Latencies in power of two microsecond buckets: bucket i counts samples
+// below 2^i us, the last bucket everything above.
+export class histogram {
+public:
+    static constexpr auto bucket_count = std::size_t{24};
+
+    void record(const std::chrono::nanoseconds latency) noexcept
+    {
+        const auto ns = static_cast<std::uint64_t>(
+            std::max(latency.count(), std::int64_t{0})
+        );
+        const auto us = ns / 1000;
+        const auto index = std::min<std::size_t>(
+            std::bit_width(us),
+            bucket_count - 1
+        );
+
+        buckets_[index].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto count() const noexcept -> std::uint64_t
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto sum() const noexcept -> std::chrono::nanoseconds
+    {
+        return std::chrono::nanoseconds{
+            static_cast<std::int64_t>(sum_ns_.load(std::memory_order_relaxed))
+        };
+    }
+
+    [[nodiscard]] auto bucket(const std::size_t index) const noexcept
+        -> std::uint64_t
+    {
+        return buckets_[index].load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] static constexpr auto upper_bound(const std::size_t index)
+        -> std::chrono::microseconds
+    {
+        return std::chrono::microseconds{std::int64_t{1} << index};
+    }
+
+    // Upper bound of the bucket the q-quantile falls into.
+    [[nodiscard]] auto quantile(const double q) const
+        -> std::chrono::microseconds
+    {
+        const auto total = count();
+        if (total == 0) {
+            return std::chrono::microseconds{0};
+        }
+
+        const auto rank = static_cast<std::uint64_t>(
+            std::ceil(q * static_cast<double>(total))
+        );
+
+        auto seen = std::uint64_t{0};
+        for (auto i = std::size_t{0}; i < bucket_count; ++i) {
+            seen += bucket(i);
+            if (seen >= rank) {
+                return upper_bound(i);
+            }
+        }
+
+        return upper_bound(bucket_count - 1);
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_ns_{0};
+};
+
+export constexpr auto max_endpoints = std::size_t{16};
+
+// Host side of an endpoint: usbip URBs as seen by device::basic.
+export struct urb_counters {
+    counter submitted{};
+    counter completed{};
+    counter bytes_in{};
+    counter bytes_out{};
+    counter errors{};
+    counter unlinks{};
+    counter dropped{};
+    histogram reply_latency{};
+};
+
+// Device side of an endpoint: transfers handed to libusb or the plugin.
+export struct transfer_counters {
+    counter submitted{};
+    counter completed{};
+    counter failed{};
+    counter bytes{};
+};
+
+export using urb_metrics = std::array<urb_counters, max_endpoints>;
+export using transfer_metrics = std::array<transfer_counters, max_endpoints>;
+
+// Kept next to the queues by their producers and consumers, reading them
+// does not touch the queue locks.
+export struct queue_gauges {
+    gauge commands{};
+    gauge replies{};
+    std::array<gauge, max_endpoints> in_commands{};
+    std::array<gauge, max_endpoints> in_data{};
+};
+
+export struct queue_depths {
+    std::size_t commands{};
+    std::size_t replies{};
+    std::array<std::size_t, max_endpoints> in_commands{};
+    std::array<std::size_t, max_endpoints> in_data{};
+};
+
+export void print(
+    std::ostream& os,
+    const urb_metrics& urbs,
+    const transfer_metrics& transfers,
+    const queue_depths& queues
+)
+{
+    std::println(
+        os,
+        "  queues: commands {}, replies {}",
+        queues.commands,
+        queues.replies
+    );
+
+    for (auto ep = std::size_t{0}; ep < max_endpoints; ++ep) {
+        const auto& urb = urbs[ep];
+        const auto& xfer = transfers[ep];
+        if (urb.submitted.value() == 0 && xfer.submitted.value() == 0) {
+            continue;
+        }
+
+        std::println(
+            os,
+            "  ep {:>2}: urbs {}/{} done, {} B in, {} B out, {} errors, "
+            "{} unlinks, {} dropped",
+            ep,
+            urb.completed.value(),
+            urb.submitted.value(),
+            urb.bytes_in.value(),
+            urb.bytes_out.value(),
+            urb.errors.value(),
+            urb.unlinks.value(),
+            urb.dropped.value()
+        );
+
+        std::println(
+            os,
+            "         transfers {}/{} done, {} failed, {} B; "
+            "queued {} commands, {} data",
+            xfer.completed.value(),
+            xfer.submitted.value(),
+            xfer.failed.value(),
+            xfer.bytes.value(),
+            queues.in_commands[ep],
+            queues.in_data[ep]
+        );
+
+        const auto& latency = urb.reply_latency;
+        if (latency.count() != 0) {
+            const auto mean = std::chrono::duration_cast<
+                std::chrono::microseconds>(latency.sum() / latency.count());
+            std::println(
+                os,
+                "         reply latency: mean {}, p50 < {}, p99 < {}",
+                mean,
+                latency.quantile(0.5),
+                latency.quantile(0.99)
+            );
+        }
+    }
+}
+
+// Text exposition in the OpenMetrics format. The samples of a family have
+// to follow its family() call without other families in between.
+export class openmetrics {
+public:
+    using label = std::pair<std::string_view, std::string_view>;
+    using label_list = std::initializer_list<label>;
+
+    void family(
+        const std::string_view name,
+        const std::string_view type,
+        const std::string_view help
+    )
+    {
+        std::format_to(out(), "# TYPE {} {}\n", name, type);
+        std::format_to(out(), "# HELP {} {}\n", name, help);
+    }
+
+    template <typename T>
+        requires std::is_arithmetic_v<T>
+    void sample(const std::string_view name, label_list labels, const T value)
+    {
+        write_name(name, labels);
+        std::format_to(out(), " {}\n", value);
+    }
+
+    // Cumulative buckets with bounds in seconds.
+    void sample(
+        const std::string_view name,
+        label_list labels,
+        const histogram& h
+    )
+    {
+        const auto bucket_name = std::format("{}_bucket", name);
+
+        auto cumulative = std::uint64_t{0};
+        for (auto i = std::size_t{0}; i < histogram::bucket_count - 1; ++i) {
+            cumulative += h.bucket(i);
+
+            const auto le = std::format(
+                "{}",
+                std::chrono::duration<double>(histogram::upper_bound(i))
+                    .count()
+            );
+            write_name(bucket_name, labels, label{"le", le});
+            std::format_to(out(), " {}\n", cumulative);
+        }
+
+        const auto count = h.count();
+        write_name(bucket_name, labels, label{"le", "+Inf"});
+        std::format_to(out(), " {}\n", count);
+
+        write_name(std::format("{}_count", name), labels);
+        std::format_to(out(), " {}\n", count);
+
+        write_name(std::format("{}_sum", name), labels);
+        std::format_to(
+            out(),
+            " {}\n",
+            std::chrono::duration<double>(h.sum()).count()
+        );
+    }
+
+    [[nodiscard]] auto finish() && -> std::string
+    {
+        out_ += "# EOF\n";
+        return std::move(out_);
+    }
+
+private:
+    auto out() { return std::back_inserter(out_); }
+
+    void write_name(
+        const std::string_view name,
+        label_list labels,
+        const std::optional<label>& extra = std::nullopt
+    )
+    {
+        out_ += name;
+
+        auto separator = '{';
+        const auto write = [&](const label& l) {
+            std::format_to(out(), "{}{}=\"{}\"", separator, l.first, l.second);
+            separator = ',';
+        };
+
+        std::ranges::for_each(labels, write);
+        if (extra) {
+            write(*extra);
+        }
+
+        if (separator == ',') {
+            out_ += '}';
+        }
+    }
+
+    std::string out_{};
+};
+
+} // namespace viu::metrics
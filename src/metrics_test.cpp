@@ -0,0 +1,123 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+import std;
+
+import viu.metrics;
+
+namespace viu::test {
+
+using namespace std::chrono_literals;
+
+class metrics_test : public testing::Test {
+protected:
+    metrics::histogram histogram_{};
+};
+
+TEST_F(metrics_test, counter)
+{
+    auto counter = metrics::counter{};
+    EXPECT_EQ(counter.value(), 0);
+
+    counter.add();
+    counter.add(41);
+    EXPECT_EQ(counter.value(), 42);
+}
+
+TEST_F(metrics_test, histogram_buckets)
+{
+    histogram_.record(500ns);
+    histogram_.record(1us);
+    histogram_.record(3us);
+    histogram_.record(-5us);
+
+    EXPECT_EQ(histogram_.count(), 4);
+    EXPECT_EQ(histogram_.sum(), 4500ns);
+    EXPECT_EQ(histogram_.bucket(0), 2);
+    EXPECT_EQ(histogram_.bucket(1), 1);
+    EXPECT_EQ(histogram_.bucket(2), 1);
+}
+
+TEST_F(metrics_test, histogram_overflow)
+{
+    histogram_.record(std::chrono::hours{1});
+
+    const auto last = metrics::histogram::bucket_count - 1;
+    EXPECT_EQ(histogram_.bucket(last), 1);
+    EXPECT_EQ(histogram_.quantile(1.0), metrics::histogram::upper_bound(last));
+}
+
+TEST_F(metrics_test, histogram_quantile)
+{
+    EXPECT_EQ(histogram_.quantile(0.5), 0us);
+
+    for (auto i = 0; i < 99; ++i) {
+        histogram_.record(10us);
+    }
+    histogram_.record(10ms);
+
+    EXPECT_EQ(histogram_.quantile(0.5), 16us);
+    EXPECT_EQ(histogram_.quantile(0.99), 16us);
+    EXPECT_EQ(histogram_.quantile(1.0), 16384us);
+}
+
+TEST_F(metrics_test, concurrent_updates)
+{
+    auto urb = metrics::urb_counters{};
+
+    {
+        auto threads = std::vector<std::jthread>{};
+        for (auto t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (auto i = 0; i < 1000; ++i) {
+                    urb.submitted.add();
+                    urb.reply_latency.record(1us);
+                }
+            });
+        }
+    }
+
+    EXPECT_EQ(urb.submitted.value(), 4000);
+    EXPECT_EQ(urb.reply_latency.count(), 4000);
+}
+
+TEST_F(metrics_test, openmetrics_text)
+{
+    histogram_.record(3us);
+    histogram_.record(3us);
+    histogram_.record(100ms);
+
+    auto om = metrics::openmetrics{};
+    om.family("viud_workers", "gauge", "Command worker threads");
+    om.sample("viud_workers", {}, 4);
+    om.family("viud_latency_seconds", "histogram", "Reply latency");
+    om.sample(
+        "viud_latency_seconds",
+        {{"device", "0"}, {"ep", "1"}},
+        histogram_
+    );
+    const auto text = std::move(om).finish();
+
+    const auto has = [&](std::string_view line) {
+        return text.contains(std::format("{}\n", line));
+    };
+
+    EXPECT_TRUE(text.starts_with("# TYPE viud_workers gauge\n"));
+    EXPECT_TRUE(has("# HELP viud_workers Command worker threads"));
+    EXPECT_TRUE(has("viud_workers 4"));
+    const auto bucket = [&](std::string_view le, std::uint64_t count) {
+        return has(std::format(
+            R"(viud_latency_seconds_bucket{{device="0",ep="1",le="{}"}} {})",
+            le,
+            count
+        ));
+    };
+
+    EXPECT_TRUE(bucket("2e-06", 0));
+    EXPECT_TRUE(bucket("4e-06", 2));
+    EXPECT_TRUE(bucket("+Inf", 3));
+    EXPECT_TRUE(has(R"(viud_latency_seconds_count{device="0",ep="1"} 3)"));
+    EXPECT_TRUE(text.ends_with("# EOF\n"));
+}
+
+} // namespace viu::test
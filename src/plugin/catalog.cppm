@@ -13,6 +13,7 @@ class catalog final : public catalog_interface {
 public:
     void set_name(std::string n) { name_ = std::move(n); }
     void set_version(std::string v) { version_ = std::move(v); }
+    void set_abi_version(std::uint32_t v) { abi_version_ = v; }
 
     using device_factory_fn = viu_usb_mock_opaque* (*)();
     auto register_device_factory(const std::string& name, device_factory_fn f)
@@ -36,7 +37,7 @@ public:
     }
 
     auto device(const std::string& name) const
-        -> viu::result<viu_usb_mock_opaque*> override
+        -> viu::result<usb::mock_plugin> override
     {
         const auto it = std::ranges::find_if(entries_, [&name](const auto& p) {
             return p.first == name;
@@ -44,7 +45,7 @@ public:
         if (it == entries_.end()) {
             return viu::make_error(viu::device::plugin::error::no_device);
         }
-        return it->second();
+        return usb::mock_plugin{it->second(), abi_version_};
     }
 
     template <typename C>
@@ -59,6 +60,7 @@ private:
 
     std::string name_{};
     std::string version_{};
+    std::uint32_t abi_version_{usb::abi::unversioned};
     std::vector<entry_type> entries_{};
 };
 
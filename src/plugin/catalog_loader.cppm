@@ -53,6 +53,13 @@ public:
 
         catalog_ = std::make_unique<device::plugin::catalog>();
 
+        const auto* abi_version = static_cast<const std::uint32_t*>(
+            dlsym(lib_handle_, abi_version_symbol_.c_str())
+        );
+        if (abi_version != nullptr) {
+            catalog_->set_abi_version(*abi_version);
+        }
+
         auto api = plugin_catalog_api{};
         api.ctx = this;
         api.set_name = &api_set_name;
@@ -76,7 +83,7 @@ public:
         return catalog_;
     }
 
-    auto device(const std::string& name) -> viu::result<viu_usb_mock_opaque*>
+    auto device(const std::string& name) -> viu::result<usb::mock_plugin>
     {
         return catalog()->device(name);
     }
@@ -95,6 +102,8 @@ private:
     }
 
     static constexpr auto ep_symbol_ = std::string{"on_plug"};
+    static constexpr auto abi_version_symbol_ =
+        std::string{"viu_usb_mock_abi_version"};
     void* lib_handle_{};
     std::unique_ptr<::viu::device::plugin::catalog> catalog_{};
 };
@@ -135,7 +144,7 @@ public:
     }
 
     auto device(const std::string& catalog_name, const std::string& device_name)
-        -> viu::result<viu_usb_mock_opaque*>
+        -> viu::result<usb::mock_plugin>
     {
         const auto it = plugins_.find(catalog_name);
         if (it == plugins_.end()) {
@@ -144,6 +153,27 @@ public:
         return it->second.device(device_name);
     }
 
+    // Whether a registered catalog offers `device_name`, without creating
+    // an instance of it.
+    auto has_device(
+        const std::string& catalog_name,
+        const std::string& device_name
+    ) const -> bool
+    {
+        const auto it = plugins_.find(catalog_name);
+        if (it == plugins_.end()) {
+            return false;
+        }
+
+        const auto catalog = it->second.catalog().get();
+        for (std::size_t n = 0; n < catalog->number_of_devices(); n++) {
+            if (catalog->device_name(n) == device_name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     auto list_catalogs(std::stringstream& ss) -> void
     {
         std::println(ss, "Registered Catalogs:");
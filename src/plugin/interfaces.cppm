@@ -21,7 +21,7 @@ struct catalog_interface {
     virtual auto number_of_devices() const -> std::size_t = 0;
     virtual auto device_name(std::size_t index) const -> std::string = 0;
     virtual auto device(const std::string& name) const
-        -> viu::result<viu_usb_mock_opaque*> = 0;
+        -> viu::result<usb::mock_plugin> = 0;
 };
 
 using on_plug_fn = void (*)(plugin_catalog_api* api);
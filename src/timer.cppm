@@ -0,0 +1,348 @@
+module;
+
+#include <cerrno>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+export module viu.timer;
+
+import std;
+
+import viu.assert;
+
+namespace viu::timer {
+
+// steady_clock is CLOCK_MONOTONIC, the clock the timerfd runs on.
+export using clock = std::chrono::steady_clock;
+export using id = std::uint64_t;
+
+// Hierarchical timer wheel with 125 us ticks: level L holds the timers whose
+// expiry tick first differs from the current tick in digit L (base 64), so a
+// timer is filed in O(1) and moves down a level at most once per level.
+// Timers beyond the top level wait in far_ for the top level to wrap.
+//
+// One thread serves all timers. It sleeps on a timerfd armed for the first
+// tick with something to do and runs the callbacks without the lock held;
+// they should return quickly, a periodic timer schedules itself again.
+export class wheel {
+public:
+    using callback = std::function<void()>;
+
+    static constexpr auto tick = std::chrono::microseconds{125};
+
+    wheel()
+        : fd_{::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)},
+          origin_{clock::now()}
+    {
+        if (fd_ < 0) {
+            throw std::system_error{
+                errno,
+                std::generic_category(),
+                "timerfd_create"
+            };
+        }
+
+        thread_ = std::jthread{[this] { run(); }};
+    }
+
+    ~wheel()
+    {
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+            stopping_ = true;
+            arm_at(clock::now());
+        }
+
+        thread_.join();
+        ::close(fd_);
+    }
+
+    wheel(const wheel&) = delete;
+    wheel(wheel&&) = delete;
+    auto operator=(const wheel&) -> wheel& = delete;
+    auto operator=(wheel&&) -> wheel& = delete;
+
+    // Calls `cb` once at `deadline`, right away if it already passed. Ids
+    // start at 1.
+    auto schedule(const clock::time_point deadline, callback cb) -> id
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+
+        const auto timer = next_id_++;
+        const auto expiry = std::max(tick_after(deadline), current_ + 1);
+        timers_.emplace(timer, entry{.expiry = expiry, .cb = std::move(cb)});
+        file(timer, expiry);
+
+        if (expiry < armed_) {
+            arm();
+        }
+
+        return timer;
+    }
+
+    // True if the timer was pending and will not run. A callback running on
+    // the wheel thread is waited for, unless cancel() is called from one.
+    auto cancel(const id timer) -> bool
+    {
+        auto lock = std::unique_lock<std::mutex>{mutex_};
+        if (timers_.erase(timer) != 0) {
+            return true;
+        }
+
+        if (std::this_thread::get_id() != thread_.get_id()) {
+            idle_.wait(lock, [this, timer] { return running_ != timer; });
+        }
+
+        return false;
+    }
+
+    [[nodiscard]] auto pending() -> std::size_t
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+        return std::size(timers_);
+    }
+
+private:
+    static constexpr auto slot_bits = 6U;
+    static constexpr auto slot_count = std::size_t{1} << slot_bits;
+    static constexpr auto level_count = 5U;
+    static constexpr auto wheel_bits = slot_bits * level_count;
+
+    struct entry {
+        std::uint64_t expiry{};
+        callback cb{};
+    };
+
+    using slot = std::vector<id>;
+
+    struct level {
+        std::array<slot, slot_count> slots{};
+        std::uint64_t occupied{};
+    };
+
+    static constexpr auto digit(const std::uint64_t t, const unsigned l)
+        -> std::size_t
+    {
+        return (t >> (slot_bits * l)) & (slot_count - 1);
+    }
+
+    auto tick_of(const clock::time_point time) const -> std::uint64_t
+    {
+        return static_cast<std::uint64_t>(
+            std::max((time - origin_) / tick, clock::rep{0})
+        );
+    }
+
+    auto tick_after(const clock::time_point time) const -> std::uint64_t
+    {
+        const auto t = tick_of(time);
+        return time_of(t) < time ? t + 1 : t;
+    }
+
+    auto time_of(const std::uint64_t t) const -> clock::time_point
+    {
+        return origin_ + static_cast<clock::rep>(t) * tick;
+    }
+
+    void file(const id timer, const std::uint64_t expiry)
+    {
+        const auto differs = expiry ^ current_;
+        if ((differs >> wheel_bits) != 0) {
+            far_.push_back(timer);
+            return;
+        }
+
+        const auto l = static_cast<unsigned>(
+            (std::bit_width(differs) - 1) / slot_bits
+        );
+        const auto i = digit(expiry, l);
+        levels_[l].slots[i].push_back(timer);
+        levels_[l].occupied |= std::uint64_t{1} << i;
+    }
+
+    // First tick after the current one at which a timer fires or moves down
+    // a level.
+    auto next_event() const -> std::optional<std::uint64_t>
+    {
+        for (auto l = 0U; l < level_count; ++l) {
+            const auto p = digit(current_, l);
+            const auto later = p + 1 == slot_count
+                                   ? std::uint64_t{0}
+                                   : levels_[l].occupied >> (p + 1) << (p + 1);
+            if (later == 0) {
+                continue;
+            }
+
+            const auto i = static_cast<std::uint64_t>(std::countr_zero(later));
+            const auto above = slot_bits * (l + 1);
+            return (current_ >> above << above) | (i << (slot_bits * l));
+        }
+
+        if (!far_.empty()) {
+            return ((current_ >> wheel_bits) + 1) << wheel_bits;
+        }
+
+        return std::nullopt;
+    }
+
+    // Moves the wheel to `target`, jumping over ticks with nothing to do,
+    // and collects the timers that expired.
+    void advance(const std::uint64_t target, std::vector<id>& due)
+    {
+        while (current_ < target) {
+            const auto next = next_event();
+            if (!next.has_value() || *next > target) {
+                current_ = target;
+                return;
+            }
+
+            current_ = *next;
+            cascade(due);
+        }
+    }
+
+    void cascade(std::vector<id>& due)
+    {
+        const auto refile = [this, &due](slot timers) {
+            for (const auto timer : timers) {
+                const auto it = timers_.find(timer);
+                if (it == std::end(timers_)) {
+                    continue;
+                }
+
+                if (it->second.expiry <= current_) {
+                    due.push_back(timer);
+                } else {
+                    file(timer, it->second.expiry);
+                }
+            }
+        };
+
+        if ((current_ & ((std::uint64_t{1} << wheel_bits) - 1)) == 0) {
+            refile(std::exchange(far_, {}));
+        }
+
+        for (auto l = level_count; l-- > 0;) {
+            const auto below = slot_bits * l;
+            if ((current_ & ((std::uint64_t{1} << below) - 1)) != 0) {
+                continue;
+            }
+
+            const auto i = digit(current_, l);
+            levels_[l].occupied &= ~(std::uint64_t{1} << i);
+            refile(std::exchange(levels_[l].slots[i], {}));
+        }
+    }
+
+    void arm_at(const clock::time_point time)
+    {
+        const auto since_epoch = time.time_since_epoch();
+        const auto seconds = std::chrono::floor<std::chrono::seconds>(
+            since_epoch
+        );
+        const auto nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                since_epoch - seconds
+            );
+
+        // A zero it_value would disarm the timer.
+        auto spec = itimerspec{};
+        spec.it_value.tv_sec = seconds.count();
+        spec.it_value.tv_nsec =
+            std::max<std::int64_t>(nanoseconds.count(), 1);
+
+        const auto result =
+            ::timerfd_settime(fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+        viu::_assert(result == 0);
+    }
+
+    void arm()
+    {
+        const auto next = next_event();
+        if (!next.has_value()) {
+            armed_ = std::numeric_limits<std::uint64_t>::max();
+            auto spec = itimerspec{};
+            ::timerfd_settime(fd_, 0, &spec, nullptr);
+            return;
+        }
+
+        armed_ = *next;
+        arm_at(time_of(*next));
+    }
+
+    void fire(const id timer)
+    {
+        auto cb = callback{};
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+            const auto it = timers_.find(timer);
+            if (it == std::end(timers_)) {
+                return;
+            }
+
+            cb = std::move(it->second.cb);
+            timers_.erase(it);
+            running_ = timer;
+        }
+
+        cb();
+
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+            running_ = 0;
+        }
+
+        idle_.notify_all();
+    }
+
+    void run()
+    {
+        auto due = std::vector<id>{};
+
+        while (true) {
+            auto expirations = std::uint64_t{};
+            if (::read(fd_, &expirations, sizeof(expirations)) < 0 &&
+                errno != EINTR) {
+                viu::_assert(false);
+            }
+
+            {
+                [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+                if (stopping_) {
+                    return;
+                }
+
+                advance(tick_of(clock::now()), due);
+                arm();
+            }
+
+            std::ranges::for_each(due, [this](const id t) { fire(t); });
+            due.clear();
+        }
+    }
+
+    const int fd_;
+    const clock::time_point origin_;
+
+    std::mutex mutex_{};
+    std::condition_variable idle_{};
+    std::unordered_map<id, entry> timers_{};
+    std::array<level, level_count> levels_{};
+    slot far_{};
+    std::uint64_t current_{0};
+    std::uint64_t armed_{std::numeric_limits<std::uint64_t>::max()};
+    id next_id_{1};
+    id running_{0};
+    bool stopping_{false};
+
+    std::jthread thread_{};
+};
+
+// The wheel shared by all plugins of the process, started on first use.
+export auto shared() -> wheel&
+{
+    static auto w = wheel{};
+    return w;
+}
+
+} // namespace viu::timer
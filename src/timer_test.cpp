@@ -0,0 +1,97 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+import std;
+
+import viu.timer;
+
+namespace viu::test {
+
+using namespace std::chrono_literals;
+
+class timer_test : public testing::Test {
+protected:
+    timer::wheel wheel_{};
+};
+
+TEST_F(timer_test, fires_in_deadline_order)
+{
+    const auto now = timer::clock::now();
+    auto fired = std::vector<int>{};
+    auto mutex = std::mutex{};
+    auto done = std::latch{3};
+
+    const auto record = [&](const int n) {
+        return [&, n] {
+            {
+                [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex};
+                fired.push_back(n);
+            }
+            done.count_down();
+        };
+    };
+
+    wheel_.schedule(now + 30ms, record(3));
+    wheel_.schedule(now + 10ms, record(1));
+    wheel_.schedule(now + 20ms, record(2));
+    done.wait();
+
+    EXPECT_EQ(fired, (std::vector<int>{1, 2, 3}));
+    EXPECT_EQ(wheel_.pending(), 0);
+}
+
+TEST_F(timer_test, not_before_deadline)
+{
+    const auto deadline = timer::clock::now() + 15ms;
+    auto fired_at = std::promise<timer::clock::time_point>{};
+
+    wheel_.schedule(deadline, [&fired_at] {
+        fired_at.set_value(timer::clock::now());
+    });
+
+    EXPECT_GE(fired_at.get_future().get(), deadline);
+}
+
+TEST_F(timer_test, cancel)
+{
+    auto fired = std::atomic<bool>{false};
+    const auto t = wheel_.schedule(timer::clock::now() + 20ms, [&fired] {
+        fired = true;
+    });
+
+    EXPECT_TRUE(wheel_.cancel(t));
+    EXPECT_FALSE(wheel_.cancel(t));
+
+    std::this_thread::sleep_for(50ms);
+    EXPECT_FALSE(fired);
+}
+
+TEST_F(timer_test, reschedules_from_callback)
+{
+    auto count = 0;
+    auto done = std::promise<void>{};
+
+    auto tick = std::function<void()>{};
+    tick = [&] {
+        if (++count == 5) {
+            done.set_value();
+            return;
+        }
+        wheel_.schedule(timer::clock::now() + 2ms, tick);
+    };
+
+    wheel_.schedule(timer::clock::now(), tick);
+    done.get_future().wait();
+
+    EXPECT_EQ(count, 5);
+}
+
+TEST_F(timer_test, far_deadline_waits)
+{
+    const auto t = wheel_.schedule(timer::clock::now() + 72h, [] {});
+
+    EXPECT_EQ(wheel_.pending(), 1);
+    EXPECT_TRUE(wheel_.cancel(t));
+}
+
+} // namespace viu::test
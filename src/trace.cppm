@@ -0,0 +1,356 @@
+export module viu.trace;
+
+import std;
+
+namespace viu::trace {
+
+#ifdef VIU_TRACING
+export constexpr auto compiled_in = true;
+#else
+export constexpr auto compiled_in = false;
+#endif
+
+// Steps of a URB through the device, in the order they usually happen.
+export enum class point : std::uint8_t {
+    read,
+    queued,
+    executing,
+    submitted,
+    completed,
+    paired,
+    written
+};
+
+export constexpr auto point_name(const point p) -> std::string_view
+{
+    switch (p) {
+        case point::read:
+            return "read";
+        case point::queued:
+            return "queued";
+        case point::executing:
+            return "executing";
+        case point::submitted:
+            return "submitted";
+        case point::completed:
+            return "completed";
+        case point::paired:
+            return "paired";
+        case point::written:
+            return "written";
+    }
+
+    return "unknown";
+}
+
+export struct event {
+    std::chrono::steady_clock::time_point time{};
+    std::uint32_t source{};
+    std::uint32_t seqnum{};
+    std::uint32_t thread{};
+    std::uint8_t ep{};
+    point where{};
+};
+
+// Written by one thread only. Slots are atomics so that a reader racing
+// with the writer sees stale events rather than undefined behaviour.
+class ring {
+public:
+    static constexpr auto capacity = std::size_t{4096};
+
+    explicit ring(const std::uint32_t thread) : thread_{thread} {}
+
+    void push(
+        const point where,
+        const std::uint32_t source,
+        const std::uint32_t seqnum,
+        const std::uint8_t ep
+    ) noexcept
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        auto& s = slots_[head % capacity];
+
+        s.time.store(
+            std::chrono::steady_clock::now().time_since_epoch().count(),
+            std::memory_order_relaxed
+        );
+        s.key.store(
+            (std::uint64_t{source} << 32U) | seqnum,
+            std::memory_order_relaxed
+        );
+        s.info.store(
+            static_cast<std::uint16_t>((ep << 8U) | std::to_underlying(where)),
+            std::memory_order_relaxed
+        );
+
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    void clear() noexcept { head_.store(0, std::memory_order_relaxed); }
+
+    // The oldest slot of a full ring may be overwritten while it is read,
+    // it is left out.
+    void snapshot(std::vector<event>& out) const
+    {
+        const auto head = head_.load(std::memory_order_acquire);
+        const auto first = head > capacity ? head - capacity + 1 : 0;
+
+        for (auto i = first; i < head; ++i) {
+            const auto& s = slots_[i % capacity];
+            const auto key = s.key.load(std::memory_order_relaxed);
+            const auto info = s.info.load(std::memory_order_relaxed);
+
+            out.push_back(
+                event{
+                    .time = std::chrono::steady_clock::time_point{
+                        std::chrono::steady_clock::duration{
+                            s.time.load(std::memory_order_relaxed)
+                        }
+                    },
+                    .source = static_cast<std::uint32_t>(key >> 32U),
+                    .seqnum = static_cast<std::uint32_t>(key),
+                    .thread = thread_,
+                    .ep = static_cast<std::uint8_t>(info >> 8U),
+                    .where = static_cast<point>(info & 0xffU)
+                }
+            );
+        }
+    }
+
+private:
+    struct slot {
+        std::atomic<std::chrono::steady_clock::rep> time{};
+        std::atomic<std::uint64_t> key{};
+        std::atomic<std::uint16_t> info{};
+    };
+
+    std::uint32_t thread_{};
+    std::atomic<std::uint64_t> head_{0};
+    std::array<slot, capacity> slots_{};
+};
+
+// Rings of all threads that recorded an event, a ring outlives its thread
+// until the next trace starts.
+class rings {
+public:
+    auto local() -> ring&
+    {
+        thread_local auto r = [this] {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+            const auto thread = static_cast<std::uint32_t>(next_thread_++);
+            return all_.emplace_back(std::make_shared<ring>(thread));
+        }();
+
+        return *r;
+    }
+
+    void clear()
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+        std::erase_if(all_, [](const auto& r) { return r.use_count() == 1; });
+        std::ranges::for_each(all_, [](const auto& r) { r->clear(); });
+    }
+
+    auto collect() -> std::vector<event>
+    {
+        auto events = std::vector<event>{};
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+            for (const auto& r : all_) {
+                r->snapshot(events);
+            }
+        }
+
+        std::ranges::sort(events, {}, &event::time);
+        return events;
+    }
+
+private:
+    std::mutex mutex_{};
+    std::size_t next_thread_{0};
+    std::vector<std::shared_ptr<ring>> all_{};
+};
+
+inline auto enabled = std::atomic<bool>{false};
+inline auto session_mutex = std::mutex{};
+inline auto next_source = std::atomic<std::uint32_t>{0};
+
+auto all_rings() -> rings&
+{
+    static auto r = rings{};
+    return r;
+}
+
+// Identifies one device in the events, seqnums are only unique per device.
+export auto make_source() -> std::uint32_t
+{
+    return next_source.fetch_add(1, std::memory_order_relaxed);
+}
+
+// A relaxed load when tracing is off, nothing at all when it is compiled
+// out.
+export inline void record(
+    const point where,
+    const std::uint32_t source,
+    const std::uint32_t seqnum,
+    const std::uint32_t ep
+) noexcept
+{
+    if constexpr (compiled_in) {
+        if (enabled.load(std::memory_order_relaxed)) {
+            all_rings().local().push(
+                where,
+                source,
+                seqnum,
+                static_cast<std::uint8_t>(ep)
+            );
+        }
+    }
+}
+
+// Records events while it is alive. Only one session runs at a time.
+export class session {
+public:
+    session() : lock_{session_mutex, std::try_to_lock}
+    {
+        if (lock_.owns_lock()) {
+            all_rings().clear();
+            enabled.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    ~session()
+    {
+        if (lock_.owns_lock()) {
+            enabled.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    session(const session&) = delete;
+    session(session&&) = delete;
+    auto operator=(const session&) -> session& = delete;
+    auto operator=(session&&) -> session& = delete;
+
+    [[nodiscard]] auto active() const noexcept -> bool
+    {
+        return lock_.owns_lock();
+    }
+
+    // Ends the session and returns its events ordered by time.
+    auto stop() -> std::vector<event>
+    {
+        enabled.store(false, std::memory_order_relaxed);
+        return all_rings().collect();
+    }
+
+private:
+    std::unique_lock<std::mutex> lock_;
+};
+
+// Chrome trace event JSON, loadable by Perfetto and chrome://tracing. Each
+// source becomes a process; every URB is an async slice split into the
+// steps between its events, and each event is also an instant on the
+// thread that recorded it.
+export auto to_chrome_json(
+    const std::span<const event> events,
+    const std::map<std::uint32_t, std::string>& source_names
+) -> std::string
+{
+    auto out = std::string{"{\"traceEvents\":[\n"};
+    auto separator = std::string_view{};
+    const auto append = [&]<typename... Args>(
+                            std::format_string<Args...> fmt,
+                            Args&&... args
+                        ) {
+        out += separator;
+        std::format_to(
+            std::back_inserter(out),
+            fmt,
+            std::forward<Args>(args)...
+        );
+        separator = ",\n";
+    };
+
+    for (const auto& [source, name] : source_names) {
+        append(
+            R"({{"ph":"M","name":"process_name","pid":{},)"
+            R"("args":{{"name":"{}"}}}})",
+            source,
+            name
+        );
+    }
+
+    if (events.empty()) {
+        out += "\n]}\n";
+        return out;
+    }
+
+    const auto origin = events.front().time;
+    const auto us = [origin](const auto time) {
+        return std::chrono::duration<double, std::micro>(time - origin).count();
+    };
+
+    auto urbs = std::map<std::pair<std::uint32_t, std::uint32_t>,
+                         std::vector<const event*>>{};
+    for (const auto& e : events) {
+        urbs[{e.source, e.seqnum}].push_back(&e);
+
+        append(
+            R"({{"ph":"i","s":"t","name":"{}","pid":{},"tid":{},"ts":{:.3f},)"
+            R"("args":{{"seqnum":{},"ep":{}}}}})",
+            point_name(e.where),
+            e.source,
+            e.thread,
+            us(e.time),
+            e.seqnum,
+            e.ep
+        );
+    }
+
+    for (const auto& [key, steps] : urbs) {
+        const auto& [source, seqnum] = key;
+        const auto& first = *steps.front();
+        const auto& last = *steps.back();
+
+        const auto id = std::format("{}:{}", source, seqnum);
+        const auto begin = [&](std::string_view name, const event& e) {
+            append(
+                R"({{"ph":"b","cat":"urb","id":"{}","name":"{}","pid":{},)"
+                R"("ts":{:.3f},"args":{{"ep":{}}}}})",
+                id,
+                name,
+                source,
+                us(e.time),
+                e.ep
+            );
+        };
+        const auto end = [&](std::string_view name, const event& e) {
+            append(
+                R"({{"ph":"e","cat":"urb","id":"{}","name":"{}","pid":{},)"
+                R"("ts":{:.3f}}})",
+                id,
+                name,
+                source,
+                us(e.time)
+            );
+        };
+
+        const auto urb = std::format("urb {} ep {}", seqnum, first.ep);
+        begin(urb, first);
+        for (auto i = std::size_t{1}; i < std::size(steps); ++i) {
+            const auto step = std::format(
+                "{} -> {}",
+                point_name(steps[i - 1]->where),
+                point_name(steps[i]->where)
+            );
+            begin(step, *steps[i - 1]);
+            end(step, *steps[i]);
+        }
+        end(urb, last);
+    }
+
+    out += "\n]}\n";
+    return out;
+}
+
+} // namespace viu::trace
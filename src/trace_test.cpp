@@ -0,0 +1,93 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+import std;
+
+import viu.trace;
+
+namespace viu::test {
+
+class trace_test : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        if constexpr (!trace::compiled_in) {
+            GTEST_SKIP() << "Built without VIU_TRACING";
+        }
+    }
+
+    const std::uint32_t source_{trace::make_source()};
+};
+
+TEST_F(trace_test, records_only_during_session)
+{
+    trace::record(trace::point::read, source_, 1, 2);
+
+    auto session = trace::session{};
+    ASSERT_TRUE(session.active());
+
+    trace::record(trace::point::read, source_, 7, 2);
+    trace::record(trace::point::queued, source_, 7, 2);
+
+    const auto events = session.stop();
+    trace::record(trace::point::executing, source_, 7, 2);
+
+    ASSERT_EQ(std::size(events), 2);
+    EXPECT_EQ(events[0].where, trace::point::read);
+    EXPECT_EQ(events[1].where, trace::point::queued);
+    EXPECT_EQ(events[0].seqnum, 7);
+    EXPECT_EQ(events[0].ep, 2);
+    EXPECT_EQ(events[0].source, source_);
+    EXPECT_LE(events[0].time, events[1].time);
+}
+
+TEST_F(trace_test, one_session_at_a_time)
+{
+    const auto first = trace::session{};
+    const auto second = trace::session{};
+
+    EXPECT_TRUE(first.active());
+    EXPECT_FALSE(second.active());
+}
+
+TEST_F(trace_test, collects_from_all_threads)
+{
+    auto session = trace::session{};
+
+    {
+        auto threads = std::vector<std::jthread>{};
+        for (auto t = 0U; t < 4; ++t) {
+            threads.emplace_back([this, t] {
+                trace::record(trace::point::written, source_, t, 1);
+            });
+        }
+    }
+
+    const auto events = session.stop();
+    ASSERT_EQ(std::size(events), 4);
+
+    auto threads = std::set<std::uint32_t>{};
+    for (const auto& e : events) {
+        threads.insert(e.thread);
+    }
+    EXPECT_EQ(std::size(threads), 4);
+}
+
+TEST_F(trace_test, chrome_json)
+{
+    auto session = trace::session{};
+    trace::record(trace::point::read, source_, 3, 1);
+    trace::record(trace::point::written, source_, 3, 1);
+    const auto events = session.stop();
+
+    const auto json = trace::to_chrome_json(events, {{source_, "device 0"}});
+
+    EXPECT_TRUE(json.starts_with(R"({"traceEvents":[)"));
+    EXPECT_TRUE(json.contains(R"("name":"process_name")"));
+    EXPECT_TRUE(json.contains(R"("name":"urb 3 ep 1")"));
+    EXPECT_TRUE(json.contains(R"("name":"read -> written")"));
+    EXPECT_TRUE(json.contains(R"("ph":"i")"));
+    EXPECT_TRUE(json.ends_with("]}\n"));
+}
+
+} // namespace viu::test
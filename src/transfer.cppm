@@ -51,6 +51,7 @@ export auto iso_descriptor_size(const auto& obj) noexcept
 
 export auto is_mock(const libusb_transfer* const transfer) -> bool;
 export auto actual_length(const pointer& transfer) -> std::uint32_t;
+export auto usbip_status(const pointer& transfer) -> std::int32_t;
 export auto iso_data(const pointer& transfer) -> buffer_type;
 export auto iso_descriptors(const pointer& transfer) -> usb::descriptor::iso;
 
@@ -70,6 +71,7 @@ export struct pending_map {
     );
     void cancel();
     void on_transfer_completed_impl(libusb_transfer* transfer);
+    void on_transfers_completed_impl(std::span<libusb_transfer* const> xfers);
 
 private:
     void wait_for_canceled_transfers();
@@ -84,13 +86,18 @@ private:
 export struct control {
     control() = default;
     explicit control(libusb_transfer* xfer) : xfer_{xfer} {}
-    void complete() const;
+    void complete(
+        libusb_transfer_status status = LIBUSB_TRANSFER_COMPLETED
+    ) const;
+    void set_status(libusb_transfer_status status) const;
     [[nodiscard]] auto is_in() -> bool const;
     [[nodiscard]] auto is_out() -> bool const;
-    void fill(const std::vector<std::uint8_t>& data);
+    void fill(std::span<const std::uint8_t> data);
     [[nodiscard]] auto read(std::optional<std::uint32_t> size = std::nullopt)
         -> transfer::buffer_type const;
     [[nodiscard]] auto size() const -> int;
+    [[nodiscard]] auto buffer() const -> std::span<std::uint8_t>;
+    void set_actual_length(std::size_t length);
     [[nodiscard]] auto type() const -> unsigned char;
     [[nodiscard]] auto ep() const -> std::uint8_t;
     [[nodiscard]] auto read_iso_packet_descriptors() const
@@ -4,6 +4,8 @@ module;
 
 #include <libusb.h>
 
+#include "usdt.h"
+
 module viu.transfer;
 
 import viu.assert;
@@ -29,6 +31,7 @@ auto pending_map::give_away_transfer(libusb_transfer* const transfer)
 void pending_map::on_transfer_completed_impl(libusb_transfer* const transfer)
 {
     std::unique_lock lock(mutex_);
+    VIU_PROBE2(transfer_dispatched, transfer, transfer->status);
 
     if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT ||
         transfer->status == LIBUSB_TRANSFER_CANCELLED) {
@@ -50,6 +53,36 @@ void pending_map::on_transfer_completed_impl(libusb_transfer* const transfer)
     }
 }
 
+// One lock for the whole batch, callbacks still run outside of it.
+void pending_map::on_transfers_completed_impl(
+    const std::span<libusb_transfer* const> xfers
+)
+{
+    auto callbacks = std::vector<callback_type>{};
+    callbacks.reserve(std::size(xfers));
+
+    {
+        [[maybe_unused]] const std::unique_lock _(mutex_);
+        for (auto* const transfer : xfers) {
+            VIU_PROBE2(transfer_dispatched, transfer, transfer->status);
+
+            auto node = pending_transfers_.extract(transfer);
+            viu::_assert(!node.empty());
+            callbacks.push_back(std::move(node.mapped()));
+        }
+    }
+
+    for (auto i = std::size_t{0}; i < std::size(xfers); ++i) {
+        auto* const transfer = xfers[i];
+        if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT ||
+            transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+            give_away_transfer(transfer);
+        } else {
+            callbacks[i](give_away_transfer(transfer));
+        }
+    }
+}
+
 void pending_map::attach(
     const callback_type& cb,
     libusb_transfer* const transfer,
@@ -62,6 +95,7 @@ void pending_map::attach(
         [[maybe_unused]] const std::unique_lock _(mutex_);
         auto r = pending_transfers_.insert({transfer, cb});
         viu::_assert(r.second);
+        VIU_PROBE2(transfer_pending, transfer, std::size(pending_transfers_));
     }
 }
 
@@ -165,6 +199,31 @@ void pending_map::submit(
     viu::_assert(res == LIBUSB_SUCCESS);
 }
 
+// https://www.kernel.org/doc/html/v4.18/driver-api/usb/error-codes.html
+auto usbip_status(const usb::transfer::pointer& transfer) -> std::int32_t
+{
+    viu::_assert(transfer != nullptr);
+
+    switch (transfer->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return 0;
+        case LIBUSB_TRANSFER_STALL:
+            return -EPIPE;
+        case LIBUSB_TRANSFER_CANCELLED:
+            return -ECONNRESET;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return -ETIMEDOUT;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            return -ENODEV;
+        case LIBUSB_TRANSFER_OVERFLOW:
+            return -EOVERFLOW;
+        case LIBUSB_TRANSFER_ERROR:
+            break;
+    }
+
+    return -EPROTO;
+}
+
 auto iso_data(const usb::transfer::pointer& transfer)
     -> usb::transfer::buffer_type
 {
@@ -241,15 +300,28 @@ auto iso_descriptors(const usb::transfer::pointer& transfer)
     return iso_desc;
 }
 
-void control::complete() const
+void control::complete(const libusb_transfer_status status) const
+{
+    set_status(status);
+
+    if (xfer_->callback != nullptr) {
+        xfer_->callback(xfer_);
+    }
+}
+
+// An OUT payload read in place leaves the length unset, the plugin took
+// the whole buffer.
+void control::set_status(const libusb_transfer_status status) const
 {
     viu::_assert(xfer_ != nullptr);
     viu::_assert(usb::transfer::is_mock(xfer_));
 
-    xfer_->status = LIBUSB_TRANSFER_COMPLETED;
+    xfer_->status = status;
 
-    if (xfer_->callback != nullptr) {
-        xfer_->callback(xfer_);
+    auto self = control{xfer_};
+    if (status == LIBUSB_TRANSFER_COMPLETED && self.is_out() &&
+        xfer_->actual_length == 0) {
+        self.set_actual_length(static_cast<std::size_t>(xfer_->length));
     }
 }
 
@@ -267,14 +339,31 @@ auto control::is_out() -> bool const
            libusb_endpoint_direction::LIBUSB_ENDPOINT_OUT;
 }
 
-void control::fill(const std::vector<std::uint8_t>& data)
+void control::fill(const std::span<const std::uint8_t> data)
 {
     viu::_assert(xfer_ != nullptr);
     viu::_assert(is_in());
     viu::_assert(std::size(data) <= xfer_->length);
 
     std::memcpy(xfer_->buffer, data.data(), std::size(data));
-    xfer_->actual_length = std::size(data);
+    set_actual_length(std::size(data));
+}
+
+auto control::buffer() const -> std::span<std::uint8_t>
+{
+    viu::_assert(xfer_ != nullptr);
+    return {xfer_->buffer, static_cast<std::size_t>(xfer_->length)};
+}
+
+// The length comes from plugins, one claiming more than the buffer holds
+// is held to the buffer.
+void control::set_actual_length(const std::size_t length)
+{
+    viu::_assert(xfer_ != nullptr);
+
+    xfer_->actual_length = static_cast<int>(
+        std::min(length, static_cast<std::size_t>(xfer_->length))
+    );
 
     if (transfer::is_iso(xfer_)) {
         libusb_iso_packet_descriptor* ipd = xfer_->iso_packet_desc;
@@ -294,15 +383,7 @@ auto control::read(std::optional<std::uint32_t> size)
     viu::_assert(read_size <= xfer_->length);
 
     if (is_out()) {
-        xfer_->actual_length = read_size;
-
-        if (transfer::is_iso(xfer_)) {
-            libusb_iso_packet_descriptor* ipd = xfer_->iso_packet_desc;
-            for (auto i = 0; i < xfer_->num_iso_packets; ++i) {
-                ipd->actual_length = ipd->length;
-                ipd++;
-            }
-        }
+        set_actual_length(read_size);
     }
 
     return viu::format::unsafe::vectorize(xfer_->buffer, read_size);
@@ -7,6 +7,8 @@ export module viu.usb;
 import std;
 
 import viu.error;
+import viu.metrics;
+import viu.timer;
 import viu.transfer;
 import viu.types;
 
@@ -35,6 +37,33 @@ export struct device_id {
     std::uint32_t pid;
 };
 
+// A plugin device and the mock ABI revision of the library it came from.
+// A bare instance is taken to be built against this tree's header.
+export struct mock_plugin {
+    mock_plugin() = default;
+
+    mock_plugin(
+        viu_usb_mock_opaque* instance,
+        const std::uint32_t abi_version = abi::version
+    )
+        : instance{instance}, abi_version{abi_version}
+    {
+    }
+
+    viu_usb_mock_opaque* instance{};
+    std::uint32_t abi_version{abi::version};
+};
+
+// `claim` takes the device over for proxying: kernel drivers are detached
+// and every interface is claimed. `capture` only reads the descriptors on
+// the daemon wide libusb context and leaves the interfaces alone.
+export enum class open_mode : std::uint8_t { claim, capture };
+
+// `interval` holds the interrupt and iso IN completions of a mock back to
+// the service interval of their endpoint, as a host controller polling it
+// would. `none` passes them on as soon as the plugin completes them.
+export enum class pacing : std::uint8_t { interval, none };
+
 enum class error : std::uint8_t {
     no_string_descriptor,
     no_report_descriptor,
@@ -56,11 +85,9 @@ public:
 
     device() = default;
 
-    device(
-        std::uint32_t vid,
-        std::uint32_t pid,
-        viu_usb_mock_opaque* xfer_instance = nullptr
-    );
+    device(std::uint32_t vid, std::uint32_t pid, mock_plugin plugin = {});
+
+    device(std::uint32_t vid, std::uint32_t pid, open_mode mode);
 
     virtual ~device();
 
@@ -99,13 +126,23 @@ public:
     void submit_iso_transfer(const transfer::info& transfer_info);
 
     void on_transfer_completed(libusb_transfer* const xfer);
+    void on_transfers_completed(std::span<libusb_transfer* const> xfers);
+
+    // Plugins that take batches get the transfers submitted in between as
+    // one on_transfer_requests() call at the end. Both are called from the
+    // thread that submits the transfers.
+    void begin_transfer_batch() noexcept { batching_ = true; }
+    void end_transfer_batch();
 
     [[nodiscard]] auto submit_control_setup(
         const libusb_control_setup& setup,
         const std::vector<std::uint8_t>& data = {}
     ) -> std::expected<std::vector<std::uint8_t>, int>;
 
-    auto save_config(const std::filesystem::path& path) const -> viu::response;
+    auto save_config(
+        const std::filesystem::path& path,
+        usb::descriptor::file_format format = usb::descriptor::file_format::text
+    ) const -> viu::response;
     auto save_hid_report(const std::filesystem::path& path) const
         -> viu::response;
 
@@ -117,8 +154,12 @@ public:
     void cancel_transfers();
 
     auto libusb_ctx() /*const*/ -> context_pointer& { return libusb_context_; }
-    auto transfer_control_of(libusb_transfer* transfer)
-        -> usb::transfer::control;
+
+    [[nodiscard]] auto transfer_metrics() const noexcept
+        -> const metrics::transfer_metrics&
+    {
+        return transfer_metrics_;
+    }
 
 private:
     [[nodiscard]] virtual auto has_valid_handle() const noexcept -> bool;
@@ -130,6 +171,7 @@ private:
         std::uint8_t alt_setting
     ) -> int;
 
+    void open();
     [[nodiscard]] auto open_cloned_libusb_device(libusb_device* dev) -> int;
     [[nodiscard]] auto count_interfaces() const -> std::uint8_t;
     [[nodiscard]] auto release_interfaces();
@@ -186,16 +228,46 @@ private:
 
     auto make_opaque_transfer_control(const usb::transfer::control& control)
         -> viu_usb_mock_transfer_control_opaque;
+    void notify_mock_transfer_request(const usb::transfer::control& control);
+    void notify_mock_transfer_complete(const usb::transfer::control& control);
+    void notify_mock_transfer_completes(
+        std::span<libusb_transfer* const> xfers
+    );
+    void flush_transfer_requests();
+    void count_completion(const libusb_transfer* xfer);
+    void dispatch_completed(libusb_transfer* xfer);
+    void dispatch_completed(std::span<libusb_transfer* const> xfers);
+    [[nodiscard]] auto pace(libusb_transfer* xfer) -> bool;
+    void complete_paced(libusb_transfer* xfer);
+    void cancel_paced();
 
     context_pointer libusb_context_{};
     device_handle_pointer device_handle_{};
     usb::device_id device_id_{};
+    open_mode mode_{open_mode::claim};
     std::map<const std::uint8_t, const std::uint8_t> alt_settings_{};
+    std::atomic<std::size_t> active_config_{0};
     usb::transfer::pending_map pending_transfers_map_{};
+    metrics::transfer_metrics transfer_metrics_{};
+    bool batching_{false};
+    std::vector<viu_usb_mock_transfer> batched_requests_{};
+    pacing pacing_{pacing::none};
+    std::mutex pacing_mutex_{};
+    bool paced_cancelled_{false};
+    std::array<timer::clock::time_point, 16> next_service_{};
+    std::unordered_map<libusb_transfer*, timer::id> paced_{};
 
 protected:
+    using tree_pointer = std::shared_ptr<const usb::descriptor::tree>;
+
+    void use_mock(mock_plugin plugin, pacing pace = pacing::none);
+
     std::shared_ptr<viu_usb_mock_opaque> mock_iface_{};
-    usb::descriptor::tree descriptor_tree_{};
+    std::uint32_t mock_abi_version_{abi::version};
+    bool mock_routes_endpoints_{false};
+    tree_pointer descriptor_tree_{
+        std::make_shared<const usb::descriptor::tree>()
+    };
 };
 
 static_assert(!std::copyable<device>);
@@ -204,14 +276,28 @@ export class mock : public device {
 public:
     explicit mock(
         usb::descriptor::tree descriptor_tree,
-        viu_usb_mock_opaque* xfer_instance
+        mock_plugin plugin,
+        pacing pace = pacing::interval
+    )
+        : mock{
+              std::make_shared<const usb::descriptor::tree>(
+                  std::move(descriptor_tree)
+              ),
+              plugin,
+              pace
+          }
+    {
+    }
+
+    // Mocks of one configuration share its parsed descriptors.
+    explicit mock(
+        tree_pointer descriptor_tree,
+        mock_plugin plugin,
+        pacing pace = pacing::interval
     )
     {
         descriptor_tree_ = std::move(descriptor_tree);
-        mock_iface_ = std::shared_ptr<viu_usb_mock_opaque>{
-            xfer_instance,
-            mock_opaque_deleter{}
-        };
+        use_mock(plugin, pace);
     }
 
     [[nodiscard]] auto handle_events(
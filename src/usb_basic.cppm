@@ -3,6 +3,8 @@ export module viu.device.basic;
 import std;
 
 import viu.boost;
+import viu.metrics;
+import viu.trace;
 import viu.transfer;
 import viu.usb.descriptors;
 import viu.vhci;
@@ -18,6 +20,7 @@ public:
         std::vector<std::uint8_t> buffer{};
         std::size_t iso_descriptor_size{};
         std::int32_t error_count;
+        std::int32_t status{};
     };
 
     struct queue_reply_request {
@@ -32,6 +35,35 @@ public:
     void queue_reply_to_host(const queue_reply_request& req);
     void queue_data_for_host(const usb::transfer::pointer& transfer);
     void attach(std::uint32_t speed, std::uint8_t device_id);
+    void attach(
+        std::uint32_t speed,
+        std::uint8_t device_id,
+        vhci::port_manager::lease port_lease
+    );
+
+    [[nodiscard]] auto link_speed() const -> std::optional<::usb_device_speed>;
+
+    [[nodiscard]] auto urb_metrics() const noexcept
+        -> const metrics::urb_metrics&
+    {
+        return urb_metrics_;
+    }
+
+    [[nodiscard]] auto queue_depths() const -> metrics::queue_depths;
+
+    // CPU time consumed by the device threads so far.
+    [[nodiscard]] auto thread_cpu_time() -> std::chrono::nanoseconds;
+
+    [[nodiscard]] auto trace_source() const noexcept -> std::uint32_t
+    {
+        return trace_source_;
+    }
+
+    // Drops the usbip connection while the device engine and its threads
+    // keep running; reattach() connects it again on a fresh port.
+    auto detach() -> bool;
+    auto reattach() -> bool;
+    [[nodiscard]] auto is_attached() -> bool;
 
 private:
     virtual void execute_in_control_command(const usbip::command& cmd) = 0;
@@ -39,16 +71,31 @@ private:
     virtual void send_data_to_device(const usbip::command& cmd) = 0;
     virtual void read_data_from_device(const usbip::command& cmd) = 0;
 
+    // Around the commands that execute_command() takes off the queue in one
+    // go, lets the device hand their transfers on together.
+    virtual void begin_command_batch() {}
+    virtual void end_command_batch() {}
+
     void command_produce_thread();
     void reply_consume_thread();
     void transfer_thread(std::uint32_t ep);
     void command_execution_thread();
     auto read_command() -> usbip::command;
     void execute_command();
+    void execute_command(const usbip::command& cmd);
     void execute_control_command(const usbip::command& cmd);
     void execute_ep_command(const usbip::command& cmd);
     void unlink_command(const usbip::command& cmd);
     void send_data_to_host(std::uint32_t ep);
+    void attach_locked(
+        std::uint32_t speed,
+        std::uint8_t device_id,
+        vhci::port_manager::lease port_lease
+    );
+    auto wait_for_link(const std::stop_token& stoken)
+        -> std::optional<std::uint64_t>;
+    [[nodiscard]] auto current_link() -> std::optional<std::uint64_t>;
+    void link_lost(std::uint64_t link);
 
     std::vector<std::jthread> threads_{};
 
@@ -64,7 +111,30 @@ private:
     std::mutex unlinked_set_mutex_{};
     std::set<std::uint32_t> unlinked_seqnums_{};
 
+    struct attach_args {
+        std::uint32_t speed{};
+        std::uint8_t device_id{};
+    };
+
+    std::mutex attach_mutex_{};
+    std::optional<attach_args> attach_args_{};
+    bool needs_reconnect_{false};
+
+    // Guards the link state, the socket itself is guarded by socket_mutex_
+    // which readers and writers hold shared while they use it.
+    std::mutex link_mutex_{};
+    std::condition_variable_any link_cv_{};
+    bool linked_{false};
+    std::uint64_t link_{0};
+    std::shared_mutex socket_mutex_{};
+
+    metrics::urb_metrics urb_metrics_{};
+    metrics::queue_gauges queue_gauges_{};
+    const std::uint32_t trace_source_{trace::make_source()};
+
     vhci::driver vhci_driver_{};
 };
 
+static_assert(metrics::max_endpoints == usb::endpoint::max_count_in);
+
 } // namespace viu::device
@@ -1,9 +1,13 @@
 module;
 
 #include <cerrno>
+#include <pthread.h>
+#include <time.h>
 
 #include <libusb.h>
 
+#include "usdt.h"
+
 module viu.device.basic;
 
 import std;
@@ -11,11 +15,20 @@ import std;
 import viu.assert;
 import viu.boost;
 import viu.format;
+import viu.metrics;
+import viu.trace;
 import viu.transfer;
 import viu.usb.descriptors;
+import viu.vhci;
 
 using viu::device::basic;
 
+namespace {
+
+constexpr auto max_command_batch = std::size_t{64};
+
+} // namespace
+
 basic::~basic()
 {
     commands_queue_.close();
@@ -38,21 +51,222 @@ basic::~basic()
 
 void basic::attach(const std::uint32_t speed, const std::uint8_t device_id)
 {
-    vhci_driver_.attach(speed, device_id);
+    attach(speed, device_id, vhci::port_manager::lease{});
+}
+
+void basic::attach(
+    const std::uint32_t speed,
+    const std::uint8_t device_id,
+    vhci::port_manager::lease port_lease
+)
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{attach_mutex_};
+    attach_locked(speed, device_id, std::move(port_lease));
+}
+
+void basic::attach_locked(
+    const std::uint32_t speed,
+    const std::uint8_t device_id,
+    vhci::port_manager::lease port_lease
+)
+{
+    if (needs_reconnect_) {
+        [[maybe_unused]] const std::unique_lock<std::shared_mutex> _{
+            socket_mutex_
+        };
+        vhci_driver_.reconnect();
+        needs_reconnect_ = false;
+    }
+
+    vhci_driver_.attach(speed, device_id, std::move(port_lease));
+    attach_args_ = attach_args{.speed = speed, .device_id = device_id};
+
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{link_mutex_};
+        linked_ = true;
+    }
+
+    link_cv_.notify_all();
+}
+
+auto basic::detach() -> bool
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{attach_mutex_};
+
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{link_mutex_};
+        if (!linked_) {
+            return false;
+        }
+
+        linked_ = false;
+        ++link_;
+    }
+
+    vhci_driver_.detach();
+
+    // Wakes up the reader and writer, the socket is replaced on reattach
+    // while they wait for the link.
+    vhci_driver_.request_stop();
+    needs_reconnect_ = true;
+
+    return true;
+}
+
+auto basic::reattach() -> bool
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{attach_mutex_};
+
+    if (is_attached() || !attach_args_.has_value()) {
+        return false;
+    }
+
+    attach_locked(
+        attach_args_->speed,
+        attach_args_->device_id,
+        vhci::port_manager::lease{}
+    );
+
+    return true;
+}
+
+auto basic::is_attached() -> bool
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{link_mutex_};
+    return linked_;
+}
+
+auto basic::wait_for_link(const std::stop_token& stoken)
+    -> std::optional<std::uint64_t>
+{
+    auto lock = std::unique_lock<std::mutex>{link_mutex_};
+    if (!link_cv_.wait(lock, stoken, [this] { return linked_; })) {
+        return std::nullopt;
+    }
+
+    return link_;
+}
+
+auto basic::current_link() -> std::optional<std::uint64_t>
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{link_mutex_};
+    if (!linked_) {
+        return std::nullopt;
+    }
+
+    return link_;
+}
+
+// The connection broke without detach(), e.g. the host side detached.
+void basic::link_lost(const std::uint64_t link)
+{
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{link_mutex_};
+        if (!linked_ || link != link_) {
+            return;
+        }
+
+        linked_ = false;
+        ++link_;
+    }
+
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{attach_mutex_};
+    vhci_driver_.request_stop();
+    needs_reconnect_ = true;
+
+    // Runs on the reader thread, nothing up the stack handles the error.
+    try {
+        vhci_driver_.detach();
+    } catch (const std::system_error& e) {
+        std::println(std::cerr, "Failed to detach a lost link: {}", e.what());
+    }
+}
+
+auto basic::link_speed() const -> std::optional<::usb_device_speed>
+{
+    return vhci_driver_.link_speed();
+}
+
+auto basic::queue_depths() const -> metrics::queue_depths
+{
+    // A consumer may get to an item before its producer counted it.
+    const auto depth = [](const metrics::gauge& g) {
+        return static_cast<std::size_t>(std::max(g.value(), std::int64_t{0}));
+    };
+
+    auto depths = metrics::queue_depths{
+        .commands = depth(queue_gauges_.commands),
+        .replies = depth(queue_gauges_.replies)
+    };
+
+    for (auto ep = std::size_t{0}; ep < metrics::max_endpoints; ++ep) {
+        depths.in_commands[ep] = depth(queue_gauges_.in_commands[ep]);
+        depths.in_data[ep] = depth(queue_gauges_.in_data[ep]);
+    }
+
+    return depths;
+}
+
+auto basic::thread_cpu_time() -> std::chrono::nanoseconds
+{
+    auto total = std::chrono::nanoseconds{0};
+
+    for (auto& t : threads_) {
+        auto clock = clockid_t{};
+        auto ts = timespec{};
+        if (pthread_getcpuclockid(t.native_handle(), &clock) != 0 ||
+            clock_gettime(clock, &ts) != 0) {
+            continue;
+        }
+
+        total += std::chrono::seconds{ts.tv_sec} +
+                 std::chrono::nanoseconds{ts.tv_nsec};
+    }
+
+    return total;
 }
 
 void basic::command_produce_thread()
 {
     const auto func = [this](const std::stop_token& stoken) {
         while (!stoken.stop_requested()) {
+            const auto link = wait_for_link(stoken);
+            if (!link.has_value()) {
+                break;
+            }
+
             try {
-                commands_queue_.push(read_command());
+                auto cmd = [this] {
+                    [[maybe_unused]] const std::shared_lock<std::shared_mutex>
+                        _{socket_mutex_};
+                    return read_command();
+                }();
+
+                cmd.set_link(*link);
+                cmd.set_received(std::chrono::steady_clock::now());
+                if (cmd.is_submit() && cmd.ep() < metrics::max_endpoints) {
+                    urb_metrics_[cmd.ep()].submitted.add();
+                }
+
+                const auto seqnum = cmd.seqnum();
+                const auto ep = cmd.ep();
+                trace::record(trace::point::read, trace_source_, seqnum, ep);
+                VIU_PROBE5(
+                    command_parsed,
+                    seqnum,
+                    cmd.request(),
+                    ep,
+                    cmd.direction(),
+                    cmd.is_submit() ? cmd.transfer_buffer_size() : 0
+                );
+
+                commands_queue_.push(std::move(cmd));
+                queue_gauges_.commands.add();
+                trace::record(trace::point::queued, trace_source_, seqnum, ep);
             } catch (const boost::concurrent::sync_queue_is_closed&) {
                 break;
-            } catch (const boost::system::system_error& se) {
-                if (se.code() == boost::asio::error::eof) {
-                    break;
-                }
+            } catch (const boost::system::system_error&) {
+                link_lost(*link);
             }
         }
     };
@@ -66,7 +280,10 @@ void basic::reply_consume_thread()
         while (!stoken.stop_requested()) {
             try {
                 const auto rep = replies_queue_.pull();
+                queue_gauges_.replies.sub();
                 const auto cmd_seqnum = format::endian::from_big(rep.seqnum());
+                const auto ep = format::endian::from_big(rep.ep());
+                auto& urb = urb_metrics_[ep % metrics::max_endpoints];
 
                 {
                     [[maybe_unused]] const std::lock_guard<std::mutex> _{
@@ -75,6 +292,7 @@ void basic::reply_consume_thread()
 
                     if (unlinked_seqnums_.contains(cmd_seqnum)) {
                         unlinked_seqnums_.erase(cmd_seqnum);
+                        urb.dropped.add();
                         continue;
                     }
                 }
@@ -90,13 +308,37 @@ void basic::reply_consume_thread()
                 );
                 const auto total_size = sizeof(header) + std::size(payload);
 
+                [[maybe_unused]] const std::shared_lock<std::shared_mutex> _{
+                    socket_mutex_
+                };
+
+                if (current_link() != rep.link()) {
+                    urb.dropped.add();
+                    continue;
+                }
+
                 vhci_driver_.write(write_buffer, total_size);
+                VIU_PROBE3(reply_written, cmd_seqnum, ep, total_size);
+                trace::record(
+                    trace::point::written,
+                    trace_source_,
+                    cmd_seqnum,
+                    ep
+                );
+
+                if (format::endian::from_big(rep.request()) ==
+                    USBIP_RET_SUBMIT) {
+                    urb.completed.add();
+                    urb.reply_latency.record(
+                        std::chrono::steady_clock::now() - rep.received()
+                    );
+                }
             } catch (const boost::concurrent::sync_queue_is_closed&) {
                 break;
-            } catch (const boost::system::system_error& se) {
-                if (se.code() == boost::asio::error::eof) {
-                    break;
-                }
+            } catch (const boost::system::system_error&) {
+                // The connection is gone, the reader notices and parks
+                // until the device is attached again.
+                continue;
             }
         }
     };
@@ -191,6 +433,30 @@ void basic::execute_command()
         return;
     }
 
+    // Whatever queued up meanwhile is executed as one batch, up to a bound
+    // that keeps replies to the first commands from waiting too long.
+    begin_command_batch();
+
+    auto count = std::size_t{0};
+    do {
+        queue_gauges_.commands.sub();
+        execute_command(cmd);
+    } while (++count < max_command_batch &&
+             commands_queue_.try_pull(cmd) ==
+                 boost::concurrent::queue_op_status::success);
+
+    end_command_batch();
+}
+
+void basic::execute_command(const usbip::command& cmd)
+{
+    trace::record(
+        trace::point::executing,
+        trace_source_,
+        cmd.seqnum(),
+        cmd.ep()
+    );
+
     if (cmd.is_submit()) {
         if (cmd.ep() == 0) {
             execute_control_command(cmd);
@@ -229,6 +495,7 @@ void basic::execute_ep_command(const usbip::command& cmd)
         // device->host
         read_data_from_device(cmd);
         in_commands_[cmd.ep()].push(cmd);
+        queue_gauges_.in_commands[cmd.ep()].add();
     } else if (cmd.is_out()) {
         // host->device
         send_data_to_device(cmd);
@@ -242,6 +509,9 @@ void basic::unlink_command(const usbip::command& cmd)
     viu::_assert(cmd.ep() < usb::endpoint::max_count_in);
     viu::_assert(cmd.is_unlink());
 
+    urb_metrics_[cmd.ep()].unlinks.add();
+    VIU_PROBE2(unlink_received, cmd.seqnum(), cmd.unlink_seqnum());
+
     auto status = std::int32_t{};
     {
         [[maybe_unused]] const std::lock_guard<std::mutex> _{
@@ -272,12 +542,20 @@ void basic::queue_reply_to_host(const queue_reply_request& req)
     const auto error_count = req.error_count;
 
     auto replay = usbip::command{};
+    replay.set_link(cmd.link());
+    replay.set_received(cmd.received());
     replay.header().base = cmd.reply_header();
     switch (cmd.request()) {
         case USBIP_CMD_SUBMIT: {
             replay.header().ret_submit =
                 cmd.make_ret_submit_header(size, status, error_count);
 
+            auto& urb = urb_metrics_[cmd.ep() % metrics::max_endpoints];
+            if (status != 0) {
+                urb.errors.add();
+            }
+            (cmd.is_in() ? urb.bytes_in : urb.bytes_out).add(size);
+
             auto payload_size = cmd.is_out() ? 0 : size;
             if (cmd.is_iso()) {
                 payload_size += iso_descriptor_size;
@@ -300,14 +578,18 @@ void basic::queue_reply_to_host(const queue_reply_request& req)
     }
 
     replies_queue_.push(replay);
+    queue_gauges_.replies.add();
 }
 
 void basic::send_data_to_host(const std::uint32_t ep)
 {
     const auto& cmd = in_commands_[ep].pull();
+    queue_gauges_.in_commands[ep].sub();
     viu::_assert(cmd.transfer_buffer_size() > 0);
     auto& ep_in_data = in_data_[cmd.ep()];
     const auto& data = ep_in_data.pull();
+    queue_gauges_.in_data[cmd.ep()].sub();
+    trace::record(trace::point::paired, trace_source_, cmd.seqnum(), ep);
 
     const auto data_size = data.buffer.size() - data.iso_descriptor_size;
     viu::_assert(data_size <= cmd.transfer_buffer_size());
@@ -316,7 +598,7 @@ void basic::send_data_to_host(const std::uint32_t ep)
     req.cmd = cmd;
     req.data = data.buffer.data();
     req.size = data_size;
-    req.status = 0;
+    req.status = data.status;
     req.iso_descriptor_size = data.iso_descriptor_size;
     req.error_count = data.error_count;
     queue_reply_to_host(req);
@@ -359,7 +641,8 @@ void basic::queue_data_for_host(const usb::transfer::pointer& transfer)
 
     transfer_data d{
         .iso_descriptor_size = iso_desc_size,
-        .error_count = error_count
+        .error_count = error_count,
+        .status = usb::transfer::usbip_status(transfer)
     };
 
     const auto total_size = size + iso_desc_size;
@@ -368,4 +651,5 @@ void basic::queue_data_for_host(const usb::transfer::pointer& transfer)
     std::copy_n(std::begin(data), total_size, std::back_inserter(d.buffer));
 
     ep_in_data.push(d);
+    queue_gauges_.in_data[ep_index].add();
 }
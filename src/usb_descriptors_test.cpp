@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <libusb.h>
 
 import std;
 
@@ -60,4 +61,294 @@ TEST_F(usb_descriptors_test, tree)
     );
 }
 
+TEST_F(usb_descriptors_test, binary_image)
+{
+    namespace fs = std::filesystem;
+    const auto tmp_image_path = fs::path{
+        fs::temp_directory_path() /= "test_device_config-tmp.viud"
+    };
+
+    auto descriptor_tree_from_json = usb::descriptor::tree{};
+    descriptor_tree_from_json.load("test_device_config.json");
+    descriptor_tree_from_json.save(
+        tmp_image_path,
+        usb::descriptor::file_format::binary
+    );
+
+    auto magic = std::string(4, '\0');
+    auto image_file = std::ifstream{tmp_image_path, std::ios::binary};
+    image_file.read(magic.data(), std::ssize(magic));
+    EXPECT_EQ(magic, "VIUD");
+
+    auto descriptor_tree_from_image = usb::descriptor::tree{};
+    descriptor_tree_from_image.load(tmp_image_path);
+
+    const auto packed = [](const auto& descriptor) {
+        auto p = usb::descriptor::packer{};
+        p.pack(descriptor);
+        return std::move(p).data();
+    };
+
+    EXPECT_EQ(
+        packed(descriptor_tree_from_json.device_descriptor()),
+        packed(descriptor_tree_from_image.device_descriptor())
+    );
+
+    EXPECT_EQ(
+        packed(descriptor_tree_from_json.device_config()),
+        packed(descriptor_tree_from_image.device_config())
+    );
+
+    EXPECT_EQ(
+        packed(descriptor_tree_from_json.bos_descriptor()),
+        packed(descriptor_tree_from_image.bos_descriptor())
+    );
+
+    EXPECT_EQ(
+        descriptor_tree_from_json.string_descriptors(),
+        descriptor_tree_from_image.string_descriptors()
+    );
+
+    EXPECT_EQ(
+        descriptor_tree_from_json.report_descriptor(),
+        descriptor_tree_from_image.report_descriptor()
+    );
+}
+
+TEST_F(usb_descriptors_test, corrupt_binary_image)
+{
+    namespace fs = std::filesystem;
+    const auto tmp_image_path = fs::path{
+        fs::temp_directory_path() /= "test_device_config-corrupt.viud"
+    };
+
+    auto descriptor_tree = usb::descriptor::tree{};
+    descriptor_tree.load("test_device_config.json");
+    descriptor_tree.save(tmp_image_path, usb::descriptor::file_format::binary);
+
+    // Flip the last payload byte, the checksum no longer matches.
+    {
+        auto image_file = std::fstream{
+            tmp_image_path,
+            std::ios::binary | std::ios::in | std::ios::out
+        };
+        image_file.seekg(-1, std::ios::end);
+        const auto last = static_cast<char>(image_file.get());
+        image_file.seekp(-1, std::ios::end);
+        image_file.put(static_cast<char>(~last));
+    }
+
+    const auto before = descriptor_tree.device_descriptor().idVendor;
+    EXPECT_THROW(
+        descriptor_tree.load(tmp_image_path),
+        usb::descriptor::image_error
+    );
+    EXPECT_EQ(descriptor_tree.device_descriptor().idVendor, before);
+    EXPECT_FALSE(descriptor_tree.configs().empty());
+}
+
+TEST_F(usb_descriptors_test, json_schema_error)
+{
+    namespace fs = std::filesystem;
+    const auto tmp_json_path = fs::path{
+        fs::temp_directory_path() /= "test_device_config-invalid.json"
+    };
+
+    {
+        auto json_file = std::ofstream{tmp_json_path};
+        json_file << R"({"aofDevices": [{"Device Descriptor": )"
+                  << R"({"bLength": 18, "idVendor": "0x1ffff"}}]})";
+    }
+
+    auto descriptor_tree = usb::descriptor::tree{};
+    auto what = std::string{};
+    try {
+        descriptor_tree.load(tmp_json_path);
+    } catch (const std::exception& e) {
+        what = e.what();
+    }
+
+    EXPECT_TRUE(what.contains("/aofDevices/0/Device Descriptor/idVendor"));
+}
+
+namespace {
+
+constexpr auto two_config_json = std::string_view{R"({
+  "aofDevices": [{
+    "Device Descriptor": {
+      "bLength": 18, "bDescriptorType": 1, "bcdUSB": "0x200",
+      "bMaxPacketSize0": 64, "idVendor": "0x1234", "idProduct": "0x5678",
+      "bNumConfigurations": 2,
+      "aofConfigurations": [
+        {"Configuration Descriptor": {
+          "bLength": 9, "bDescriptorType": 2, "wTotalLength": 25,
+          "bNumInterfaces": 1, "bConfigurationValue": 1,
+          "bmAttributes": "0xc0", "MaxPower": 50,
+          "aofAltsettings": [{"aofInterfaces": [{"Interface Descriptor": {
+            "bLength": 9, "bDescriptorType": 4, "bNumEndpoints": 1,
+            "aofEndpoints": [{"Endpoint Descriptor": {
+              "bLength": 7, "bDescriptorType": 5, "bEndpointAddress": "0x81",
+              "bmAttributes": 3, "wMaxPacketSize": 8, "bInterval": 10}}]
+          }}]}]
+        }},
+        {"Configuration Descriptor": {
+          "bLength": 9, "bDescriptorType": 2, "wTotalLength": 25,
+          "bNumInterfaces": 1, "bConfigurationValue": 2,
+          "bmAttributes": "0x80", "MaxPower": 250,
+          "aofAltsettings": [{"aofInterfaces": [{"Interface Descriptor": {
+            "bLength": 9, "bDescriptorType": 4, "bNumEndpoints": 1,
+            "aofEndpoints": [{"Endpoint Descriptor": {
+              "bLength": 7, "bDescriptorType": 5, "bEndpointAddress": "0x81",
+              "bmAttributes": 2, "wMaxPacketSize": 512, "bInterval": 0}}]
+          }}]}]
+        }}
+      ]
+    },
+    "aofStringDescriptors": [],
+    "daReportDescriptor": [],
+    "BOS Descriptor": {"aofDeviceCaps": []}
+  }]
+})"};
+
+void expect_two_configs(const usb::descriptor::tree& t)
+{
+    ASSERT_EQ(std::size(t.configs()), 2U);
+
+    EXPECT_EQ(t.config_index(1), std::size_t{0});
+    EXPECT_EQ(t.config_index(2), std::size_t{1});
+    EXPECT_FALSE(t.config_index(3).has_value());
+
+    EXPECT_EQ(t.ep_attributes(0, 0x81), LIBUSB_TRANSFER_TYPE_INTERRUPT);
+    EXPECT_EQ(t.ep_attributes(1, 0x81), LIBUSB_TRANSFER_TYPE_BULK);
+    EXPECT_FALSE(t.ep_attributes(0, 0x01).has_value());
+    EXPECT_FALSE(t.ep_attributes(2, 0x81).has_value());
+    EXPECT_EQ(t.ep_interval(0, 0x81), 10);
+    EXPECT_EQ(t.ep_interval(1, 0x81), 0);
+
+    EXPECT_TRUE(t.device_config(0).is_self_powered());
+    EXPECT_FALSE(t.device_config(1).is_self_powered());
+}
+
+} // namespace
+
+TEST_F(usb_descriptors_test, multiple_configurations)
+{
+    namespace fs = std::filesystem;
+    const auto tmp = fs::temp_directory_path();
+    const auto json_path = fs::path{tmp / "test_two_configs-tmp.json"};
+    const auto text_path = fs::path{tmp / "test_two_configs-tmp.config"};
+    const auto image_path = fs::path{tmp / "test_two_configs-tmp.viud"};
+
+    {
+        auto json_file = std::ofstream{json_path};
+        json_file << two_config_json;
+    }
+
+    auto from_json = usb::descriptor::tree{};
+    from_json.load(json_path);
+    expect_two_configs(from_json);
+
+    from_json.save(text_path);
+    auto from_text = usb::descriptor::tree{};
+    from_text.load(text_path);
+    expect_two_configs(from_text);
+
+    from_json.save(image_path, usb::descriptor::file_format::binary);
+    auto from_image = usb::descriptor::tree{};
+    from_image.load(image_path);
+    expect_two_configs(from_image);
+}
+
+TEST_F(usb_descriptors_test, layout_size)
+{
+    using usb::descriptor::layout;
+
+    static_assert(layout<libusb_device_descriptor>::size == 18);
+    static_assert(layout<libusb_config_descriptor>::size == 9);
+    static_assert(layout<libusb_interface_descriptor>::size == 9);
+    static_assert(layout<libusb_bos_descriptor>::size == 5);
+}
+
+TEST_F(usb_descriptors_test, layout_pack_device_descriptor)
+{
+    using usb::descriptor::layout;
+
+    static constexpr auto device_descriptor = libusb_device_descriptor{
+        .bLength = 0x12,
+        .bDescriptorType = 0x01,
+        .bcdUSB = 0x0210,
+        .bDeviceClass = 0xef,
+        .bDeviceSubClass = 0x02,
+        .bDeviceProtocol = 0x01,
+        .bMaxPacketSize0 = 0x40,
+        .idVendor = 0x1234,
+        .idProduct = 0xabcd,
+        .bcdDevice = 0x0102,
+        .iManufacturer = 0x01,
+        .iProduct = 0x02,
+        .iSerialNumber = 0x03,
+        .bNumConfigurations = 0x01
+    };
+
+    constexpr auto expected = std::array<std::uint8_t, 18>{
+        0x12, 0x01, 0x10, 0x02, 0xef, 0x02, 0x01, 0x40, 0x34,
+        0x12, 0xcd, 0xab, 0x02, 0x01, 0x01, 0x02, 0x03, 0x01
+    };
+
+    constexpr auto compile_time =
+        layout<libusb_device_descriptor>::pack(device_descriptor);
+    static_assert(
+        std::ranges::equal(compile_time, expected, {}, [](auto b) {
+            return std::to_integer<std::uint8_t>(b);
+        })
+    );
+
+    const auto run_time =
+        layout<libusb_device_descriptor>::pack(device_descriptor);
+    EXPECT_EQ(run_time, compile_time);
+
+    auto p = usb::descriptor::packer{};
+    p.pack(device_descriptor);
+    EXPECT_TRUE(std::ranges::equal(p.data(), run_time));
+}
+
+TEST_F(usb_descriptors_test, layout_pack_config_descriptor)
+{
+    using usb::descriptor::layout;
+
+    const auto config_descriptor = libusb_config_descriptor{
+        .bLength = 0x09,
+        .bDescriptorType = 0x02,
+        .wTotalLength = 0x0109,
+        .bNumInterfaces = 0x00,
+        .bConfigurationValue = 0x01,
+        .iConfiguration = 0x00,
+        .bmAttributes = 0xa0,
+        .MaxPower = 0x32,
+        .interface = nullptr,
+        .extra = nullptr,
+        .extra_length = 0
+    };
+
+    const auto expected = usb::descriptor::vector_type{
+        std::byte{0x09},
+        std::byte{0x02},
+        std::byte{0x09},
+        std::byte{0x01},
+        std::byte{0x00},
+        std::byte{0x01},
+        std::byte{0x00},
+        std::byte{0xa0},
+        std::byte{0x32}
+    };
+
+    const auto bytes =
+        layout<libusb_config_descriptor>::pack(config_descriptor);
+    EXPECT_TRUE(std::ranges::equal(bytes, expected));
+
+    auto p = usb::descriptor::packer{};
+    p.pack(config_descriptor);
+    EXPECT_EQ(p.data(), expected);
+}
+
 } // namespace viu::test
@@ -8,8 +8,10 @@ import std;
 
 import viu.device.basic;
 import viu.error;
+import viu.metrics;
 import viu.transfer;
 import viu.usb;
+import viu.usb.descriptors;
 import viu.vhci;
 
 namespace viu::device {
@@ -18,6 +20,10 @@ export class proxy : private basic {
 public:
     proxy() = default;
     explicit proxy(const std::shared_ptr<usb::device>& device);
+    proxy(
+        const std::shared_ptr<usb::device>& device,
+        vhci::port_manager::lease port_lease
+    );
     ~proxy() override;
 
     proxy(const proxy&) = delete;
@@ -25,10 +31,33 @@ public:
     auto operator=(const proxy&) -> proxy& = delete;
     auto operator=(proxy&&) -> proxy& = delete;
 
-    auto save_config(const std::filesystem::path& path) const -> viu::response;
+    auto save_config(
+        const std::filesystem::path& path,
+        usb::descriptor::file_format format = usb::descriptor::file_format::text
+    ) const -> viu::response;
     auto save_hid_report(const std::filesystem::path& path) const
         -> viu::response;
 
+    // Waits until the host selected a configuration, i.e. until the device
+    // finished enumerating.
+    [[nodiscard]] auto wait_configured(std::chrono::milliseconds timeout)
+        -> bool;
+
+    [[nodiscard]] auto transfer_metrics() const noexcept
+        -> const metrics::transfer_metrics&
+    {
+        return usb_device_->transfer_metrics();
+    }
+
+    using basic::detach;
+    using basic::is_attached;
+    using basic::link_speed;
+    using basic::queue_depths;
+    using basic::reattach;
+    using basic::thread_cpu_time;
+    using basic::trace_source;
+    using basic::urb_metrics;
+
 private:
     using transfer_tuple = std::tuple<
         usb::transfer::pending_map::callback_type,
@@ -50,6 +79,8 @@ private:
     auto prepare_buffer(const usbip::command& cmd);
     auto prepare_iso_descriptors_buffer(const usbip::command& cmd);
     auto prepare_transfer(const usbip::command& cmd) -> usb::transfer::info;
+    auto traced(const usbip::command& cmd, usb::transfer::info xfer_info)
+        -> usb::transfer::info;
     void submit_transfer(const usbip::command& cmd);
     void submit_iso_transfer(const usbip::command& cmd);
     void submit_bulk_transfer(const usbip::command& cmd);
@@ -65,8 +96,13 @@ private:
     void execute_std_out_interface_control_command(const usbip::command& cmd);
     void send_data_to_device(const usbip::command& cmd) override;
     void read_data_from_device(const usbip::command& cmd) override;
+    void begin_command_batch() override;
+    void end_command_batch() override;
 
     std::shared_ptr<usb::device> usb_device_{};
+    std::mutex configured_mutex_{};
+    std::condition_variable configured_cv_{};
+    bool configured_{false};
     std::jthread device_thread_{};
 };
 
@@ -28,16 +28,30 @@ import std;
 import viu.assert;
 import viu.error;
 import viu.format;
+import viu.trace;
 import viu.transfer;
 import viu.usb.descriptors;
 import viu.vhci;
 
 using viu::device::proxy;
 
-proxy::proxy(const std::shared_ptr<usb::device>& device) : usb_device_{device}
+proxy::proxy(const std::shared_ptr<usb::device>& device)
+    : proxy{device, vhci::port_manager::lease{}}
+{
+}
+
+proxy::proxy(
+    const std::shared_ptr<usb::device>& device,
+    vhci::port_manager::lease port_lease
+)
+    : usb_device_{device}
 {
     start();
 
+    // Attached here rather than on the device thread, a full port table or
+    // a failed attach is reported to whoever creates the device.
+    attach(usb_device_->speed(), 1, std::move(port_lease));
+
     device_thread_ = std::jthread{[this](const std::stop_token& stoken) {
         std::atomic<bool> stop{false};
         auto completed = int{0};
@@ -52,7 +66,6 @@ proxy::proxy(const std::shared_ptr<usb::device>& device) : usb_device_{device}
             }
         };
 
-        attach(usb_device_->speed(), 1);
         auto event_handler_thread = std::thread{usb_event_handler};
 
         while (!stoken.stop_requested()) {
@@ -77,11 +90,13 @@ proxy::~proxy()
     device_thread_.join();
 }
 
-auto proxy::save_config(const std::filesystem::path& path) const
-    -> viu::response
+auto proxy::save_config(
+    const std::filesystem::path& path,
+    usb::descriptor::file_format format
+) const -> viu::response
 {
     viu::_assert(usb_device_ != nullptr);
-    return usb_device_->save_config(path);
+    return usb_device_->save_config(path, format);
 }
 
 auto proxy::save_hid_report(const std::filesystem::path& path) const
@@ -98,6 +113,16 @@ void proxy::read_data_from_device(const usbip::command& cmd)
     submit_transfer(cmd);
 }
 
+void proxy::begin_command_batch()
+{
+    usb_device_->begin_transfer_batch();
+}
+
+void proxy::end_command_batch()
+{
+    usb_device_->end_transfer_batch();
+}
+
 void proxy::descriptor(const usbip::command& cmd)
 {
     const auto control_setup = cmd.control_setup();
@@ -206,8 +231,10 @@ void proxy::on_in_iso_transfer_complete(const usb::transfer::pointer& transfer)
 void proxy::on_in_transfer_complete(const usb::transfer::pointer& transfer)
 {
     viu::_assert(transfer != nullptr);
-    viu::_assert(transfer->status == LIBUSB_TRANSFER_COMPLETED);
-    viu::_assert(transfer->actual_length > 0);
+    viu::_assert(
+        transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+        transfer->actual_length > 0
+    );
 
     queue_data_for_host(transfer);
 }
@@ -218,12 +245,16 @@ void proxy::on_out_transfer_complete(
 )
 {
     viu::_assert(transfer != nullptr);
-    viu::_assert(transfer->actual_length == transfer->length);
+    viu::_assert(
+        transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+        transfer->actual_length == transfer->length
+    );
 
     viu::device::basic::queue_reply_request req{};
     req.cmd = cmd;
     req.data = nullptr;
     req.size = transfer->actual_length;
+    req.status = usb::transfer::usbip_status(transfer);
     queue_reply_to_host(req);
 }
 
@@ -300,7 +331,7 @@ auto proxy::prepare_transfer(const usbip::command& cmd) -> usb::transfer::info
             .descriptors = prepare_iso_descriptors_buffer(cmd)
         };
 
-        return xfer_info;
+        return traced(cmd, std::move(xfer_info));
     }
 
     const cb_t in_cb = [this](const xfr_ptr& xfr) {
@@ -311,15 +342,43 @@ auto proxy::prepare_transfer(const usbip::command& cmd) -> usb::transfer::info
         on_out_transfer_complete(cmd, xfr);
     };
 
-    return usb::transfer::info{
-        .ep_address = cmd.ep_address(),
-        .buffer = buffer,
-        .callback = cmd.is_in() ? in_cb : out_cb
-    };
+    return traced(
+        cmd,
+        usb::transfer::info{
+            .ep_address = cmd.ep_address(),
+            .buffer = buffer,
+            .callback = cmd.is_in() ? in_cb : out_cb
+        }
+    );
+}
+
+auto proxy::traced(const usbip::command& cmd, usb::transfer::info xfer_info)
+    -> usb::transfer::info
+{
+    if constexpr (trace::compiled_in) {
+        xfer_info.callback = [this,
+                              seqnum = cmd.seqnum(),
+                              ep = cmd.ep(),
+                              callback = std::move(xfer_info.callback)](
+                                 const usb::transfer::pointer& xfr
+                             ) {
+            trace::record(trace::point::completed, trace_source(), seqnum, ep);
+            callback(xfr);
+        };
+    }
+
+    return xfer_info;
 }
 
 void proxy::submit_transfer(const usbip::command& cmd)
 {
+    trace::record(
+        trace::point::submitted,
+        trace_source(),
+        cmd.seqnum(),
+        cmd.ep()
+    );
+
     const auto xfer_type = usb_device_->ep_transfer_type(cmd.ep_address());
     viu::_assert(xfer_type.has_value());
 
@@ -451,6 +510,16 @@ void proxy::set_configuration(const usbip::command& cmd)
 {
     auto result = usb_device_->set_configuration(cmd.config_index());
     viu::_assert(result == LIBUSB_SUCCESS);
+
+    if (cmd.config_index() != 0) {
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{
+                configured_mutex_
+            };
+            configured_ = true;
+        }
+        configured_cv_.notify_all();
+    }
     viu::device::basic::queue_reply_request req{};
     req.cmd = cmd;
     req.data = nullptr;
@@ -458,6 +527,14 @@ void proxy::set_configuration(const usbip::command& cmd)
     queue_reply_to_host(req);
 }
 
+auto proxy::wait_configured(const std::chrono::milliseconds timeout) -> bool
+{
+    auto lock = std::unique_lock<std::mutex>{configured_mutex_};
+    return configured_cv_.wait_for(lock, timeout, [this] {
+        return configured_;
+    });
+}
+
 void proxy::interface(const usbip::command& cmd)
 {
     const auto control_setup = cmd.control_setup();
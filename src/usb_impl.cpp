@@ -1,6 +1,7 @@
 module;
 
 #include "libusb.h"
+#include "usdt.h"
 
 #include <cassert>
 
@@ -12,6 +13,8 @@ import viu.assert;
 import viu.error;
 import viu.format;
 import viu.io;
+import viu.metrics;
+import viu.timer;
 import viu.transfer;
 import viu.usb.descriptors;
 
@@ -63,20 +66,112 @@ auto device::make_context()
     );
 }
 
-device::device(
-    std::uint32_t vid,
-    std::uint32_t pid,
-    viu_usb_mock_opaque* xfer_instance
+namespace {
+
+// Captures share one context for the life of the daemon, libusb_init()
+// costs more than reading all descriptors of a device.
+auto shared_context() -> std::tuple<device::context_pointer, int>
+{
+    static auto libusb_result = int{LIBUSB_ERROR_OTHER};
+    static const auto context = [] {
+        libusb_context* context{};
+        libusb_result = libusb_init(&context);
+        return std::unique_ptr<libusb_context, decltype(&libusb_exit)>{
+            context,
+            &libusb_exit
+        };
+    }();
+
+    return std::make_tuple(
+        device::context_pointer{context.get(), [](libusb_context*) {}},
+        libusb_result
+    );
+}
+
+extern "C" {
+
+std::uint64_t host_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               viu::timer::clock::now().time_since_epoch()
+    )
+        .count();
+}
+
+viu_usb_mock_timer host_schedule(
+    std::uint64_t deadline_ns,
+    void (*cb)(void* ctx),
+    void* ctx
 )
+{
+    viu::_assert(cb != nullptr);
+
+    const auto deadline = viu::timer::clock::time_point{
+        std::chrono::duration_cast<viu::timer::clock::duration>(
+            std::chrono::nanoseconds{deadline_ns}
+        )
+    };
+
+    return viu::timer::shared().schedule(deadline, [cb, ctx] { cb(ctx); });
+}
+
+bool host_cancel(viu_usb_mock_timer timer)
+{
+    return viu::timer::shared().cancel(timer);
+}
+}
+
+constexpr auto host_services = viu_usb_mock_host{
+    .version = viu::usb::abi::version,
+    .now_ns = &host_now_ns,
+    .schedule = &host_schedule,
+    .cancel = &host_cancel,
+};
+
+} // namespace
+
+device::device(std::uint32_t vid, std::uint32_t pid, mock_plugin plugin)
     : device_id_{.vid = vid, .pid = pid}
 {
-    if (xfer_instance != nullptr) {
-        mock_iface_ = std::shared_ptr<viu_usb_mock_opaque>{
-            xfer_instance,
-            mock_opaque_deleter{}
-        };
+    if (plugin.instance != nullptr) {
+        use_mock(plugin);
     }
-    auto [context, libusb_result] = make_context();
+
+    open();
+}
+
+void device::use_mock(const mock_plugin plugin, const pacing pace)
+{
+    mock_iface_ = std::shared_ptr<viu_usb_mock_opaque>{
+        plugin.instance,
+        mock_opaque_deleter{}
+    };
+    mock_abi_version_ = plugin.abi_version;
+    pacing_ = pace;
+
+    mock_routes_endpoints_ =
+        plugin.instance != nullptr && mock_abi_version_ >= 4 &&
+        std::ranges::any_of(plugin.instance->on_endpoint_request, [](auto f) {
+            return f != nullptr;
+        });
+
+    if (plugin.instance != nullptr && mock_abi_version_ >= 5 &&
+        plugin.instance->on_host != nullptr) {
+        plugin.instance->on_host(plugin.instance, &host_services);
+    }
+}
+
+device::device(std::uint32_t vid, std::uint32_t pid, open_mode mode)
+    : device_id_{.vid = vid, .pid = pid}, mode_{mode}
+{
+    open();
+}
+
+void device::open()
+{
+    auto [context, libusb_result] = mode_ == open_mode::capture
+                                        ? shared_context()
+                                        : make_context();
 
     if (libusb_result == LIBUSB_SUCCESS) {
         libusb_context_ = std::move(context);
@@ -122,9 +217,17 @@ device::device(
 
                 libusb_result = open_cloned_libusb_device(usb_device);
                 if (libusb_result == LIBUSB_SUCCESS) {
-                    descriptor_tree_ = viu::usb::descriptor::tree{
+                    auto configs = std::vector<
+                        viu::usb::descriptor::config_descriptor_pointer>{};
+                    for (auto i = std::uint8_t{0};
+                         i < descriptor.bNumConfigurations;
+                         ++i) {
+                        configs.push_back(config_descriptor(i));
+                    }
+
+                    auto tree = viu::usb::descriptor::tree{
                         descriptor,
-                        config_descriptor(),
+                        configs,
                         string_descriptors(),
                         bos_descriptor().value_or(
                             viu::usb::descriptor::bos_descriptor_pointer{
@@ -136,6 +239,14 @@ device::device(
                             std::vector<std::uint8_t>{}
                         )
                     };
+
+                    descriptor_tree_ = std::make_shared<
+                        const viu::usb::descriptor::tree>(std::move(tree));
+
+                    const auto active = descriptor_tree_->config_index(
+                        config_descriptor()->bConfigurationValue
+                    );
+                    active_config_ = active.value_or(0);
                     break;
                 }
             }
@@ -172,7 +283,11 @@ auto device::release_interfaces()
     return libusb_result;
 }
 
-device::~device() { close(); }
+device::~device()
+{
+    cancel_paced();
+    close();
+}
 
 auto device::claim_interfaces()
 {
@@ -190,7 +305,7 @@ auto device::claim_interfaces()
 
 void device::close()
 {
-    if (has_valid_handle()) {
+    if (has_valid_handle() && mode_ == open_mode::claim) {
         const auto result = release_interfaces();
         if (result != LIBUSB_SUCCESS) {
             std::println(std::cerr, "Failed to release interfaces: {}", result);
@@ -200,7 +315,7 @@ void device::close()
 
 auto device::device_descriptor() const noexcept -> libusb_device_descriptor
 {
-    return descriptor_tree_.device_descriptor();
+    return descriptor_tree_->device_descriptor();
 }
 
 auto device::config_descriptor(std::optional<std::uint8_t> index) const
@@ -247,53 +362,38 @@ auto device::count_interfaces() const -> std::uint8_t
 auto device::ep_transfer_type(std::uint8_t ep_address) const
     -> std::expected<libusb_endpoint_transfer_type, error>
 {
-    constexpr auto flatten_from = [](auto op) {
-        return std::views::transform(op) | std::views::join;
-    };
-
-    auto interfaces = std::vector<usb::descriptor::usb_interface>{};
-    descriptor_tree_.device_config().read(
-        usb::descriptor::key::interface,
-        interfaces
+    const auto attributes = descriptor_tree_->ep_attributes(
+        active_config_.load(std::memory_order_relaxed),
+        ep_address
     );
 
-    const auto vector_of_altsettings = [](const auto& interface) {
-        auto v = std::vector<usb::descriptor::interface>{};
-        interface.read(usb::descriptor::key::altsetting, v);
-        return v;
-    };
-
-    const auto vector_of_endpoints = [](const auto& altsetting) {
-        auto v = std::vector<usb::descriptor::endpoint>{};
-        altsetting.read(usb::descriptor::key::ep, v);
-        return v;
-    };
-
-    auto endpoints = interfaces | flatten_from(vector_of_altsettings) |
-                     flatten_from(vector_of_endpoints) |
-                     std::views::filter([ep_address](const auto& ep) {
-                         return ep.address() == ep_address;
-                     });
-
-    for (const auto& ep : endpoints) {
-        // TODO: return the type for the current altsetting
-        const auto xfer_type = ep.attributes() & ep_transfer_type_mask;
-        return static_cast<libusb_endpoint_transfer_type>(xfer_type);
+    if (!attributes.has_value()) {
+        return std::unexpected(error::ep_get_transfer_type_failed);
     }
 
-    return std::unexpected(error::ep_get_transfer_type_failed);
+    const auto xfer_type = *attributes & ep_transfer_type_mask;
+    return static_cast<libusb_endpoint_transfer_type>(xfer_type);
 }
 
 auto device::pack_device_descriptor() const -> vector_type
 {
     auto desc_packer = usb::descriptor::packer{};
-    desc_packer.pack(descriptor_tree_.device_descriptor());
-    desc_packer.pack(descriptor_tree_.device_config());
-    return desc_packer.data();
+    desc_packer.pack(descriptor_tree_->device_descriptor());
+    desc_packer.pack(descriptor_tree_->device_config());
+    return std::move(desc_packer).data();
 }
 
 auto device::set_configuration(std::uint8_t index) -> int
 {
+    // The host selects by bConfigurationValue, 0 leaves the device
+    // unconfigured and keeps the last endpoint table.
+    const auto config_index = descriptor_tree_->config_index(index);
+    if (config_index.has_value()) {
+        active_config_.store(*config_index, std::memory_order_relaxed);
+    }
+
+    flush_transfer_requests();
+
     auto result = int{LIBUSB_ERROR_NOT_SUPPORTED};
     if (mock_iface_ != nullptr &&
         mock_iface_->on_set_configuration != nullptr) {
@@ -332,12 +432,18 @@ auto device::pack_config_descriptor(std::uint8_t index) const -> vector_type
 {
     viu::_assert(has_valid_handle());
     viu::_assert(
-        index < descriptor_tree_.device_descriptor().bNumConfigurations
+        index < descriptor_tree_->device_descriptor().bNumConfigurations
     );
 
+    // Configs saved before multi-configuration support may hold fewer
+    // configurations than the device descriptor announces.
+    if (index >= std::size(descriptor_tree_->configs())) {
+        return {};
+    }
+
     auto desc_packer = usb::descriptor::packer{};
-    desc_packer.pack(descriptor_tree_.device_config());
-    return desc_packer.data();
+    desc_packer.pack(descriptor_tree_->device_config(index));
+    return std::move(desc_packer).data();
 }
 
 auto device::bos_descriptor() const
@@ -369,9 +475,9 @@ auto device::pack_bos_descriptor() const -> vector_type
     viu::_assert(has_valid_handle());
 
     auto desc_packer = usb::descriptor::packer{};
-    desc_packer.pack(descriptor_tree_.bos_descriptor());
+    desc_packer.pack(descriptor_tree_->bos_descriptor());
 
-    return desc_packer.data();
+    return std::move(desc_packer).data();
 }
 
 template <viu::usb::string_unit T>
@@ -473,7 +579,7 @@ auto device::pack_string_descriptor(
 {
     viu::_assert(has_valid_handle());
 
-    const auto string_descriptors = descriptor_tree_.string_descriptors();
+    const auto& string_descriptors = descriptor_tree_->string_descriptors();
     const auto desc_vector = string_descriptors.find(language_id);
     if (desc_vector == std::end(string_descriptors)) {
         return {};
@@ -496,9 +602,35 @@ auto device::report_descriptor() const
     -> std::expected<std::vector<std::uint8_t>, error>
 {
     viu::_assert(has_valid_handle());
+
+    // Only HID interfaces have one. Asking anything else would claim it
+    // from its kernel driver for nothing.
+    const auto config = config_descriptor();
+    if (config->bNumInterfaces == 0 ||
+        config->interface[0].num_altsetting == 0 ||
+        config->interface[0].altsetting[0].bInterfaceClass !=
+            LIBUSB_CLASS_HID) {
+        return std::unexpected{error::no_report_descriptor};
+    }
+
     constexpr auto max_len = 4096;
     auto hid_report_descriptor = std::vector<std::uint8_t>(max_len);
 
+    // The request goes to an interface, which has to be ours for the
+    // duration. Releasing it hands it back to its kernel driver.
+    const auto claim_for_capture = [this] {
+        if (mode_ != open_mode::capture) {
+            return false;
+        }
+
+        std::ignore =
+            libusb_set_auto_detach_kernel_driver(underlying_handle(), 1);
+        return libusb_claim_interface(underlying_handle(), 0) ==
+               LIBUSB_SUCCESS;
+    };
+
+    const auto claimed = claim_for_capture();
+
     const auto ep_direction = std::uint8_t{LIBUSB_ENDPOINT_IN};
     const auto request_type = std::uint8_t{LIBUSB_REQUEST_TYPE_STANDARD};
     const auto recipient = std::uint8_t{LIBUSB_RECIPIENT_INTERFACE};
@@ -513,6 +645,10 @@ auto device::report_descriptor() const
         0
     );
 
+    if (claimed) {
+        std::ignore = libusb_release_interface(underlying_handle(), 0);
+    }
+
     if (descriptor_size < 0) {
         return std::unexpected{error::no_report_descriptor};
     }
@@ -525,21 +661,26 @@ auto device::report_descriptor() const
 
 auto device::pack_report_descriptor() const -> vector_type
 {
-    auto hid_report_descriptor = descriptor_tree_.report_descriptor();
     auto report = vector_type{};
-    usb::descriptor::packer::to_packing_type(hid_report_descriptor, report);
+    usb::descriptor::packer::to_packing_type(
+        descriptor_tree_->report_descriptor(),
+        report
+    );
     return report;
 }
 
 auto device::is_self_powered() const -> bool
 {
-    return descriptor_tree_.device_config().is_self_powered();
+    const auto active = active_config_.load(std::memory_order_relaxed);
+    return descriptor_tree_->device_config(active).is_self_powered();
 }
 
-auto device::save_config(const std::filesystem::path& path) const
-    -> viu::response
+auto device::save_config(
+    const std::filesystem::path& path,
+    usb::descriptor::file_format format
+) const -> viu::response
 {
-    descriptor_tree_.save(path);
+    descriptor_tree_->save(path, format);
 
     return viu::response::success(
         std::format("Device configuration saved to {}", path.string())
@@ -549,8 +690,8 @@ auto device::save_config(const std::filesystem::path& path) const
 auto device::save_hid_report(const std::filesystem::path& path) const
     -> viu::response
 {
-
-    if (!viu::io::bin::file::save(path, descriptor_tree_.report_descriptor())) {
+    const auto& report = descriptor_tree_->report_descriptor();
+    if (!viu::io::bin::file::save(path, report)) {
         return viu::response::failure(
             std::format("Failed to save HID report to {}", path.string()),
             viu::make_error(error::io_failed, "Invalid argument").error()
@@ -596,6 +737,11 @@ auto device::open_cloned_libusb_device(libusb_device* dev) -> int
 {
     auto [handle, libusb_result] = make_handle(dev);
 
+    if (libusb_result == LIBUSB_SUCCESS && mode_ == open_mode::capture) {
+        device_handle_ = std::move(handle);
+        return libusb_result;
+    }
+
     if (libusb_result == LIBUSB_SUCCESS) {
         device_handle_ = std::move(handle);
         libusb_result =
@@ -611,8 +757,9 @@ auto device::open_cloned_libusb_device(libusb_device* dev) -> int
 auto device::on_set_interface(std::uint8_t interface, std::uint8_t alt_setting)
     -> int
 {
-    auto result = int{LIBUSB_ERROR_NOT_SUPPORTED};
+    flush_transfer_requests();
 
+    auto result = int{LIBUSB_ERROR_NOT_SUPPORTED};
     if (mock_iface_ != nullptr && mock_iface_->on_set_interface != nullptr) {
         result = mock_iface_->on_set_interface(
             mock_iface_.get(),
@@ -643,100 +790,85 @@ auto device::set_interface(std::uint8_t interface, std::uint8_t alt_setting)
     return result;
 }
 
-auto device::transfer_control_of(libusb_transfer* transfer)
-    -> viu::usb::transfer::control
-{
-    // TODO: check pending transfers
-    return viu::usb::transfer::control{transfer};
-}
-
 namespace {
 
-auto transfer_control_of(viu_usb_mock_transfer_control_opaque* xfer)
+auto control_of(const viu_usb_mock_transfer xfer)
     -> viu::usb::transfer::control
 {
-    viu::_assert(xfer != nullptr);
-    auto* transfer = static_cast<libusb_transfer*>(xfer->ctx);
-    viu::_assert(transfer != nullptr);
-    auto* usb_dev = static_cast<device*>(xfer->device);
-    viu::_assert(usb_dev != nullptr);
-    return usb_dev->transfer_control_of(transfer);
+    return viu::usb::transfer::control{
+        static_cast<libusb_transfer*>(xfer.transfer)
+    };
 }
 
 extern "C" {
 
-void transfer_control_complete(
-    struct viu_usb_mock_transfer_control_opaque* xfer
-)
+void transfer_complete(viu_usb_mock_transfer xfer)
 {
-    transfer_control_of(xfer).complete();
+    control_of(xfer).complete();
 }
 
-bool transfer_control_is_in(struct viu_usb_mock_transfer_control_opaque* xfer)
+bool transfer_is_in(viu_usb_mock_transfer xfer)
 {
-    return transfer_control_of(xfer).is_in();
+    return control_of(xfer).is_in();
 }
 
-bool transfer_control_is_out(struct viu_usb_mock_transfer_control_opaque* xfer)
+bool transfer_is_out(viu_usb_mock_transfer xfer)
 {
-    return transfer_control_of(xfer).is_out();
+    return control_of(xfer).is_out();
 }
 
-void transfer_control_fill(
-    struct viu_usb_mock_transfer_control_opaque* xfer,
+void transfer_fill(
+    viu_usb_mock_transfer xfer,
     const std::uint8_t* data,
     std::size_t size
 )
 {
-    auto vec = viu::format::unsafe::vectorize(data, size);
-    transfer_control_of(xfer).fill(vec);
+    control_of(xfer).fill(std::span{data, size});
 }
 
-void transfer_control_read(
-    struct viu_usb_mock_transfer_control_opaque* xfer,
+void transfer_read(
+    viu_usb_mock_transfer xfer,
     std::uint8_t* out_data,
     std::uint32_t size
 )
 {
-    auto control = transfer_control_of(xfer);
-    if (size == 0) {
-        size = control.size();
-    } else {
-        size = std::min(control.size(), static_cast<int>(size));
+    auto control = control_of(xfer);
+    const auto buffer = control.buffer();
+    const auto read_size =
+        size == 0 ? std::size(buffer)
+                  : std::min<std::size_t>(std::size(buffer), size);
+
+    if (control.is_out()) {
+        control.set_actual_length(read_size);
     }
 
-    auto data = control.read(size);
-    if (!data.empty() && out_data != nullptr) {
-        std::memcpy(out_data, data.data(), size);
+    if (read_size != 0 && out_data != nullptr) {
+        std::memcpy(out_data, buffer.data(), read_size);
     }
 }
 
-int transfer_control_size(struct viu_usb_mock_transfer_control_opaque* xfer)
+int transfer_size(viu_usb_mock_transfer xfer)
 {
-    return transfer_control_of(xfer).size();
+    return control_of(xfer).size();
 }
 
-unsigned char transfer_control_type(
-    struct viu_usb_mock_transfer_control_opaque* xfer
-)
+unsigned char transfer_type(viu_usb_mock_transfer xfer)
 {
-    return transfer_control_of(xfer).type();
+    return control_of(xfer).type();
 }
 
-std::uint8_t transfer_control_ep(
-    struct viu_usb_mock_transfer_control_opaque* xfer
-)
+std::uint8_t transfer_ep(viu_usb_mock_transfer xfer)
 {
-    return transfer_control_of(xfer).ep();
+    return control_of(xfer).ep();
 }
 
-void transfer_control_read_iso_packet_descriptors(
-    struct viu_usb_mock_transfer_control_opaque* xfer,
+void transfer_read_iso_packet_descriptors(
+    viu_usb_mock_transfer xfer,
     struct libusb_iso_packet_descriptor* out_descriptors,
     size_t out_count
 )
 {
-    auto control = transfer_control_of(xfer);
+    const auto control = control_of(xfer);
 
     if (control.iso_packet_descriptor_count() > 0 &&
         out_descriptors != nullptr) {
@@ -752,21 +884,191 @@ void transfer_control_read_iso_packet_descriptors(
     }
 }
 
+size_t transfer_iso_packet_descriptor_count(viu_usb_mock_transfer xfer)
+{
+    return control_of(xfer).iso_packet_descriptor_count();
+}
+
+void transfer_fill_iso_packet_descriptors(
+    viu_usb_mock_transfer xfer,
+    const struct libusb_iso_packet_descriptor* data,
+    size_t size
+)
+{
+    auto vec = viu::format::unsafe::vectorize(data, size);
+    control_of(xfer).fill_iso_packet_descriptors(vec);
+}
+
+std::uint8_t* transfer_buffer(viu_usb_mock_transfer xfer, std::size_t* size)
+{
+    const auto buffer = control_of(xfer).buffer();
+    if (size != nullptr) {
+        *size = std::size(buffer);
+    }
+
+    return buffer.data();
+}
+
+void transfer_set_actual_length(viu_usb_mock_transfer xfer, std::size_t length)
+{
+    control_of(xfer).set_actual_length(length);
+}
+
+void transfer_complete_many(
+    const viu_usb_mock_transfer* xfers,
+    std::size_t count
+)
+{
+    auto transfers = std::vector<libusb_transfer*>{};
+    transfers.reserve(count);
+
+    for (const auto xfer : std::span{xfers, count}) {
+        auto* const t = static_cast<libusb_transfer*>(xfer.transfer);
+        viu::usb::transfer::control{t}.set_status(LIBUSB_TRANSFER_COMPLETED);
+        transfers.push_back(t);
+    }
+
+    // Consecutive transfers of the same device complete together.
+    for (auto first = std::begin(transfers); first != std::end(transfers);) {
+        auto* const self = static_cast<device*>((*first)->user_data);
+        viu::_assert(self != nullptr);
+
+        const auto last = std::find_if(
+            first,
+            std::end(transfers),
+            [self](const auto* t) { return t->user_data != self; }
+        );
+        self->on_transfers_completed(std::span{first, last});
+        first = last;
+    }
+}
+}
+
+constexpr auto transfer_ops = viu_usb_mock_transfer_ops{
+    .version = viu::usb::abi::version,
+    .complete = &transfer_complete,
+    .is_in = &transfer_is_in,
+    .is_out = &transfer_is_out,
+    .fill = &transfer_fill,
+    .read = &transfer_read,
+    .size = &transfer_size,
+    .type = &transfer_type,
+    .ep = &transfer_ep,
+    .read_iso_packet_descriptors = &transfer_read_iso_packet_descriptors,
+    .iso_packet_descriptor_count = &transfer_iso_packet_descriptor_count,
+    .fill_iso_packet_descriptors = &transfer_fill_iso_packet_descriptors,
+    .buffer = &transfer_buffer,
+    .set_actual_length = &transfer_set_actual_length,
+    .complete_many = &transfer_complete_many,
+};
+
+auto mock_transfer_of(const viu::usb::transfer::control& control)
+    -> viu_usb_mock_transfer
+{
+    return {&transfer_ops, control.underlying_transfer()};
+}
+
+// Revision 1 controls carry the transfer in ctx and forward to the table.
+auto mock_transfer_of(viu_usb_mock_transfer_control_opaque* xfer)
+    -> viu_usb_mock_transfer
+{
+    viu::_assert(xfer != nullptr);
+    return {&transfer_ops, xfer->ctx};
+}
+
+extern "C" {
+
+void transfer_control_complete(viu_usb_mock_transfer_control_opaque* xfer)
+{
+    transfer_complete(mock_transfer_of(xfer));
+}
+
+bool transfer_control_is_in(viu_usb_mock_transfer_control_opaque* xfer)
+{
+    return transfer_is_in(mock_transfer_of(xfer));
+}
+
+bool transfer_control_is_out(viu_usb_mock_transfer_control_opaque* xfer)
+{
+    return transfer_is_out(mock_transfer_of(xfer));
+}
+
+void transfer_control_fill(
+    viu_usb_mock_transfer_control_opaque* xfer,
+    const std::uint8_t* data,
+    std::size_t size
+)
+{
+    transfer_fill(mock_transfer_of(xfer), data, size);
+}
+
+void transfer_control_read(
+    viu_usb_mock_transfer_control_opaque* xfer,
+    std::uint8_t* out_data,
+    std::uint32_t size
+)
+{
+    transfer_read(mock_transfer_of(xfer), out_data, size);
+}
+
+int transfer_control_size(viu_usb_mock_transfer_control_opaque* xfer)
+{
+    return transfer_size(mock_transfer_of(xfer));
+}
+
+unsigned char transfer_control_type(viu_usb_mock_transfer_control_opaque* xfer)
+{
+    return transfer_type(mock_transfer_of(xfer));
+}
+
+std::uint8_t transfer_control_ep(viu_usb_mock_transfer_control_opaque* xfer)
+{
+    return transfer_ep(mock_transfer_of(xfer));
+}
+
+void transfer_control_read_iso_packet_descriptors(
+    viu_usb_mock_transfer_control_opaque* xfer,
+    struct libusb_iso_packet_descriptor* out_descriptors,
+    size_t out_count
+)
+{
+    transfer_read_iso_packet_descriptors(
+        mock_transfer_of(xfer),
+        out_descriptors,
+        out_count
+    );
+}
+
 size_t transfer_control_iso_packet_descriptor_count(
-    struct viu_usb_mock_transfer_control_opaque* xfer
+    viu_usb_mock_transfer_control_opaque* xfer
 )
 {
-    return transfer_control_of(xfer).iso_packet_descriptor_count();
+    return transfer_iso_packet_descriptor_count(mock_transfer_of(xfer));
 }
 
 void transfer_control_fill_iso_packet_descriptors(
-    struct viu_usb_mock_transfer_control_opaque* xfer,
+    viu_usb_mock_transfer_control_opaque* xfer,
     const struct libusb_iso_packet_descriptor* data,
     size_t size
 )
 {
-    auto vec = viu::format::unsafe::vectorize(data, size);
-    transfer_control_of(xfer).fill_iso_packet_descriptors(vec);
+    transfer_fill_iso_packet_descriptors(mock_transfer_of(xfer), data, size);
+}
+
+std::uint8_t* transfer_control_buffer(
+    viu_usb_mock_transfer_control_opaque* xfer,
+    std::size_t* size
+)
+{
+    return transfer_buffer(mock_transfer_of(xfer), size);
+}
+
+void transfer_control_set_actual_length(
+    viu_usb_mock_transfer_control_opaque* xfer,
+    std::size_t length
+)
+{
+    transfer_set_actual_length(mock_transfer_of(xfer), length);
 }
 }
 
@@ -793,9 +1095,116 @@ auto device::make_opaque_transfer_control(
             &transfer_control_iso_packet_descriptor_count,
         .fill_iso_packet_descriptors =
             &transfer_control_fill_iso_packet_descriptors,
+        .buffer = &transfer_control_buffer,
+        .set_actual_length = &transfer_control_set_actual_length,
     };
 }
 
+void device::notify_mock_transfer_request(const transfer::control& control)
+{
+    if (mock_iface_ == nullptr) {
+        return;
+    }
+
+    if (mock_routes_endpoints_) {
+        const auto handler =
+            mock_iface_->on_endpoint_request[abi::endpoint_slot(control.ep())];
+        if (handler != nullptr) {
+            handler(mock_iface_.get(), mock_transfer_of(control));
+        } else {
+            // Nothing serves the endpoint. The host sees it stall instead
+            // of waiting for a completion that never comes.
+            control.complete(LIBUSB_TRANSFER_STALL);
+        }
+    } else if (mock_abi_version_ >= 3 &&
+               mock_iface_->on_transfer_requests != nullptr) {
+        batched_requests_.push_back(mock_transfer_of(control));
+        if (!batching_) {
+            flush_transfer_requests();
+        }
+    } else if (mock_abi_version_ >= 2 &&
+        mock_iface_->on_transfer_request_v2 != nullptr) {
+        mock_iface_->on_transfer_request_v2(
+            mock_iface_.get(),
+            mock_transfer_of(control)
+        );
+    } else if (mock_iface_->on_transfer_request != nullptr) {
+        auto opaque_control = make_opaque_transfer_control(control);
+        mock_iface_->on_transfer_request(mock_iface_.get(), &opaque_control);
+    }
+}
+
+void device::notify_mock_transfer_complete(const transfer::control& control)
+{
+    if (mock_iface_ == nullptr) {
+        return;
+    }
+
+    if (mock_abi_version_ >= 3 &&
+        mock_iface_->on_transfer_completes != nullptr) {
+        const auto xfer = mock_transfer_of(control);
+        mock_iface_->on_transfer_completes(mock_iface_.get(), &xfer, 1);
+    } else if (mock_abi_version_ >= 2 &&
+        mock_iface_->on_transfer_complete_v2 != nullptr) {
+        mock_iface_->on_transfer_complete_v2(
+            mock_iface_.get(),
+            mock_transfer_of(control)
+        );
+    } else if (mock_iface_->on_transfer_complete != nullptr) {
+        auto opaque_control = make_opaque_transfer_control(control);
+        mock_iface_->on_transfer_complete(mock_iface_.get(), &opaque_control);
+    }
+}
+
+void device::notify_mock_transfer_completes(
+    const std::span<libusb_transfer* const> xfers
+)
+{
+    if (mock_iface_ == nullptr) {
+        return;
+    }
+
+    if (mock_abi_version_ < 3 ||
+        mock_iface_->on_transfer_completes == nullptr) {
+        for (auto* const xfer : xfers) {
+            notify_mock_transfer_complete(transfer::control{xfer});
+        }
+        return;
+    }
+
+    auto batch = std::vector<viu_usb_mock_transfer>{};
+    batch.reserve(std::size(xfers));
+    for (auto* const xfer : xfers) {
+        batch.push_back(mock_transfer_of(transfer::control{xfer}));
+    }
+
+    mock_iface_->on_transfer_completes(
+        mock_iface_.get(),
+        batch.data(),
+        std::size(batch)
+    );
+}
+
+void device::flush_transfer_requests()
+{
+    if (batched_requests_.empty()) {
+        return;
+    }
+
+    mock_iface_->on_transfer_requests(
+        mock_iface_.get(),
+        batched_requests_.data(),
+        std::size(batched_requests_)
+    );
+    batched_requests_.clear();
+}
+
+void device::end_transfer_batch()
+{
+    batching_ = false;
+    flush_transfer_requests();
+}
+
 template <typename XferFillMemberFn>
 void device::submit_transfer_impl(
     const transfer::info& transfer_info,
@@ -805,10 +1214,17 @@ void device::submit_transfer_impl(
     auto xfer_control = (this->*fill_fn)(transfer_info, underlying_handle());
     xfer_control.attach(transfer_info.callback, pending_transfers_map_, this);
 
-    if (mock_iface_ != nullptr && mock_iface_->on_transfer_request != nullptr) {
-        auto opaque_control = make_opaque_transfer_control(xfer_control);
-        mock_iface_->on_transfer_request(mock_iface_.get(), &opaque_control);
-    }
+    const auto ep = transfer_info.ep_address & LIBUSB_ENDPOINT_ADDRESS_MASK;
+    transfer_metrics_[ep].submitted.add();
+    VIU_PROBE4(
+        transfer_submitted,
+        xfer_control.underlying_transfer(),
+        transfer_info.ep_address,
+        std::size(transfer_info.buffer),
+        xfer_control.type()
+    );
+
+    notify_mock_transfer_request(xfer_control);
 
     if (!is_mock()) {
         xfer_control.submit(libusb_ctx(), pending_transfers_map_);
@@ -837,18 +1253,184 @@ void LIBUSB_CALL on_transfer_completed(libusb_transfer* const transfer)
     self->on_transfer_completed(transfer);
 }
 
-void device::on_transfer_completed(libusb_transfer* const xfer)
+void device::count_completion(const libusb_transfer* const xfer)
 {
-    if (mock_iface_ != nullptr &&
-        mock_iface_->on_transfer_complete != nullptr) {
-        auto control = viu::usb::transfer::control(xfer);
-        auto opaque_control = make_opaque_transfer_control(control);
-        mock_iface_->on_transfer_complete(mock_iface_.get(), &opaque_control);
+    auto& counters =
+        transfer_metrics_[xfer->endpoint & LIBUSB_ENDPOINT_ADDRESS_MASK];
+    counters.completed.add();
+    VIU_PROBE4(
+        transfer_completed,
+        xfer,
+        xfer->endpoint,
+        xfer->status,
+        xfer->actual_length
+    );
+
+    if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        counters.failed.add();
     }
 
+    if (xfer->num_iso_packets == 0) {
+        counters.bytes.add(xfer->actual_length);
+    } else {
+        const auto packets = std::span{
+            xfer->iso_packet_desc,
+            static_cast<std::size_t>(xfer->num_iso_packets)
+        };
+        for (const auto& packet : packets) {
+            counters.bytes.add(packet.actual_length);
+        }
+    }
+}
+
+void device::dispatch_completed(libusb_transfer* const xfer)
+{
+    count_completion(xfer);
+    notify_mock_transfer_complete(viu::usb::transfer::control{xfer});
+
     pending_transfers_map_.on_transfer_completed_impl(xfer);
 }
 
+void device::dispatch_completed(const std::span<libusb_transfer* const> xfers)
+{
+    std::ranges::for_each(xfers, [this](const auto* x) {
+        count_completion(x);
+    });
+    notify_mock_transfer_completes(xfers);
+
+    pending_transfers_map_.on_transfers_completed_impl(xfers);
+}
+
+namespace {
+
+// bInterval counts frames of 1 ms for full speed interrupt endpoints and is
+// the exponent of 2^(bInterval-1) frames for full speed iso endpoints and
+// of as many microframes of 125 us from high speed on.
+auto service_period(
+    const std::uint8_t attributes,
+    const std::uint8_t interval,
+    const std::uint16_t bcd_usb
+) -> std::optional<viu::timer::clock::duration>
+{
+    using namespace std::chrono_literals;
+
+    const auto type = attributes & ep_transfer_type_mask;
+    if (type != LIBUSB_TRANSFER_TYPE_INTERRUPT &&
+        type != LIBUSB_TRANSFER_TYPE_ISOCHRONOUS) {
+        return std::nullopt;
+    }
+
+    const auto frames = bcd_usb < 0x0200;
+    if (frames && type == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+        return std::max<int>(interval, 1) * 1ms;
+    }
+
+    const auto exponent = std::clamp<int>(interval, 1, 16) - 1;
+    return (1 << exponent) * (frames ? 1000us : 125us);
+}
+
+} // namespace
+
+// A completion that comes before the endpoint's next service opportunity
+// is dispatched from the shared timer wheel once it is due.
+auto device::pace(libusb_transfer* const xfer) -> bool
+{
+    const auto is_in =
+        (xfer->endpoint & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN;
+    if (pacing_ != pacing::interval || !is_mock() || !is_in) {
+        return false;
+    }
+
+    const auto active = active_config_.load(std::memory_order_relaxed);
+    const auto attributes =
+        descriptor_tree_->ep_attributes(active, xfer->endpoint);
+    const auto interval = descriptor_tree_->ep_interval(active, xfer->endpoint);
+    if (!attributes.has_value() || !interval.has_value()) {
+        return false;
+    }
+
+    const auto period = service_period(*attributes, *interval, speed());
+    if (!period.has_value()) {
+        return false;
+    }
+
+    const auto now = viu::timer::clock::now();
+
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{pacing_mutex_};
+    if (paced_cancelled_) {
+        return false;
+    }
+
+    // An isochronous transfer takes one service interval per packet.
+    const auto intervals = std::max(xfer->num_iso_packets, 1);
+    auto& next = next_service_[xfer->endpoint & LIBUSB_ENDPOINT_ADDRESS_MASK];
+    const auto due = std::max(now, next);
+    next = due + *period * intervals;
+    if (due == now) {
+        return false;
+    }
+
+    const auto timer = viu::timer::shared().schedule(due, [this, xfer] {
+        complete_paced(xfer);
+    });
+    paced_.emplace(xfer, timer);
+
+    return true;
+}
+
+void device::complete_paced(libusb_transfer* const xfer)
+{
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{pacing_mutex_};
+        paced_.erase(xfer);
+    }
+
+    dispatch_completed(xfer);
+}
+
+// Held back transfers stay pending and go with the others, a timer already
+// running is waited for.
+void device::cancel_paced()
+{
+    auto paced = decltype(paced_){};
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{pacing_mutex_};
+        paced_cancelled_ = true;
+        paced = std::exchange(paced_, {});
+    }
+
+    for (const auto& [xfer, timer] : paced) {
+        viu::timer::shared().cancel(timer);
+    }
+}
+
+void device::on_transfer_completed(libusb_transfer* const xfer)
+{
+    if (!pace(xfer)) {
+        dispatch_completed(xfer);
+    }
+}
+
+void device::on_transfers_completed(
+    const std::span<libusb_transfer* const> xfers
+)
+{
+    if (pacing_ != pacing::interval) {
+        dispatch_completed(xfers);
+        return;
+    }
+
+    auto ready = std::vector<libusb_transfer*>{};
+    ready.reserve(std::size(xfers));
+    std::ranges::copy_if(xfers, std::back_inserter(ready), [this](auto* x) {
+        return !pace(x);
+    });
+
+    if (!ready.empty()) {
+        dispatch_completed(ready);
+    }
+}
+
 auto device::fill_bulk(
     const usb::transfer::info& transfer_info,
     libusb_device_handle* const device_handle
@@ -993,6 +1575,7 @@ auto device::submit_control_setup(
         );
     }
 
+    flush_transfer_requests();
     if (mock_iface_ != nullptr && mock_iface_->on_control_setup != nullptr) {
         result = mock_iface_->on_control_setup(
             mock_iface_.get(),
@@ -1029,4 +1612,8 @@ auto device::handle_events(
     return result;
 }
 
-void device::cancel_transfers() { pending_transfers_map_.cancel(); }
\ No newline at end of file
+void device::cancel_transfers()
+{
+    cancel_paced();
+    pending_transfers_map_.cancel();
+}
\ No newline at end of file
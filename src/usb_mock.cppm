@@ -6,6 +6,7 @@ import viu.usb;
 import viu.usb.mock.abi;
 import viu.device.proxy;
 import viu.usb.descriptors;
+import viu.vhci;
 
 namespace viu::device {
 
@@ -13,10 +14,22 @@ export class mock : public proxy {
 public:
     mock(
         usb::descriptor::tree descriptor_tree,
-        viu_usb_mock_opaque* xfer_instance
+        usb::mock_plugin plugin,
+        usb::pacing pace = usb::pacing::interval
+    )
+        : proxy{std::make_shared<viu::usb::mock>(descriptor_tree, plugin, pace)}
+    {
+    }
+
+    mock(
+        std::shared_ptr<const usb::descriptor::tree> descriptor_tree,
+        usb::mock_plugin plugin,
+        vhci::port_manager::lease port_lease,
+        usb::pacing pace = usb::pacing::interval
     )
         : proxy{
-              std::make_shared<viu::usb::mock>(descriptor_tree, xfer_instance)
+              std::make_shared<viu::usb::mock>(descriptor_tree, plugin, pace),
+              std::move(port_lease)
           }
     {
     }
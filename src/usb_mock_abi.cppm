@@ -7,6 +7,25 @@ export module viu.usb.mock.abi;
 export {
     using ::device_factory_fn;
     using ::plugin_catalog_api;
+    using ::viu_usb_mock_host;
     using ::viu_usb_mock_opaque;
+    using ::viu_usb_mock_timer;
+    using ::viu_usb_mock_transfer;
     using ::viu_usb_mock_transfer_control_opaque;
+    using ::viu_usb_mock_transfer_ops;
 }
+
+export namespace viu::usb::abi {
+
+constexpr uint32_t version = VIU_USB_MOCK_ABI_VERSION;
+
+// Assumed for plugin libraries that do not export viu_usb_mock_abi_version.
+constexpr uint32_t unversioned = 1;
+
+// Index of an endpoint address in viu_usb_mock_opaque::on_endpoint_request.
+constexpr auto endpoint_slot(const uint8_t address) -> size_t
+{
+    return VIU_USB_MOCK_ENDPOINT_SLOT(address);
+}
+
+} // namespace viu::usb::abi
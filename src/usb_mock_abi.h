@@ -10,6 +10,92 @@
 extern "C" {
 #endif
 
+/* Revision of this header. A plugin library exports it as
+ *     const uint32_t viu_usb_mock_abi_version = VIU_USB_MOCK_ABI_VERSION;
+ * (usb_mock_abi.hpp does that for C++ plugins). Libraries without the
+ * symbol are revision 1: the host only uses the callbacks up to
+ * on_transfer_complete and hands them viu_usb_mock_transfer_control_opaque.
+ */
+#define VIU_USB_MOCK_ABI_VERSION 5
+
+/* Slot of an endpoint address in on_endpoint_request, OUT endpoints first. */
+#define VIU_USB_MOCK_ENDPOINT_SLOTS 32
+#define VIU_USB_MOCK_ENDPOINT_SLOT(address)                                    \
+    (((address) & 0x0f) | (((address) & 0x80) >> 3))
+
+struct viu_usb_mock_transfer_ops;
+
+/* A transfer as seen by a plugin since revision 2. It is two pointers,
+ * passed by value and cheap to queue until the plugin completes it. */
+struct viu_usb_mock_transfer {
+    const struct viu_usb_mock_transfer_ops* ops;
+    void* transfer;
+};
+
+/* One table for all transfers, owned by the host. Plugins that run on
+ * older hosts check `version` before using entries added after theirs. */
+struct viu_usb_mock_transfer_ops {
+    uint32_t version;
+    void (*complete)(struct viu_usb_mock_transfer xfer);
+    bool (*is_in)(struct viu_usb_mock_transfer xfer);
+    bool (*is_out)(struct viu_usb_mock_transfer xfer);
+    void (*fill)(
+        struct viu_usb_mock_transfer xfer,
+        const uint8_t* data,
+        size_t size
+    );
+    void (*read)(
+        struct viu_usb_mock_transfer xfer,
+        uint8_t* data,
+        uint32_t size
+    );
+    int (*size)(struct viu_usb_mock_transfer xfer);
+    unsigned char (*type)(struct viu_usb_mock_transfer xfer);
+    uint8_t (*ep)(struct viu_usb_mock_transfer xfer);
+    void (*read_iso_packet_descriptors)(
+        struct viu_usb_mock_transfer xfer,
+        struct libusb_iso_packet_descriptor* out_descriptors,
+        size_t out_count
+    );
+    size_t (*iso_packet_descriptor_count)(struct viu_usb_mock_transfer xfer);
+    void (*fill_iso_packet_descriptors)(
+        struct viu_usb_mock_transfer xfer,
+        const struct libusb_iso_packet_descriptor* data,
+        size_t size
+    );
+    uint8_t* (*buffer)(struct viu_usb_mock_transfer xfer, size_t* size);
+    void (*set_actual_length)(struct viu_usb_mock_transfer xfer, size_t length);
+
+    /* Version 3. Completes all transfers in one go, the host hands them to
+     * its completion path together instead of one call per transfer. */
+    void (*complete_many)(
+        const struct viu_usb_mock_transfer* xfers,
+        size_t count
+    );
+};
+
+/* A timer of viu_usb_mock_host, 0 is never a valid one. */
+typedef uint64_t viu_usb_mock_timer;
+
+/* Services the host offers to plugins since revision 5. */
+struct viu_usb_mock_host {
+    uint32_t version;
+    /* Nanoseconds on CLOCK_MONOTONIC, the clock of all deadlines. */
+    uint64_t (*now_ns)(void);
+    /* Calls cb(ctx) once at deadline_ns on a host thread that serves the
+     * timers of all plugins. Callbacks should return quickly, a periodic
+     * timer schedules itself again from its callback. */
+    viu_usb_mock_timer (*schedule)(
+        uint64_t deadline_ns,
+        void (*cb)(void* ctx),
+        void* ctx
+    );
+    /* True if the timer had not fired yet and never will. Waits for its
+     * callback to return if it is running, unless called from a callback. */
+    bool (*cancel)(viu_usb_mock_timer timer);
+};
+
+/* Revision 1 transfer control, built per callback. */
 struct viu_usb_mock_transfer_control_opaque {
     void* ctx;
     void* device;
@@ -42,6 +128,19 @@ struct viu_usb_mock_transfer_control_opaque {
         const struct libusb_iso_packet_descriptor* data,
         size_t size
     );
+    /* The transfer buffer itself, valid until the transfer completes. IN
+     * payloads are written into it followed by set_actual_length(), OUT
+     * payloads are read from it without a copy and count as taken whole
+     * unless set_actual_length() says otherwise. Lengths past the end of
+     * the buffer are clamped to its size. */
+    uint8_t* (*buffer)(
+        struct viu_usb_mock_transfer_control_opaque* xfer,
+        size_t* size
+    );
+    void (*set_actual_length)(
+        struct viu_usb_mock_transfer_control_opaque* xfer,
+        size_t length
+    );
 };
 
 struct viu_usb_mock_opaque {
@@ -68,6 +167,47 @@ struct viu_usb_mock_opaque {
         struct viu_usb_mock_transfer_control_opaque* xfer
     );
     void (*destroy)(struct viu_usb_mock_opaque* self);
+
+    /* Revision 2, preferred over the callbacks above when set. */
+    void (*on_transfer_request_v2)(
+        viu_usb_mock_opaque* mock,
+        struct viu_usb_mock_transfer xfer
+    );
+    void (*on_transfer_complete_v2)(
+        viu_usb_mock_opaque* mock,
+        struct viu_usb_mock_transfer xfer
+    );
+
+    /* Revision 3, preferred over the single transfer callbacks when set.
+     * The host delivers the URBs it took off its queue in one go, a single
+     * transfer comes as a batch of one. The array is only valid during the
+     * call, the transfers themselves until they complete. */
+    void (*on_transfer_requests)(
+        viu_usb_mock_opaque* mock,
+        const struct viu_usb_mock_transfer* xfers,
+        size_t count
+    );
+    void (*on_transfer_completes)(
+        viu_usb_mock_opaque* mock,
+        const struct viu_usb_mock_transfer* xfers,
+        size_t count
+    );
+
+    /* Revision 4. Once a plugin sets any of these, the host routes each
+     * transfer request to the handler of its endpoint and stalls requests
+     * to endpoints without one; the request callbacks above are no longer
+     * used. */
+    void (*on_endpoint_request[VIU_USB_MOCK_ENDPOINT_SLOTS])(
+        viu_usb_mock_opaque* mock,
+        struct viu_usb_mock_transfer xfer
+    );
+
+    /* Revision 5. Called once before any other callback, the services stay
+     * valid for the lifetime of the mock. */
+    void (*on_host)(
+        viu_usb_mock_opaque* mock,
+        const struct viu_usb_mock_host* host
+    );
 };
 
 typedef struct viu_usb_mock_opaque* (*device_factory_fn)(void);
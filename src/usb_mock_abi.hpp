@@ -1,16 +1,83 @@
 #ifndef VIU_USB_MOCK_ABI_HPP
 #define VIU_USB_MOCK_ABI_HPP
 
+#include <array>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <span>
 #include <type_traits>
 #include <utility>
 
 #include "usb_mock_abi.h"
 
+// Weak, so that every translation unit of a plugin may include this header.
+extern "C" __attribute__((weak, visibility("default")))
+const uint32_t viu_usb_mock_abi_version = VIU_USB_MOCK_ABI_VERSION;
+
+namespace viu {
+
+// An entry of a plugin's endpoint map, an alternative to on_ep_0x81 style
+// members:
+//   static constexpr auto endpoints = std::array{
+//       viu::endpoint<mouse>{0x81, &mouse::on_input},
+//   };
+template <typename T>
+struct endpoint {
+    uint8_t address;
+    void (T::*handler)(viu_usb_mock_transfer);
+};
+
+} // namespace viu
+
 namespace viu::detail {
 
+template <typename T>
+concept has_on_transfer_request_v2_member =
+    requires(T t, viu_usb_mock_transfer x) {
+        { t.on_transfer_request(x) } -> std::same_as<void>;
+    };
+
+template <typename T>
+concept has_on_transfer_request_v2_static = requires(viu_usb_mock_transfer x) {
+    { T::on_transfer_request(x) } -> std::same_as<void>;
+};
+
+template <typename T>
+concept has_on_transfer_complete_v2_member =
+    requires(T t, viu_usb_mock_transfer x) {
+        { t.on_transfer_complete(x) } -> std::same_as<void>;
+    };
+
+template <typename T>
+concept has_on_transfer_complete_v2_static = requires(viu_usb_mock_transfer x) {
+    { T::on_transfer_complete(x) } -> std::same_as<void>;
+};
+
+template <typename T>
+concept has_on_transfer_requests_member =
+    requires(T t, std::span<const viu_usb_mock_transfer> x) {
+        { t.on_transfer_requests(x) } -> std::same_as<void>;
+    };
+
+template <typename T>
+concept has_on_transfer_requests_static =
+    requires(std::span<const viu_usb_mock_transfer> x) {
+        { T::on_transfer_requests(x) } -> std::same_as<void>;
+    };
+
+template <typename T>
+concept has_on_transfer_completes_member =
+    requires(T t, std::span<const viu_usb_mock_transfer> x) {
+        { t.on_transfer_completes(x) } -> std::same_as<void>;
+    };
+
+template <typename T>
+concept has_on_transfer_completes_static =
+    requires(std::span<const viu_usb_mock_transfer> x) {
+        { T::on_transfer_completes(x) } -> std::same_as<void>;
+    };
+
 template <typename T>
 concept has_on_transfer_request_member =
     requires(T t, viu_usb_mock_transfer_control_opaque x) {
@@ -37,6 +104,16 @@ concept has_on_transfer_complete_static = requires(
     { T::on_transfer_complete(x) } -> std::same_as<void>;
 };
 
+template <typename T>
+concept has_on_host_member = requires(T t, const viu_usb_mock_host* host) {
+    { t.on_host(host) } -> std::same_as<void>;
+};
+
+template <typename T>
+concept has_on_destroy_member = requires(T t) {
+    { t.on_destroy() } -> std::same_as<void>;
+};
+
 template <typename T>
 concept has_on_control_setup_member = requires(
     T t,
@@ -112,6 +189,95 @@ inline void dispatch_transfer_compete(
     }
 }
 
+template <typename T>
+inline void dispatch_transfer_request_v2(
+    viu_usb_mock_opaque* mock,
+    viu_usb_mock_transfer xfer
+) noexcept
+{
+    try {
+        if constexpr (has_on_transfer_request_v2_static<T>) {
+            T::on_transfer_request(xfer);
+        } else if constexpr (has_on_transfer_request_v2_member<T>) {
+            static_cast<T*>(mock->ctx)->on_transfer_request(xfer);
+        }
+    } catch (...) {
+    }
+}
+
+template <typename T>
+inline void dispatch_transfer_complete_v2(
+    viu_usb_mock_opaque* mock,
+    viu_usb_mock_transfer xfer
+) noexcept
+{
+    try {
+        if constexpr (has_on_transfer_complete_v2_static<T>) {
+            T::on_transfer_complete(xfer);
+        } else if constexpr (has_on_transfer_complete_v2_member<T>) {
+            static_cast<T*>(mock->ctx)->on_transfer_complete(xfer);
+        }
+    } catch (...) {
+    }
+}
+
+template <typename T>
+inline void dispatch_transfer_requests(
+    viu_usb_mock_opaque* mock,
+    const viu_usb_mock_transfer* xfers,
+    size_t count
+) noexcept
+{
+    try {
+        const auto batch = std::span{xfers, count};
+        if constexpr (has_on_transfer_requests_static<T>) {
+            T::on_transfer_requests(batch);
+        } else if constexpr (has_on_transfer_requests_member<T>) {
+            static_cast<T*>(mock->ctx)->on_transfer_requests(batch);
+        }
+    } catch (...) {
+    }
+}
+
+template <typename T>
+inline void dispatch_transfer_completes(
+    viu_usb_mock_opaque* mock,
+    const viu_usb_mock_transfer* xfers,
+    size_t count
+) noexcept
+{
+    try {
+        const auto batch = std::span{xfers, count};
+        if constexpr (has_on_transfer_completes_static<T>) {
+            T::on_transfer_completes(batch);
+        } else if constexpr (has_on_transfer_completes_member<T>) {
+            static_cast<T*>(mock->ctx)->on_transfer_completes(batch);
+        }
+    } catch (...) {
+    }
+}
+
+// Plugins implement one of the signatures of each transfer callback, the
+// host prefers the batched one, then revision 2, then revision 1.
+template <typename T>
+constexpr bool has_on_transfer_request_v2 =
+    has_on_transfer_request_v2_static<T> ||
+    has_on_transfer_request_v2_member<T>;
+
+template <typename T>
+constexpr bool has_on_transfer_complete_v2 =
+    has_on_transfer_complete_v2_static<T> ||
+    has_on_transfer_complete_v2_member<T>;
+
+template <typename T>
+constexpr bool has_on_transfer_requests =
+    has_on_transfer_requests_static<T> || has_on_transfer_requests_member<T>;
+
+template <typename T>
+constexpr bool has_on_transfer_completes =
+    has_on_transfer_completes_static<T> ||
+    has_on_transfer_completes_member<T>;
+
 template <typename T>
 inline int dispatch_control_setup(
     viu_usb_mock_opaque* mock,
@@ -174,6 +340,103 @@ inline int dispatch_set_interface(
     return LIBUSB_ERROR_NOT_SUPPORTED;
 }
 
+template <typename T>
+inline void dispatch_host(
+    viu_usb_mock_opaque* mock,
+    const viu_usb_mock_host* host
+) noexcept
+{
+    try {
+        static_cast<T*>(mock->ctx)->on_host(host);
+    } catch (...) {
+    }
+}
+
+// on_destroy() runs while the whole object is still alive, before its
+// destructor.
+template <typename T>
+inline void dispatch_destroy(viu_usb_mock_opaque* mock) noexcept
+{
+    auto* const impl = static_cast<T*>(mock->ctx);
+    if constexpr (has_on_destroy_member<T>) {
+        impl->on_destroy();
+    }
+
+    delete impl;
+}
+
+template <typename T, auto Handler>
+inline void dispatch_endpoint(
+    viu_usb_mock_opaque* mock,
+    viu_usb_mock_transfer xfer
+) noexcept
+{
+    try {
+        (static_cast<T*>(mock->ctx)->*Handler)(xfer);
+    } catch (...) {
+    }
+}
+
+#define VIU_DETAIL_ENDPOINTS(X)                                                \
+    X(0x01) X(0x02) X(0x03) X(0x04) X(0x05) X(0x06) X(0x07) X(0x08)            \
+    X(0x09) X(0x0a) X(0x0b) X(0x0c) X(0x0d) X(0x0e) X(0x0f)                    \
+    X(0x81) X(0x82) X(0x83) X(0x84) X(0x85) X(0x86) X(0x87) X(0x88)            \
+    X(0x89) X(0x8a) X(0x8b) X(0x8c) X(0x8d) X(0x8e) X(0x8f)
+
+#define VIU_DETAIL_ENDPOINT_MEMBER(address)                                    \
+    template <typename T>                                                      \
+    concept has_on_ep_##address = requires(T t, viu_usb_mock_transfer x) {     \
+        { t.on_ep_##address(x) } -> std::same_as<void>;                        \
+    };                                                                         \
+                                                                               \
+    template <typename T>                                                      \
+    inline void set_on_ep_##address(viu_usb_mock_opaque* self) noexcept        \
+    {                                                                          \
+        if constexpr (has_on_ep_##address<T>) {                                \
+            self->on_endpoint_request[VIU_USB_MOCK_ENDPOINT_SLOT(address)] =   \
+                &dispatch_endpoint<T, &T::on_ep_##address>;                    \
+        }                                                                      \
+    }
+
+VIU_DETAIL_ENDPOINTS(VIU_DETAIL_ENDPOINT_MEMBER)
+
+#undef VIU_DETAIL_ENDPOINT_MEMBER
+
+template <typename T>
+concept has_endpoint_map = requires {
+    std::tuple_size<std::remove_cv_t<decltype(T::endpoints)>>::value;
+    { T::endpoints[0] } -> std::convertible_to<endpoint<T>>;
+};
+
+template <typename T, size_t I>
+inline void set_mapped_endpoint(viu_usb_mock_opaque* self) noexcept
+{
+    constexpr auto entry = endpoint<T>{T::endpoints[I]};
+    static_assert(
+        (entry.address & 0x70) == 0 && (entry.address & 0x0f) != 0,
+        "Endpoint map entries need a non-control endpoint address"
+    );
+
+    self->on_endpoint_request[VIU_USB_MOCK_ENDPOINT_SLOT(entry.address)] =
+        &dispatch_endpoint<T, entry.handler>;
+}
+
+template <typename T>
+inline void set_endpoint_handlers(viu_usb_mock_opaque* self) noexcept
+{
+#define VIU_DETAIL_SET_ON_EP(address) set_on_ep_##address<T>(self);
+    VIU_DETAIL_ENDPOINTS(VIU_DETAIL_SET_ON_EP)
+#undef VIU_DETAIL_SET_ON_EP
+
+    if constexpr (has_endpoint_map<T>) {
+        constexpr auto count =
+            std::tuple_size_v<std::remove_cv_t<decltype(T::endpoints)>>;
+        [self]<size_t... I>(std::index_sequence<I...>) {
+            (set_mapped_endpoint<T, I>(self), ...);
+        }(std::make_index_sequence<count>{});
+    }
+}
+
 template <typename T>
 inline void destroy_impl(viu_usb_mock_opaque* self) noexcept
 {
@@ -204,6 +467,40 @@ inline void destroy_impl(viu_usb_mock_opaque* self) noexcept
         viu::detail::dispatch_transfer_compete<Type>(mock, xfer);              \
     }                                                                          \
                                                                                \
+    extern "C" void Name##_on_transfer_request_v2(                             \
+        viu_usb_mock_opaque* mock,                                             \
+        viu_usb_mock_transfer xfer                                             \
+    ) noexcept                                                                 \
+    {                                                                          \
+        viu::detail::dispatch_transfer_request_v2<Type>(mock, xfer);           \
+    }                                                                          \
+                                                                               \
+    extern "C" void Name##_on_transfer_complete_v2(                            \
+        viu_usb_mock_opaque* mock,                                             \
+        viu_usb_mock_transfer xfer                                             \
+    ) noexcept                                                                 \
+    {                                                                          \
+        viu::detail::dispatch_transfer_complete_v2<Type>(mock, xfer);          \
+    }                                                                          \
+                                                                               \
+    extern "C" void Name##_on_transfer_requests(                               \
+        viu_usb_mock_opaque* mock,                                             \
+        const viu_usb_mock_transfer* xfers,                                    \
+        size_t count                                                           \
+    ) noexcept                                                                 \
+    {                                                                          \
+        viu::detail::dispatch_transfer_requests<Type>(mock, xfers, count);     \
+    }                                                                          \
+                                                                               \
+    extern "C" void Name##_on_transfer_completes(                              \
+        viu_usb_mock_opaque* mock,                                             \
+        const viu_usb_mock_transfer* xfers,                                    \
+        size_t count                                                           \
+    ) noexcept                                                                 \
+    {                                                                          \
+        viu::detail::dispatch_transfer_completes<Type>(mock, xfers, count);    \
+    }                                                                          \
+                                                                               \
     extern "C" int Name##_on_control_setup(                                    \
         viu_usb_mock_opaque* mock,                                             \
         libusb_control_setup s,                                                \
@@ -240,7 +537,7 @@ inline void destroy_impl(viu_usb_mock_opaque* self) noexcept
                                                                                \
     extern "C" void Name##_destroy(viu_usb_mock_opaque* self) noexcept         \
     {                                                                          \
-        delete static_cast<Type*>(self->ctx);                                  \
+        viu::detail::dispatch_destroy<Type>(self);                             \
         delete self;                                                           \
     }                                                                          \
                                                                                \
@@ -254,6 +551,22 @@ inline void destroy_impl(viu_usb_mock_opaque* self) noexcept
         self->on_control_setup = &Name##_on_control_setup;                     \
         self->on_set_configuration = &Name##_on_set_configuration;             \
         self->on_set_interface = &Name##_on_set_interface;                     \
+        if constexpr (viu::detail::has_on_transfer_request_v2<Type>) {         \
+            self->on_transfer_request_v2 = &Name##_on_transfer_request_v2;     \
+        }                                                                      \
+        if constexpr (viu::detail::has_on_transfer_complete_v2<Type>) {        \
+            self->on_transfer_complete_v2 = &Name##_on_transfer_complete_v2;   \
+        }                                                                      \
+        if constexpr (viu::detail::has_on_transfer_requests<Type>) {           \
+            self->on_transfer_requests = &Name##_on_transfer_requests;         \
+        }                                                                      \
+        if constexpr (viu::detail::has_on_transfer_completes<Type>) {          \
+            self->on_transfer_completes = &Name##_on_transfer_completes;       \
+        }                                                                      \
+        viu::detail::set_endpoint_handlers<Type>(self);                        \
+        if constexpr (viu::detail::has_on_host_member<Type>) {                 \
+            self->on_host = &viu::detail::dispatch_host<Type>;                 \
+        }                                                                      \
         return self;                                                           \
     }
 
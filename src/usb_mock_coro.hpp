@@ -0,0 +1,454 @@
+#ifndef VIU_USB_MOCK_CORO_HPP
+#define VIU_USB_MOCK_CORO_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "usb_mock_abi.hpp"
+
+// Coroutines over the mock ABI. A plugin derives from viu::coro::device,
+// spawns its tasks in start() and waits for transfers, control requests
+// and deadlines instead of queueing them for a thread of its own:
+//
+//   struct mouse final : viu::coro::device {
+//       void start() override { spawn(report()); }
+//
+//       auto report() -> viu::coro::task
+//       {
+//           while (true) {
+//               auto xfer = co_await ep(0x81).next();
+//               co_await sleep_for(std::chrono::milliseconds{500});
+//               xfer.fill(report_);
+//               xfer.complete();
+//           }
+//       }
+//   };
+//
+//   REGISTER_USB_MOCK(mouse_plugin, mouse)
+//
+// Tasks are resumed from the host's callbacks: transfer requests and
+// control setups on the thread that submits them, sleeps on the host's
+// timer thread. A device resumes one task at a time, its tasks share its
+// state without locks of their own.
+
+namespace viu::coro {
+
+using clock = std::chrono::steady_clock;
+
+class device;
+
+// A task of a device. It starts when spawned and is destroyed with the
+// device if it has not finished by then.
+class task {
+public:
+    struct promise_type {
+        auto get_return_object() -> task
+        {
+            return task{
+                std::coroutine_handle<promise_type>::from_promise(*this)
+            };
+        }
+
+        auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+        auto final_suspend() noexcept -> std::suspend_always { return {}; }
+        void return_void() noexcept {}
+        // A task that throws ends there, the device and its other tasks
+        // carry on.
+        void unhandled_exception() noexcept
+        {
+            try {
+                throw;
+            } catch (const std::exception& e) {
+                std::fprintf(stderr, "viu: mock task failed: %s\n", e.what());
+            } catch (...) {
+                std::fprintf(stderr, "viu: mock task failed\n");
+            }
+        }
+    };
+
+    task(task&& other) noexcept : handle_{std::exchange(other.handle_, {})}
+    {
+    }
+
+    ~task()
+    {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    task(const task&) = delete;
+    auto operator=(const task&) -> task& = delete;
+    auto operator=(task&&) -> task& = delete;
+
+private:
+    friend class device;
+
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept
+        : handle_{handle}
+    {
+    }
+
+    auto release() noexcept -> std::coroutine_handle<>
+    {
+        return std::exchange(handle_, {});
+    }
+
+    std::coroutine_handle<promise_type> handle_{};
+};
+
+// A transfer requested by the host, valid until it is completed.
+class transfer {
+public:
+    explicit transfer(viu_usb_mock_transfer xfer) noexcept : xfer_{xfer} {}
+
+    [[nodiscard]] auto ep() const -> std::uint8_t
+    {
+        return xfer_.ops->ep(xfer_);
+    }
+
+    [[nodiscard]] auto is_in() const -> bool { return xfer_.ops->is_in(xfer_); }
+
+    [[nodiscard]] auto buffer() const -> std::span<std::uint8_t>
+    {
+        auto size = std::size_t{};
+        auto* const data = xfer_.ops->buffer(xfer_, &size);
+        return {data, size};
+    }
+
+    void fill(std::span<const std::uint8_t> data) const
+    {
+        xfer_.ops->fill(xfer_, data.data(), data.size());
+    }
+
+    void set_actual_length(std::size_t length) const
+    {
+        xfer_.ops->set_actual_length(xfer_, length);
+    }
+
+    void complete() const { xfer_.ops->complete(xfer_); }
+
+    [[nodiscard]] auto raw() const noexcept -> viu_usb_mock_transfer
+    {
+        return xfer_;
+    }
+
+private:
+    viu_usb_mock_transfer xfer_;
+};
+
+// Transfers the host requested on one endpoint, in the order it did.
+class endpoint {
+public:
+    class awaiter {
+    public:
+        explicit awaiter(endpoint& ep) noexcept : ep_{ep} {}
+
+        [[nodiscard]] auto await_ready() const noexcept -> bool
+        {
+            return !ep_.requested_.empty();
+        }
+
+        void await_suspend(std::coroutine_handle<> waiter) noexcept
+        {
+            ep_.waiter_ = waiter;
+        }
+
+        auto await_resume() -> transfer
+        {
+            const auto xfer = ep_.requested_.front();
+            ep_.requested_.pop_front();
+            return transfer{xfer};
+        }
+
+    private:
+        endpoint& ep_;
+    };
+
+    // One task at a time waits on an endpoint.
+    [[nodiscard]] auto next() noexcept -> awaiter { return awaiter{*this}; }
+
+private:
+    friend class device;
+
+    void push(viu_usb_mock_transfer xfer)
+    {
+        requested_.push_back(xfer);
+        if (waiter_) {
+            std::exchange(waiter_, {}).resume();
+        }
+    }
+
+    std::deque<viu_usb_mock_transfer> requested_{};
+    std::coroutine_handle<> waiter_{};
+};
+
+// A control request and its data stage. IN replies are written to `data`,
+// OUT payloads are read from it. `result` goes back to the host, a length
+// or a libusb error, and starts out as what the host would answer itself.
+// Both are only valid until the task waits again.
+struct setup_request {
+    libusb_control_setup setup;
+    std::span<std::uint8_t> data;
+    int result;
+};
+
+class device {
+public:
+    device(const device&) = delete;
+    device(device&&) = delete;
+    auto operator=(const device&) -> device& = delete;
+    auto operator=(device&&) -> device& = delete;
+
+    void on_host(const viu_usb_mock_host* host)
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+        host_ = host;
+        ensure_started();
+    }
+
+    void on_transfer_requests(std::span<const viu_usb_mock_transfer> xfers)
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+        ensure_started();
+
+        for (const auto& xfer : xfers) {
+            ep(xfer.ops->ep(xfer)).push(xfer);
+        }
+    }
+
+    // Answered by the task waiting in control_setup(), by the host if
+    // there is none.
+    int on_control_setup(
+        libusb_control_setup setup,
+        std::uint8_t* data,
+        std::size_t data_size,
+        int result
+    )
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+        ensure_started();
+
+        if (!control_waiter_) {
+            return result;
+        }
+
+        auto request = setup_request{
+            .setup = setup,
+            .data = {data, data_size},
+            .result = result
+        };
+        setup_ = &request;
+        std::exchange(control_waiter_, {}).resume();
+        setup_ = nullptr;
+
+        return request.result;
+    }
+
+    int on_set_configuration([[maybe_unused]] std::uint8_t index)
+    {
+        return LIBUSB_SUCCESS;
+    }
+
+    int on_set_interface(
+        [[maybe_unused]] std::uint8_t interface,
+        [[maybe_unused]] std::uint8_t alt_setting
+    )
+    {
+        return LIBUSB_SUCCESS;
+    }
+
+    // Cancels the pending sleeps and destroys the tasks while the derived
+    // device they use is still alive.
+    void on_destroy()
+    {
+        auto timers = std::vector<viu_usb_mock_timer>{};
+        {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+            stopped_ = true;
+            for (const auto* s : sleeping_) {
+                timers.push_back(s->timer_);
+            }
+            sleeping_.clear();
+        }
+
+        for (const auto timer : timers) {
+            host_->cancel(timer);
+        }
+
+        for (const auto t : std::exchange(tasks_, {})) {
+            t.destroy();
+        }
+    }
+
+protected:
+    class sleep_awaiter {
+    public:
+        sleep_awaiter(device& dev, clock::time_point deadline) noexcept
+            : dev_{dev}, deadline_{deadline}
+        {
+        }
+
+        [[nodiscard]] auto await_ready() const noexcept -> bool
+        {
+            return deadline_ <= clock::now();
+        }
+
+        void await_suspend(std::coroutine_handle<> waiter)
+        {
+            waiter_ = waiter;
+            dev_.sleep(*this);
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        friend class device;
+
+        static void wake(void* ctx)
+        {
+            auto* const self = static_cast<sleep_awaiter*>(ctx);
+            self->dev_.wake(*self);
+        }
+
+        device& dev_;
+        clock::time_point deadline_;
+        std::coroutine_handle<> waiter_{};
+        viu_usb_mock_timer timer_{};
+    };
+
+    class control_awaiter {
+    public:
+        explicit control_awaiter(device& dev) noexcept : dev_{dev} {}
+
+        [[nodiscard]] auto await_ready() const noexcept -> bool
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> waiter) noexcept
+        {
+            dev_.control_waiter_ = waiter;
+        }
+
+        auto await_resume() const noexcept -> setup_request&
+        {
+            return *dev_.setup_;
+        }
+
+    private:
+        device& dev_;
+    };
+
+    device() = default;
+
+    virtual ~device() { on_destroy(); }
+
+    // Spawns the device's tasks. Called once, with the first callback of
+    // the host, which is on_host() from revision 5 on.
+    virtual void start() = 0;
+
+    // Starts a task right away, from start() or from another task.
+    void spawn(task t)
+    {
+        std::erase_if(tasks_, [](const std::coroutine_handle<> h) {
+            if (h.done()) {
+                h.destroy();
+                return true;
+            }
+            return false;
+        });
+
+        const auto handle = t.release();
+        tasks_.push_back(handle);
+        handle.resume();
+    }
+
+    [[nodiscard]] auto ep(std::uint8_t address) noexcept -> endpoint&
+    {
+        return endpoints_[VIU_USB_MOCK_ENDPOINT_SLOT(address)];
+    }
+
+    // Sleeps need the timers of a revision 5 host, on older ones the task
+    // is not resumed.
+    [[nodiscard]] auto sleep_until(clock::time_point deadline) noexcept
+        -> sleep_awaiter
+    {
+        return sleep_awaiter{*this, deadline};
+    }
+
+    [[nodiscard]] auto sleep_for(clock::duration duration) noexcept
+        -> sleep_awaiter
+    {
+        return sleep_awaiter{*this, clock::now() + duration};
+    }
+
+    // The next control request, one task at a time waits for them.
+    [[nodiscard]] auto control_setup() noexcept -> control_awaiter
+    {
+        return control_awaiter{*this};
+    }
+
+private:
+    void ensure_started()
+    {
+        if (!started_) {
+            started_ = true;
+            start();
+        }
+    }
+
+    // Called with the device locked, from the task that goes to sleep. The
+    // timer may fire before schedule() returns, wake() waits for the lock.
+    void sleep(sleep_awaiter& s)
+    {
+        if (host_ == nullptr) {
+            return;
+        }
+
+        const auto deadline = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(s.deadline_.time_since_epoch());
+        s.timer_ = host_->schedule(
+            static_cast<std::uint64_t>(deadline.count()),
+            &sleep_awaiter::wake,
+            &s
+        );
+        sleeping_.push_back(&s);
+    }
+
+    void wake(sleep_awaiter& s)
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+        if (stopped_) {
+            return;
+        }
+
+        std::erase(sleeping_, &s);
+        s.waiter_.resume();
+    }
+
+    std::mutex mutex_{};
+    const viu_usb_mock_host* host_{};
+    bool started_{false};
+    bool stopped_{false};
+    std::vector<std::coroutine_handle<>> tasks_{};
+    std::array<endpoint, VIU_USB_MOCK_ENDPOINT_SLOTS> endpoints_{};
+    std::vector<sleep_awaiter*> sleeping_{};
+    std::coroutine_handle<> control_waiter_{};
+    setup_request* setup_{};
+};
+
+} // namespace viu::coro
+
+#endif /* VIU_USB_MOCK_CORO_HPP */
@@ -4,6 +4,7 @@
 #include <libusb.h>
 
 #include "usb_mock_abi.hpp"
+#include "usb_mock_coro.hpp"
 
 import std;
 
@@ -71,6 +72,175 @@ static_assert(!std::copyable<test_device_mock>);
 
 REGISTER_USB_MOCK(test_device_mock_plugin, test_device_mock)
 
+// Answers IN transfers with what the last OUT transfer to their endpoint
+// carried, reading and writing the transfer buffers in place. The mocks
+// below hand it their transfers through each shape of the request
+// callback. OUT lengths are left to the host, which takes them as read
+// whole.
+class echo_buffers {
+public:
+    void serve(viu_usb_mock_transfer_control_opaque& xfer)
+    {
+        auto size = std::size_t{0};
+        auto* const buffer = xfer.buffer(&xfer, &size);
+        const auto length =
+            serve(xfer.is_in(&xfer), xfer.ep(&xfer), {buffer, size});
+        if (xfer.is_in(&xfer)) {
+            xfer.set_actual_length(&xfer, length);
+        }
+    }
+
+    void serve(const viu_usb_mock_transfer xfer)
+    {
+        const auto* const ops = xfer.ops;
+        auto size = std::size_t{0};
+        auto* const buffer = ops->buffer(xfer, &size);
+        const auto length =
+            serve(ops->is_in(xfer), ops->ep(xfer), {buffer, size});
+        if (ops->is_in(xfer)) {
+            ops->set_actual_length(xfer, length);
+        }
+    }
+
+private:
+    auto serve(
+        const bool is_in,
+        const std::uint8_t ep,
+        const std::span<std::uint8_t> buffer
+    ) -> std::size_t
+    {
+        auto& data = data_[ep & 0x0f];
+        if (!is_in) {
+            data.assign(std::begin(buffer), std::end(buffer));
+            return std::size(buffer);
+        }
+
+        const auto length = std::min(std::size(buffer), std::size(data));
+        std::copy_n(std::begin(data), length, std::begin(buffer));
+        return length;
+    }
+
+    std::array<std::vector<std::uint8_t>, 16> data_{};
+};
+
+struct in_place_mock final : echo_buffers {
+    void on_transfer_request(viu_usb_mock_transfer_control_opaque xfer)
+    {
+        serve(xfer);
+        xfer.complete(&xfer);
+    }
+};
+
+REGISTER_USB_MOCK(in_place_mock_plugin, in_place_mock)
+
+struct ops_mock final : echo_buffers {
+    void on_transfer_request(viu_usb_mock_transfer xfer)
+    {
+        serve(xfer);
+        xfer.ops->complete(xfer);
+    }
+};
+
+REGISTER_USB_MOCK(ops_mock_plugin, ops_mock)
+
+struct batch_mock final : echo_buffers {
+    void on_transfer_requests(std::span<const viu_usb_mock_transfer> xfers)
+    {
+        batch_sizes.push_back(std::size(xfers));
+        for (const auto xfer : xfers) {
+            serve(xfer);
+        }
+
+        if (!xfers.empty()) {
+            xfers.front().ops->complete_many(xfers.data(), std::size(xfers));
+        }
+    }
+
+    std::vector<std::size_t> batch_sizes{};
+};
+
+REGISTER_USB_MOCK(batch_mock_plugin, batch_mock)
+
+// Holds on to its transfers until a test completes them.
+struct held_mock final {
+    void on_transfer_requests(std::span<const viu_usb_mock_transfer> xfers)
+    {
+        held.insert(std::end(held), std::begin(xfers), std::end(xfers));
+    }
+
+    std::vector<viu_usb_mock_transfer> held{};
+};
+
+REGISTER_USB_MOCK(held_mock_plugin, held_mock)
+
+// Claims more data than the buffers it is given hold.
+struct overlong_mock final {
+    void on_transfer_request(viu_usb_mock_transfer_control_opaque xfer)
+    {
+        auto size = std::size_t{0};
+        std::ignore = xfer.buffer(&xfer, &size);
+        xfer.set_actual_length(&xfer, size * 2);
+        xfer.complete(&xfer);
+    }
+};
+
+REGISTER_USB_MOCK(overlong_mock_plugin, overlong_mock)
+
+struct endpoint_mock final {
+    static constexpr auto report = std::array<std::uint8_t, 4>{1, 2, 3, 4};
+
+    void on_ep_0x81(viu_usb_mock_transfer xfer)
+    {
+        xfer.ops->fill(xfer, report.data(), std::size(report));
+        xfer.ops->complete(xfer);
+    }
+
+    void on_output(viu_usb_mock_transfer xfer) { xfer.ops->complete(xfer); }
+
+    static constexpr auto endpoints = std::array{
+        viu::endpoint<endpoint_mock>{0x02, &endpoint_mock::on_output}
+    };
+};
+
+REGISTER_USB_MOCK(endpoint_mock_plugin, endpoint_mock)
+
+struct coro_mock final : viu::coro::device {
+    static constexpr auto delay = std::chrono::milliseconds{5};
+
+    void start() override
+    {
+        spawn(count_reports());
+        spawn(delayed_reports());
+        spawn(failing());
+    }
+
+    auto count_reports() -> viu::coro::task
+    {
+        for (auto n = std::uint8_t{1};; ++n) {
+            const auto xfer = co_await ep(0x81).next();
+            xfer.fill(std::array{n});
+            xfer.complete();
+        }
+    }
+
+    auto delayed_reports() -> viu::coro::task
+    {
+        while (true) {
+            const auto xfer = co_await ep(0x82).next();
+            co_await sleep_for(delay);
+            xfer.complete();
+        }
+    }
+
+    auto failing() -> viu::coro::task
+    {
+        co_await ep(0x83).next();
+        throw std::runtime_error{"failing task"};
+    }
+};
+
+REGISTER_USB_MOCK(coro_mock_plugin, coro_mock)
+
 struct host final {
     host()
     {
@@ -276,7 +446,45 @@ private:
     std::jthread t_{};
 };
 
-class usb_mock_test : public testing::Test {};
+class usb_mock_test : public testing::Test {
+protected:
+    // Writes `data` to endpoint 1 and returns what 0x81 answers.
+    static auto echo(usb::mock& usb_dev, const usb::transfer::buffer_type& data)
+        -> usb::transfer::buffer_type
+    {
+        auto written = std::optional<std::size_t>{};
+        auto answer = usb::transfer::buffer_type{};
+
+        usb_dev.submit_interrupt_transfer(
+            usb::transfer::info{
+                .ep_address = 0x01,
+                .buffer = data,
+                .callback =
+                    [&written](const usb::transfer::pointer& transfer) {
+                        written = usb::transfer::actual_length(transfer);
+                    }
+            }
+        );
+        EXPECT_EQ(written, std::size(data));
+
+        usb_dev.submit_interrupt_transfer(
+            usb::transfer::info{
+                .ep_address = 0x81,
+                .buffer = usb::transfer::buffer_type(std::size(data)),
+                .callback =
+                    [&answer](const usb::transfer::pointer& transfer) {
+                        answer = viu::format::unsafe::vectorize(
+                            transfer->buffer,
+                            usb::transfer::actual_length(transfer)
+                        );
+                    }
+            }
+        );
+
+        usb_dev.cancel_transfers();
+        return answer;
+    }
+};
 
 TEST_F(usb_mock_test, 3s_transfer)
 {
@@ -288,4 +496,334 @@ TEST_F(usb_mock_test, 3s_transfer)
     std::this_thread::sleep_for(3s);
 }
 
+// The same echo through the revision 1 control, the revision 2 ops table
+// and batches.
+TEST_F(usb_mock_test, in_place_buffers)
+{
+    const auto data = usb::transfer::buffer_type{5, 6, 7, 8};
+
+    for (const auto create : {
+             &in_place_mock_plugin_create,
+             &ops_mock_plugin_create,
+             &batch_mock_plugin_create
+         }) {
+        auto usb_dev = usb::mock{usb::descriptor::tree{}, create()};
+        EXPECT_EQ(echo(usb_dev, data), data);
+    }
+}
+
+TEST_F(usb_mock_test, batched_requests)
+{
+    auto* const plugin = batch_mock_plugin_create();
+    const auto& mock = *static_cast<batch_mock*>(plugin->ctx);
+    auto usb_dev = usb::mock{usb::descriptor::tree{}, plugin};
+
+    auto answer = usb::transfer::buffer_type{};
+    usb_dev.begin_transfer_batch();
+    usb_dev.submit_interrupt_transfer(
+        usb::transfer::info{
+            .ep_address = 0x01,
+            .buffer = usb::transfer::buffer_type{14},
+            .callback = [](const usb::transfer::pointer&) {}
+        }
+    );
+    usb_dev.submit_interrupt_transfer(
+        usb::transfer::info{
+            .ep_address = 0x81,
+            .buffer = usb::transfer::buffer_type(1),
+            .callback =
+                [&answer](const usb::transfer::pointer& transfer) {
+                    answer = viu::format::unsafe::vectorize(
+                        transfer->buffer,
+                        usb::transfer::actual_length(transfer)
+                    );
+                }
+        }
+    );
+    EXPECT_TRUE(answer.empty());
+    usb_dev.end_transfer_batch();
+
+    EXPECT_EQ(answer, usb::transfer::buffer_type{14});
+    EXPECT_EQ(mock.batch_sizes, (std::vector<std::size_t>{2}));
+
+    usb_dev.cancel_transfers();
+}
+
+TEST_F(usb_mock_test, completes_many_across_devices)
+{
+    auto* const first_plugin = held_mock_plugin_create();
+    auto* const second_plugin = held_mock_plugin_create();
+    auto& first = *static_cast<held_mock*>(first_plugin->ctx);
+    auto& second = *static_cast<held_mock*>(second_plugin->ctx);
+    auto first_dev = usb::mock{usb::descriptor::tree{}, first_plugin};
+    auto second_dev = usb::mock{usb::descriptor::tree{}, second_plugin};
+
+    using completion = std::pair<char, std::size_t>;
+    auto completed = std::vector<completion>{};
+    const auto submit = [&completed](usb::mock& usb_dev, const char tag) {
+        usb_dev.submit_interrupt_transfer(
+            usb::transfer::info{
+                .ep_address = 0x01,
+                .buffer = usb::transfer::buffer_type{1, 2, 3},
+                .callback =
+                    [&completed, tag](const usb::transfer::pointer& transfer) {
+                        completed.emplace_back(
+                            tag,
+                            usb::transfer::actual_length(transfer)
+                        );
+                    }
+            }
+        );
+    };
+    submit(first_dev, 'a');
+    submit(first_dev, 'b');
+    submit(second_dev, 'c');
+    ASSERT_EQ(std::size(first.held), 2U);
+    ASSERT_EQ(std::size(second.held), 1U);
+
+    const auto xfers = std::array{first.held[0], second.held[0], first.held[1]};
+    xfers.front().ops->complete_many(xfers.data(), std::size(xfers));
+
+    EXPECT_EQ(
+        completed,
+        (std::vector<completion>{{'a', 3}, {'c', 3}, {'b', 3}})
+    );
+
+    first_dev.cancel_transfers();
+    second_dev.cancel_transfers();
+}
+
+TEST_F(usb_mock_test, clamps_actual_length)
+{
+    auto usb_dev = usb::mock{
+        usb::descriptor::tree{},
+        overlong_mock_plugin_create()
+    };
+    auto actual_length = std::optional<std::size_t>{};
+
+    usb_dev.submit_interrupt_transfer(
+        usb::transfer::info{
+            .ep_address = 0x81,
+            .buffer = usb::transfer::buffer_type(8),
+            .callback =
+                [&actual_length](const usb::transfer::pointer& transfer) {
+                    actual_length = usb::transfer::actual_length(transfer);
+                }
+        }
+    );
+
+    EXPECT_EQ(actual_length, 8);
+
+    usb_dev.cancel_transfers();
+}
+
+TEST_F(usb_mock_test, routes_by_endpoint)
+{
+    auto usb_dev = usb::mock{
+        usb::descriptor::tree{},
+        endpoint_mock_plugin_create()
+    };
+    auto completed = std::map<std::uint8_t, usb::transfer::buffer_type>{};
+    auto statuses = std::map<std::uint8_t, int>{};
+
+    for (const auto ep : {0x81, 0x02, 0x83}) {
+        usb_dev.submit_interrupt_transfer(
+            usb::transfer::info{
+                .ep_address = static_cast<std::uint8_t>(ep),
+                .buffer = usb::transfer::buffer_type(8),
+                .callback =
+                    [&completed, &statuses, ep](
+                        const usb::transfer::pointer& transfer
+                    ) {
+                        statuses[ep] = transfer->status;
+                        completed[ep] = viu::format::unsafe::vectorize(
+                            transfer->buffer,
+                            usb::transfer::actual_length(transfer)
+                        );
+                    }
+            }
+        );
+    }
+
+    ASSERT_EQ(std::size(completed), 3);
+    EXPECT_EQ(
+        completed[0x81],
+        usb::transfer::buffer_type(
+            std::begin(endpoint_mock::report),
+            std::end(endpoint_mock::report)
+        )
+    );
+    EXPECT_EQ(statuses[0x81], LIBUSB_TRANSFER_COMPLETED);
+    EXPECT_EQ(statuses[0x02], LIBUSB_TRANSFER_COMPLETED);
+    EXPECT_EQ(statuses[0x83], LIBUSB_TRANSFER_STALL);
+
+    usb_dev.cancel_transfers();
+}
+
+// A stall has to reach the host through the proxy, in both directions.
+TEST_F(usb_mock_test, stall_reaches_host)
+{
+    using namespace std::chrono_literals;
+
+    auto tree = usb::descriptor::tree{};
+    tree.load("test_device_config.json");
+
+    // Only 0x81 and 0x02 are served, the bulk endpoints stall.
+    auto virtual_device =
+        viu::device::mock{tree, endpoint_mock_plugin_create()};
+    ASSERT_TRUE(virtual_device.wait_configured(5s));
+
+    auto usb_dev = usb::device{0x0000, 0x0001};
+    auto statuses = std::map<std::uint8_t, int>{};
+
+    for (const auto ep : {0x83, 0x03}) {
+        usb_dev.submit_bulk_transfer(
+            usb::transfer::info{
+                .ep_address = static_cast<std::uint8_t>(ep),
+                .buffer = usb::transfer::buffer_type(8),
+                .callback =
+                    [&statuses, ep](const usb::transfer::pointer& transfer) {
+                        statuses[ep] = transfer->status;
+                    }
+            }
+        );
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (std::size(statuses) < 2 &&
+           std::chrono::steady_clock::now() < deadline) {
+        auto completed = int{0};
+        ASSERT_EQ(usb_dev.handle_events(100ms, &completed), LIBUSB_SUCCESS);
+    }
+
+    EXPECT_EQ(statuses[0x83], LIBUSB_TRANSFER_STALL);
+    EXPECT_EQ(statuses[0x03], LIBUSB_TRANSFER_STALL);
+}
+
+TEST_F(usb_mock_test, paces_interrupt_in)
+{
+    using namespace std::chrono_literals;
+
+    auto tree = usb::descriptor::tree{};
+    tree.load("test_device_config.json");
+
+    // 0x81 is an interrupt endpoint with bInterval 10 on a SuperSpeed
+    // device, serviced every 2^9 microframes. 0x82 is isochronous with
+    // bInterval 1, each of its packets takes a microframe.
+    constexpr auto period = std::chrono::microseconds{125 << 9};
+    constexpr auto microframe = std::chrono::microseconds{125};
+    constexpr auto packets = 64;
+    constexpr auto count = 3;
+
+    auto usb_dev = usb::mock{std::move(tree), endpoint_mock_plugin_create()};
+
+    // Time it takes `count` transfers like `xfer` to complete.
+    const auto time_of = [&usb_dev](auto submit, usb::transfer::info xfer) {
+        auto done = std::latch{count};
+        xfer.callback = [&done](const usb::transfer::pointer&) {
+            done.count_down();
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+        for (auto n = 0; n < count; ++n) {
+            (usb_dev.*submit)(xfer);
+        }
+
+        done.wait();
+        return std::chrono::steady_clock::now() - start;
+    };
+
+    EXPECT_GE(
+        time_of(
+            &usb::mock::submit_interrupt_transfer,
+            usb::transfer::info{
+                .ep_address = 0x81,
+                .buffer = usb::transfer::buffer_type(8)
+            }
+        ),
+        (count - 1) * period
+    );
+
+    EXPECT_GE(
+        time_of(
+            &usb::mock::submit_iso_transfer,
+            usb::transfer::info{
+                .ep_address = 0x82,
+                .buffer = usb::transfer::buffer_type(packets * 8),
+                .iso = usb::transfer::iso{.packet_count = packets}
+            }
+        ),
+        (count - 1) * packets * microframe
+    );
+
+    usb_dev.cancel_transfers();
+}
+
+TEST_F(usb_mock_test, coroutine_device)
+{
+    auto usb_dev = usb::mock{
+        usb::descriptor::tree{},
+        coro_mock_plugin_create()
+    };
+    auto reports = std::vector<std::uint8_t>{};
+
+    for (auto n = 0; n < 3; ++n) {
+        usb_dev.submit_interrupt_transfer(
+            usb::transfer::info{
+                .ep_address = 0x81,
+                .buffer = usb::transfer::buffer_type(1),
+                .callback =
+                    [&reports](const usb::transfer::pointer& transfer) {
+                        reports.push_back(transfer->buffer[0]);
+                    }
+            }
+        );
+    }
+
+    EXPECT_EQ(reports, (std::vector<std::uint8_t>{1, 2, 3}));
+
+    auto completed = std::promise<std::chrono::steady_clock::time_point>{};
+    const auto start = std::chrono::steady_clock::now();
+    usb_dev.submit_interrupt_transfer(
+        usb::transfer::info{
+            .ep_address = 0x82,
+            .buffer = usb::transfer::buffer_type(1),
+            .callback =
+                [&completed](const usb::transfer::pointer&) {
+                    completed.set_value(std::chrono::steady_clock::now());
+                }
+        }
+    );
+
+    EXPECT_GE(completed.get_future().get() - start, coro_mock::delay);
+
+    usb_dev.cancel_transfers();
+}
+
+TEST_F(usb_mock_test, coroutine_task_throws)
+{
+    auto usb_dev = usb::mock{
+        usb::descriptor::tree{},
+        coro_mock_plugin_create()
+    };
+    auto reports = std::vector<std::uint8_t>{};
+
+    for (const auto ep : {0x83, 0x81}) {
+        usb_dev.submit_interrupt_transfer(
+            usb::transfer::info{
+                .ep_address = static_cast<std::uint8_t>(ep),
+                .buffer = usb::transfer::buffer_type(1),
+                .callback =
+                    [&reports](const usb::transfer::pointer& transfer) {
+                        reports.push_back(transfer->buffer[0]);
+                    }
+            }
+        );
+    }
+
+    EXPECT_EQ(reports, (std::vector<std::uint8_t>{1}));
+
+    usb_dev.cancel_transfers();
+}
+
 } // namespace viu::test
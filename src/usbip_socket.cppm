@@ -21,6 +21,12 @@ export struct socket final {
     void write(boost::asio::streambuf& write_buffer, std::size_t length);
     void close();
 
+    // Wakes up readers and writers without closing the descriptors.
+    void shutdown();
+
+    // Closes both ends and connects a new pair.
+    void reconnect();
+
 private:
     boost::asio::io_context io_context_;
 
@@ -32,7 +38,6 @@ private:
 
     auto host_socket() -> socket_type& { return sockets_.at(1); }
     auto client_socket() -> socket_type& { return sockets_.at(0); }
-    void shutdown();
 };
 
 static_assert(!std::copyable<socket>);
@@ -39,9 +39,29 @@ void socket::write(
     viu::_assert(bytes_sent == length);
 }
 
-// TODO: Fix close data race with socket ops
-void socket::close() { shutdown(); }
+void socket::close()
+{
+    shutdown();
+
+    for (auto& s : sockets_) {
+        if (!s.is_open()) {
+            continue;
+        }
 
+        boost::system::error_code ec;
+        s.close(ec);
+        viu::_assert(ec == boost::system::errc::success);
+    }
+}
+
+void socket::reconnect()
+{
+    close();
+    boost::asio::local::connect_pair(client_socket(), host_socket());
+}
+
+// The descriptors stay open, a blocked read or write returns with an error
+// instead of using a descriptor that may already be reused.
 void socket::shutdown()
 {
     for (auto& s : sockets_) {
@@ -49,10 +69,8 @@ void socket::shutdown()
             continue;
         }
 
+        // ENOTCONN once the peer or an earlier call shut it down.
         boost::system::error_code ec;
         s.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-        viu::_assert(ec == boost::system::errc::success);
-        s.close(ec);
-        viu::_assert(ec == boost::system::errc::success);
     }
 }
@@ -0,0 +1,31 @@
+#ifndef VIU_USDT_H
+#define VIU_USDT_H
+
+// USDT probes of the `viu` provider, e.g.
+//   bpftrace -e 'usdt:/usr/bin/viud:viu:transfer_completed { ... }'
+// A probe is a single nop until a tracer attaches. Builds without
+// sys/sdt.h, or configured with -DVIU_USDT=OFF, drop them entirely.
+//
+// command_parsed       seqnum, command, ep, direction, length
+// unlink_received      seqnum, unlinked seqnum
+// reply_written        seqnum, ep, bytes written
+// transfer_submitted   libusb_transfer*, ep address, length, type
+// transfer_completed   libusb_transfer*, ep address, status, actual length
+// transfer_pending     libusb_transfer*, transfers pending
+// transfer_dispatched  libusb_transfer*, status
+
+#if defined(VIU_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+
+#define VIU_PROBE2(name, a, b) STAP_PROBE2(viu, name, a, b)
+#define VIU_PROBE3(name, a, b, c) STAP_PROBE3(viu, name, a, b, c)
+#define VIU_PROBE4(name, a, b, c, d) STAP_PROBE4(viu, name, a, b, c, d)
+#define VIU_PROBE5(name, a, b, c, d, e) STAP_PROBE5(viu, name, a, b, c, d, e)
+#else
+#define VIU_PROBE2(name, a, b) ((void)0)
+#define VIU_PROBE3(name, a, b, c) ((void)0)
+#define VIU_PROBE4(name, a, b, c, d) ((void)0)
+#define VIU_PROBE5(name, a, b, c, d, e) ((void)0)
+#endif
+
+#endif // VIU_USDT_H
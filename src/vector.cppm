@@ -18,7 +18,7 @@ struct plugin;
 export template <>
 struct plugin<empty_list, empty_list> {
     template <typename U>
-    void fill(const std::string_view& key, const std::vector<U>& in)
+    void fill(const std::string_view& key, std::vector<U> in)
     {
         static_assert(false, "Cannot fill empty vector plugin");
     }
@@ -27,6 +27,11 @@ struct plugin<empty_list, empty_list> {
     {
         static_assert(false, "Cannot read from empty vector plugin");
     }
+    template <typename U>
+    auto view(const std::string_view& key) const -> std::span<const U>
+    {
+        static_assert(false, "Cannot view empty vector plugin");
+    }
     void for_each([[maybe_unused]] const auto& visitor) {}
     void for_each([[maybe_unused]] const auto& visitor) const {}
 };
@@ -36,7 +41,7 @@ enum class flow_control : std::uint8_t { break_, continue_, loop };
 template <typename T>
 struct member_entry {
     member_entry(const std::string_view& key) : key_{key} {}
-    auto key() const { return key_; }
+    auto key() const noexcept -> std::string_view { return key_; }
     auto vec() noexcept -> auto& { return vector_; }
     auto vec() const noexcept -> const auto& { return vector_; }
 
@@ -98,7 +103,7 @@ public:
     }
 
     template <typename U>
-    void fill(const std::string_view& key, const std::vector<U>& in)
+    void fill(const std::string_view& key, std::vector<U> in)
     {
         const auto predicate = [&key](const auto& entry) -> auto {
             return entry.key() == key;
@@ -109,7 +114,7 @@ public:
                 decltype(entry.vec())>::value_type;
             if constexpr (std::is_same_v<U, value_type>) {
                 if (predicate(entry)) {
-                    entry.vec() = in;
+                    entry.vec() = std::move(in);
                     return flow_control::break_;
                 }
             }
@@ -155,6 +160,36 @@ public:
         }
     }
 
+    template <typename U>
+    [[nodiscard]] auto view(const std::string_view& key) const
+        -> std::span<const U>
+    {
+        auto result = std::span<const U>{};
+
+        const auto view_visitor = [&key, &result](const auto& entry) -> auto {
+            using value_type = typename std::remove_cvref_t<
+                decltype(entry.vec())>::value_type;
+            if constexpr (std::is_same_v<U, value_type>) {
+                if (entry.key() == key) {
+                    result = entry.vec();
+                    return flow_control::break_;
+                }
+            }
+
+            return flow_control::loop;
+        };
+
+        for (const auto& elem : vector_) {
+            const auto flow_ctrl = std::visit(view_visitor, elem);
+
+            if (flow_ctrl == flow_control::break_) {
+                break;
+            }
+        }
+
+        return result;
+    }
+
     void for_each(const auto& visitor)
     {
         for (auto& elem : vector_) {
@@ -124,4 +124,33 @@ TEST_F(vector_test, for_each)
     }(keys{}, types{});
 }
 
+TEST_F(vector_test, view)
+{
+    using keys = viu::vector::key_list<key::u8, key::u16, key::int_>;
+    using types = viu::vector::type_list<std::uint8_t, std::uint16_t, int>;
+
+    const auto vector_plugin = viu::vector::plugin<keys, types>{
+        std::vector<std::uint8_t>{0, 1, 2},
+        std::vector<std::uint16_t>{3, 4},
+        std::vector<int>{5}
+    };
+
+    const auto u8_view = vector_plugin.view<std::uint8_t>(key::u8);
+    const auto u16_view = vector_plugin.view<std::uint16_t>(key::u16);
+    const auto int_view = vector_plugin.view<int>(key::int_);
+
+    EXPECT_THAT(u8_view, ::testing::ElementsAre(0, 1, 2));
+    EXPECT_THAT(u16_view, ::testing::ElementsAre(3, 4));
+    EXPECT_THAT(int_view, ::testing::ElementsAre(5));
+
+    EXPECT_EQ(vector_plugin.view<std::uint8_t>(key::u8).data(), u8_view.data());
+
+    auto read_back_vec = std::vector<std::uint8_t>{};
+    vector_plugin.read(key::u8, read_back_vec);
+    EXPECT_TRUE(std::ranges::equal(read_back_vec, u8_view));
+
+    EXPECT_TRUE(vector_plugin.view<int>(key::u8).empty());
+    EXPECT_TRUE(vector_plugin.view<long>(key::int_).empty());
+}
+
 } // namespace viu::test
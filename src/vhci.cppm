@@ -136,6 +136,19 @@ export struct command {
         return payload_size;
     }
 
+    // Not part of the wire format: the usbip connection the command was
+    // received on, replies for a connection that is gone are dropped.
+    [[nodiscard]] auto link() const noexcept { return link_; }
+    void set_link(const std::uint64_t link) noexcept { link_ = link; }
+
+    // Not part of the wire format either: when the request was read from
+    // the usbip socket, carried over to its reply.
+    [[nodiscard]] auto received() const noexcept { return received_; }
+    void set_received(const std::chrono::steady_clock::time_point t) noexcept
+    {
+        received_ = t;
+    }
+
     [[nodiscard]] auto ep() const noexcept { return header().base.ep; }
     [[nodiscard]] auto seqnum() const noexcept { return header().base.seqnum; }
     [[nodiscard]] auto devid() const noexcept { return header().base.devid; }
@@ -173,6 +186,8 @@ private:
 
     usbip_header header_{};
     payload_type payload_{};
+    std::uint64_t link_{};
+    std::chrono::steady_clock::time_point received_{};
 };
 
 } // namespace viu::usbip
@@ -195,7 +210,7 @@ enum usbip_device_status {
 };
 
 // https://github.com/torvalds/linux/blob/master/include/uapi/linux/usb/ch9.h
-enum class usb_device_speed : std::uint8_t {
+export enum class usb_device_speed : std::uint8_t {
     USB_SPEED_UNKNOWN = 0, /* enumerating */
     USB_SPEED_LOW,
     USB_SPEED_FULL,       /* usb 1.1 */
@@ -213,16 +228,164 @@ enum class hub_speed : std::uint8_t {
     HUB_SPEED_SUPER,
 };
 
+using port_type = std::uint16_t;
+
 struct virtual_device {
     hub_speed hub;
-    std::uint8_t port;
+    port_type port;
     std::uint32_t status;
+    std::uint32_t speed;
     std::uint32_t devid;
     std::uint8_t busnum;
     std::uint8_t devnum;
+    bool reserved;
+};
+
+export enum class error : std::uint8_t { no_free_port, unavailable };
+
+export [[nodiscard]] constexpr auto speed_name(const ::usb_device_speed speed)
+    -> std::string_view
+{
+    switch (speed) {
+        case ::usb_device_speed::USB_SPEED_LOW:
+            return "low-speed";
+        case ::usb_device_speed::USB_SPEED_FULL:
+            return "full-speed";
+        case ::usb_device_speed::USB_SPEED_HIGH:
+            return "high-speed";
+        case ::usb_device_speed::USB_SPEED_WIRELESS:
+            return "wireless";
+        case ::usb_device_speed::USB_SPEED_SUPER:
+            return "super-speed";
+        case ::usb_device_speed::USB_SPEED_SUPER_PLUS:
+            return "super-speed-plus";
+        case ::usb_device_speed::USB_SPEED_UNKNOWN:
+            break;
+    }
+
+    return "unknown";
+}
+
+export struct port_utilization {
+    std::size_t controllers{};
+    std::size_t high_speed_ports{};
+    std::size_t high_speed_used{};
+    std::size_t super_speed_ports{};
+    std::size_t super_speed_used{};
+    std::size_t reserved{};
 };
 
-enum class error : std::uint8_t { no_free_port };
+// Daemon-wide owner of the vhci_hcd ports. The port table is parsed from
+// sysfs once and then kept up to date from uevents of usb devices on the
+// vhci root hubs; ports handed out as leases stay reserved until released.
+// Ports are numbered across all vhci_hcd.N controllers, reservations are
+// spread over the controllers so that their root hubs enumerate in
+// parallel.
+export class port_manager {
+public:
+    class lease {
+    public:
+        lease() = default;
+        lease(const lease&) = delete;
+        lease(lease&& other) noexcept;
+        auto operator=(const lease&) -> lease& = delete;
+        auto operator=(lease&& other) noexcept -> lease&;
+        ~lease();
+
+        [[nodiscard]] auto port() const noexcept { return port_; }
+
+        [[nodiscard]] explicit operator bool() const noexcept
+        {
+            return manager_ != nullptr;
+        }
+
+    private:
+        friend class port_manager;
+
+        lease(port_manager& manager, port_type port) noexcept;
+        void release() noexcept;
+
+        port_manager* manager_{};
+        port_type port_{};
+    };
+
+    port_manager(const port_manager&) = delete;
+    port_manager(port_manager&&) = delete;
+    auto operator=(const port_manager&) -> port_manager& = delete;
+    auto operator=(port_manager&&) -> port_manager& = delete;
+    ~port_manager() = default;
+
+    [[nodiscard]] static auto instance() -> port_manager&;
+
+    [[nodiscard]] auto is_available() -> bool;
+    [[nodiscard]] auto reserve(::usb_device_speed speed)
+        -> std::expected<lease, vhci::error>;
+
+    // All or nothing.
+    [[nodiscard]] auto reserve(::usb_device_speed speed, std::size_t count)
+        -> std::expected<std::vector<lease>, vhci::error>;
+
+    // Returns 0 or the errno reported by the vhci attach attribute.
+    [[nodiscard]] auto attach(
+        const lease& port_lease,
+        int sockfd,
+        std::uint32_t devid,
+        std::uint32_t speed
+    ) -> int;
+
+    // Returns 0 or the errno reported by the vhci detach attribute.
+    [[nodiscard]] auto detach(const lease& port_lease) -> int;
+
+    void mark_used(port_type port);
+    void refresh();
+
+    // True when the vhci SuperSpeed root hubs run at 10 Gbps or faster,
+    // i.e. the driver accepts USB_SPEED_SUPER_PLUS attach requests.
+    [[nodiscard]] auto supports_super_plus() -> bool;
+
+    // The fastest speed not above `speed` that vhci can attach at.
+    [[nodiscard]] auto clamp(::usb_device_speed speed) -> ::usb_device_speed;
+
+    // Speed of the device on the port as reported by the vhci status.
+    [[nodiscard]] auto speed_of(port_type port) const
+        -> std::optional<::usb_device_speed>;
+
+    [[nodiscard]] auto utilization() const -> port_utilization;
+
+private:
+    port_manager() = default;
+
+    using device_deleter_type = std::function<void(sd_device*)>;
+    using device_pointer = std::unique_ptr<sd_device, device_deleter_type>;
+
+    [[nodiscard]] static auto make_device() -> device_pointer;
+    [[nodiscard]] static auto get_number_of_ports(sd_device* device)
+        -> std::size_t;
+    [[nodiscard]] static auto count_controllers(sd_device* device)
+        -> std::size_t;
+    [[nodiscard]] static auto probe_super_plus(
+        const std::filesystem::path& syspath
+    ) -> bool;
+
+    [[nodiscard]] auto open_locked() -> bool;
+    [[nodiscard]] auto refresh_locked() -> bool;
+    void parse_status_locked(const std::string& status);
+    [[nodiscard]] auto controller_of(port_type port) const noexcept
+        -> std::size_t;
+    [[nodiscard]] auto find_free_port_locked(hub_speed hub) const
+        -> std::optional<port_type>;
+    [[nodiscard]] auto reserve_locked(hub_speed hub)
+        -> std::expected<lease, vhci::error>;
+    void release(port_type port) noexcept;
+    void monitor(const std::stop_token& stoken);
+
+    mutable std::mutex mutex_{};
+    std::filesystem::path syspath_{};
+    std::size_t number_of_controllers_{};
+    bool super_plus_{};
+    std::vector<virtual_device> devices_{};
+    std::jthread monitor_thread_{};
+};
 
 export class driver {
 public:
@@ -233,9 +396,31 @@ public:
     auto operator=(driver&&) -> driver& = delete;
 
     void attach(std::uint32_t speed, std::uint8_t device_id);
+
+    // Attaches to a port reserved up front, e.g. as part of a batch.
+    void attach(
+        std::uint32_t speed,
+        std::uint8_t device_id,
+        port_manager::lease port_lease
+    );
+
+    // Disconnects the device from its port and gives the port back. The
+    // socket is left alone, see reconnect().
+    void detach();
+
+    // Replaces the usbip socket pair, callers must make sure nobody is
+    // reading or writing at the same time.
+    void reconnect();
+
     void read(boost::asio::streambuf& buffer, std::size_t size);
     void write(boost::asio::streambuf& buffer, std::size_t size);
+    // Shuts the socket down so that blocked reads and writes return, it
+    // is closed by reconnect() or the destructor.
     void request_stop();
+
+    // Speed the device was attached at, empty while detached.
+    [[nodiscard]] auto link_speed() const -> std::optional<::usb_device_speed>;
+
     [[nodiscard]] static auto to_speed_enum(const std::uint16_t bcd_version)
         -> ::usb_device_speed
     {
@@ -260,40 +445,18 @@ public:
     }
 
 private:
-    using device_deleter_type = std::function<void(sd_device*)>;
-    using device_pointer = std::unique_ptr<sd_device, device_deleter_type>;
-
-    void write_sysfs_attribute(
-        const std::string& attr_path,
-        const std::string& attribute_value
-    ) const;
-    [[nodiscard]] auto get_number_of_ports(
-        sd_device* host_controller_device
-    ) const;
-    [[nodiscard]] auto count_controllers() const;
-    [[nodiscard]] auto parse_status(const char* value);
-    [[nodiscard]] auto refresh_status();
-    [[nodiscard]] auto open();
-    [[nodiscard]] auto get_free_port(usb_device_speed speed) const
-        -> std::expected<std::uint8_t, vhci::error>;
-    [[nodiscard]] auto attach_device(
-        std::uint8_t port,
-        int sockfd,
-        std::uint32_t devid,
-        std::uint32_t speed
-    ) const;
-    [[nodiscard]] auto make_device() const;
-    [[nodiscard]] auto underlying_device() const noexcept
-    {
-        return host_controller_device_.get();
-    }
-
-    device_pointer host_controller_device_{};
-    int number_of_controllers_{};
-    std::vector<virtual_device> devices_{};
+    // Guards the port and speed, link_speed() is read by daemon command
+    // threads while the device thread attaches or detaches.
+    mutable std::mutex state_mutex_{};
+
+    // Declared before the socket: the port is released only after the
+    // socket is closed and the kernel has let go of it.
+    port_manager::lease port_lease_{};
+    ::usb_device_speed attached_speed_{::usb_device_speed::USB_SPEED_UNKNOWN};
     usbip::socket usbip_socket_{};
 };
 
 static_assert(!std::copyable<driver>);
+static_assert(!std::copyable<port_manager>);
 
 } // namespace viu::vhci
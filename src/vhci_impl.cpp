@@ -3,8 +3,14 @@ module;
 #include <boost/fusion/include/adapt_struct.hpp>
 #include <boost/spirit/home/x3.hpp>
 
+#include <cerrno>
+
+#include <fcntl.h>
+#include <libudev.h>
 #include <libusb.h>
+#include <poll.h>
 #include <systemd/sd-device.h>
+#include <unistd.h>
 
 namespace ast {
 
@@ -279,44 +285,118 @@ auto command::make_ret_unlink_header(const std::int32_t status) const noexcept
     };
 }
 
-using viu::vhci::driver;
+namespace {
 
-void driver::read(boost::asio::streambuf& buffer, const std::size_t size)
+constexpr auto monitor_poll_timeout_ms = 200;
+constexpr auto max_attach_attempts = 16;
+
+auto hub_for(const usb_device_speed speed) -> viu::vhci::hub_speed
 {
-    usbip_socket_.read(buffer, size);
+    const auto is_super = speed == usb_device_speed::USB_SPEED_SUPER ||
+                          speed == usb_device_speed::USB_SPEED_SUPER_PLUS;
+
+    return is_super ? viu::vhci::hub_speed::HUB_SPEED_SUPER
+                    : viu::vhci::hub_speed::HUB_SPEED_HIGH;
 }
 
-void driver::write(boost::asio::streambuf& buffer, const std::size_t size)
+auto read_sysfs_attribute(const std::filesystem::path& attr_path)
+    -> std::optional<std::string>
 {
-    usbip_socket_.write(buffer, size);
-}
+    auto attribute_stream = std::ifstream{attr_path};
+    if (!attribute_stream.is_open()) {
+        return std::nullopt;
+    }
 
-void driver::request_stop() { usbip_socket_.close(); }
+    return std::string{
+        std::istreambuf_iterator<char>(attribute_stream),
+        std::istreambuf_iterator<char>()
+    };
+}
 
-void driver::write_sysfs_attribute(
-    const std::string& attr_path,
+// sysfs reports the failure of a store only through write(2).
+auto write_sysfs_attribute(
+    const std::filesystem::path& attr_path,
     const std::string& attribute_value
-) const
+) -> int
+{
+    const auto fd = ::open(attr_path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+
+    const auto written = ::write(
+        fd,
+        attribute_value.data(),
+        std::size(attribute_value)
+    );
+    const auto result = written < 0 ? errno : 0;
+
+    ::close(fd);
+    return result;
+}
+
+} // namespace
+
+using viu::vhci::port_manager;
+
+port_manager::lease::lease(port_manager& manager, port_type port) noexcept
+    : manager_{&manager}, port_{port}
 {
-    std::ofstream sysfs_attribute_stream{attr_path};
-    sysfs_attribute_stream << attribute_value;
 }
 
-auto driver::get_number_of_ports(sd_device* host_controller_device) const
+port_manager::lease::lease(lease&& other) noexcept
+    : manager_{std::exchange(other.manager_, nullptr)}, port_{other.port_}
+{
+}
+
+auto port_manager::lease::operator=(lease&& other) noexcept -> lease&
+{
+    if (this != &other) {
+        release();
+        manager_ = std::exchange(other.manager_, nullptr);
+        port_ = other.port_;
+    }
+
+    return *this;
+}
+
+port_manager::lease::~lease() { release(); }
+
+void port_manager::lease::release() noexcept
+{
+    if (manager_ != nullptr) {
+        std::exchange(manager_, nullptr)->release(port_);
+    }
+}
+
+auto port_manager::instance() -> port_manager&
+{
+    static auto manager = port_manager{};
+    return manager;
+}
+
+auto port_manager::make_device() -> device_pointer
+{
+    const auto create = []() {
+        sd_device* dev{};
+        sd_device_new_from_subsystem_sysname(&dev, "platform", "vhci_hcd.0");
+        return dev;
+    };
+    const auto deleter = [](sd_device* device) { sd_device_unref(device); };
+    return device_pointer{create(), deleter};
+}
+
+auto port_manager::get_number_of_ports(sd_device* device) -> std::size_t
 {
     const char* number_of_ports{};
-    sd_device_get_sysattr_value(
-        host_controller_device,
-        "nports",
-        &number_of_ports
-    );
+    sd_device_get_sysattr_value(device, "nports", &number_of_ports);
 
     if (number_of_ports == nullptr) {
         return 0;
     }
 
     try {
-        return std::stoi(std::string{number_of_ports});
+        return std::stoul(std::string{number_of_ports});
     } catch (std::invalid_argument& invalid_argument_ex) {
         std::println(std::cerr, "{}", invalid_argument_ex.what());
         return 0;
@@ -326,13 +406,13 @@ auto driver::get_number_of_ports(sd_device* host_controller_device) const
     }
 }
 
-auto driver::count_controllers() const
+auto port_manager::count_controllers(sd_device* device) -> std::size_t
 {
     sd_device* platform{};
-    sd_device_get_parent(underlying_device(), &platform);
+    sd_device_get_parent(device, &platform);
 
     if (platform == nullptr) {
-        return std::filesystem::directory_iterator::difference_type{};
+        return 0;
     }
 
     const char* system_path{};
@@ -341,175 +421,508 @@ auto driver::count_controllers() const
 
     const auto& path = std::filesystem::path{system_path};
 
-    return std::ranges::count_if(
+    return static_cast<std::size_t>(std::ranges::count_if(
         std::filesystem::directory_iterator{path},
         [](const auto& entry) {
             return entry.path().stem().string() == "vhci_hcd";
         }
-    );
+    ));
+}
+
+auto port_manager::probe_super_plus(const std::filesystem::path& syspath)
+    -> bool
+{
+    constexpr auto super_plus_mbps = 10000;
+
+    auto ec = std::error_code{};
+    for (const auto& entry : std::filesystem::directory_iterator{syspath, ec}) {
+        if (!entry.path().filename().string().starts_with("usb")) {
+            continue;
+        }
+
+        const auto speed = read_sysfs_attribute(entry.path() / "speed");
+        if (!speed.has_value()) {
+            continue;
+        }
+
+        auto mbps = 0;
+        const auto* const last = speed->data() + std::size(*speed);
+        const auto parsed = std::from_chars(speed->data(), last, mbps);
+        if (parsed.ec == std::errc{} && mbps >= super_plus_mbps) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+auto port_manager::open_locked() -> bool
+{
+    if (!devices_.empty()) {
+        return true;
+    }
+
+    const auto device = make_device();
+    if (device == nullptr) {
+        return false;
+    }
+
+    const char* path{};
+    sd_device_get_syspath(device.get(), &path);
+    if (path == nullptr) {
+        return false;
+    }
+
+    const auto number_of_ports = get_number_of_ports(device.get());
+    const auto number_of_controllers = count_controllers(device.get());
+    if (number_of_ports == 0 || number_of_controllers == 0) {
+        return false;
+    }
+
+    syspath_ = path;
+    number_of_controllers_ = number_of_controllers;
+    super_plus_ = probe_super_plus(syspath_);
+    devices_.resize(number_of_ports);
+
+    if (!refresh_locked()) {
+        devices_.clear();
+        return false;
+    }
+
+    monitor_thread_ = std::jthread{[this](const std::stop_token& stoken) {
+        monitor(stoken);
+    }};
+
+    return true;
 }
 
-auto driver::parse_status(const char* value)
+auto port_manager::refresh_locked() -> bool
 {
-    viu::_assert(value != nullptr);
+    for (std::size_t i = 0; i < number_of_controllers_; ++i) {
+        const auto attr = i > 0 ? std::format("status.{}", i) : "status";
+        const auto status = read_sysfs_attribute(syspath_ / attr);
+        if (!status.has_value()) {
+            return false;
+        }
 
+        parse_status_locked(*status);
+    }
+
+    return true;
+}
+
+void port_manager::parse_status_locked(const std::string& status)
+{
     ast::vhci_hcd_status_vector vhci_hcd_status{};
 
-    if (client::parse_status(value, vhci_hcd_status)) {
-        for (const auto& status : vhci_hcd_status) {
-            auto& virtual_device = devices_.at(status.port);
+    if (!client::parse_status(status.c_str(), vhci_hcd_status)) {
+        return;
+    }
 
-            if (status.hub == "hs") {
-                virtual_device.hub = hub_speed::HUB_SPEED_HIGH;
-            } else {
-                virtual_device.hub = hub_speed::HUB_SPEED_SUPER;
-            }
+    for (const auto& port_status : vhci_hcd_status) {
+        const auto port = static_cast<std::size_t>(port_status.port);
+        if (port >= std::size(devices_)) {
+            continue;
+        }
 
-            virtual_device.port = status.port;
-            virtual_device.status = status.sta;
-            virtual_device.devid = status.dev;
-            virtual_device.busnum = (status.dev >> 16);
-            virtual_device.devnum = (status.dev & 0x0000ffff);
+        auto& virtual_device = devices_[port];
 
-            if (virtual_device.status != VDEV_ST_NULL &&
-                virtual_device.status != VDEV_ST_NOTASSIGNED) {
-                // viu::_assert(false);
-            }
+        if (port_status.hub == "hs") {
+            virtual_device.hub = hub_speed::HUB_SPEED_HIGH;
+        } else {
+            virtual_device.hub = hub_speed::HUB_SPEED_SUPER;
         }
+
+        virtual_device.port = static_cast<port_type>(port);
+        virtual_device.status = port_status.sta;
+        virtual_device.speed = port_status.spd;
+        virtual_device.devid = port_status.dev;
+        virtual_device.busnum = (port_status.dev >> 16);
+        virtual_device.devnum = (port_status.dev & 0x0000ffff);
     }
+}
+
+auto port_manager::controller_of(const port_type port) const noexcept
+    -> std::size_t
+{
+    const auto ports_per_controller =
+        std::max<std::size_t>(std::size(devices_) / number_of_controllers_, 1);
 
-    return 0;
+    return port / ports_per_controller;
 }
 
-auto driver::refresh_status()
+// The free port on the controller with the fewest busy ports of that speed.
+auto port_manager::find_free_port_locked(const hub_speed hub) const
+    -> std::optional<port_type>
 {
-    for (int i = 0; i < number_of_controllers_; ++i) {
-        const std::string status = i > 0 ? std::format("status.{}", i)
-                                         : "status";
-        const char* attr_status{};
-        sd_device_get_sysattr_value(
-            underlying_device(),
-            status.c_str(),
-            &attr_status
-        );
+    auto busy = std::vector<std::size_t>(number_of_controllers_);
+    for (const auto& device : devices_) {
+        const auto controller = controller_of(device.port);
+        if (device.hub == hub && controller < std::size(busy) &&
+            (device.status != VDEV_ST_NULL || device.reserved)) {
+            ++busy[controller];
+        }
+    }
 
-        if (attr_status == nullptr) {
-            return -1;
+    auto port = std::optional<port_type>{};
+    auto least_busy = std::numeric_limits<std::size_t>::max();
+    for (const auto& device : devices_) {
+        if (device.hub != hub || device.status != VDEV_ST_NULL ||
+            device.reserved) {
+            continue;
         }
 
-        if (const auto r = parse_status(attr_status); r != 0) {
-            return r;
+        const auto controller = controller_of(device.port);
+        const auto load = controller < std::size(busy) ? busy[controller]
+                                                       : least_busy;
+        if (load < least_busy) {
+            least_busy = load;
+            port = device.port;
         }
     }
 
-    return 0;
+    return port;
 }
 
-auto driver::make_device() const
+auto port_manager::reserve_locked(const hub_speed hub)
+    -> std::expected<lease, viu::vhci::error>
 {
-    const auto create = []() {
-        sd_device* dev{};
-        sd_device_new_from_subsystem_sysname(&dev, "platform", "vhci_hcd.0");
-        return dev;
+    auto port = find_free_port_locked(hub);
+
+    // A uevent may not have been processed yet, look at sysfs once more.
+    if (!port.has_value() && refresh_locked()) {
+        port = find_free_port_locked(hub);
+    }
+
+    if (!port.has_value()) {
+        return std::unexpected{viu::vhci::error::no_free_port};
+    }
+
+    devices_[*port].reserved = true;
+    return lease{*this, *port};
+}
+
+void port_manager::monitor(const std::stop_token& stoken)
+{
+    using udev_pointer = std::unique_ptr<udev, decltype(&udev_unref)>;
+    using monitor_pointer =
+        std::unique_ptr<udev_monitor, decltype(&udev_monitor_unref)>;
+
+    const auto context = udev_pointer{udev_new(), udev_unref};
+    if (context == nullptr) {
+        return;
+    }
+
+    const auto uevents = monitor_pointer{
+        udev_monitor_new_from_netlink(context.get(), "kernel"),
+        udev_monitor_unref
     };
-    const auto deleter = [](sd_device* device) { sd_device_unref(device); };
-    return driver::device_pointer{create(), deleter};
+
+    if (uevents == nullptr ||
+        udev_monitor_filter_add_match_subsystem_devtype(
+            uevents.get(),
+            "usb",
+            "usb_device"
+        ) < 0 ||
+        udev_monitor_enable_receiving(uevents.get()) < 0) {
+        return;
+    }
+
+    auto fds = pollfd{
+        .fd = udev_monitor_get_fd(uevents.get()),
+        .events = POLLIN,
+        .revents = 0
+    };
+
+    while (!stoken.stop_requested()) {
+        if (::poll(&fds, 1, monitor_poll_timeout_ms) <= 0) {
+            continue;
+        }
+
+        auto* const dev = udev_monitor_receive_device(uevents.get());
+        if (dev == nullptr) {
+            continue;
+        }
+
+        const auto* const devpath = udev_device_get_devpath(dev);
+        const auto on_vhci = devpath != nullptr &&
+                             std::string_view{devpath}.contains("vhci_hcd");
+        udev_device_unref(dev);
+
+        if (on_vhci) {
+            refresh();
+        }
+    }
+}
+
+auto port_manager::is_available() -> bool
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+    return open_locked();
 }
 
-auto driver::open()
+void port_manager::refresh()
 {
-    host_controller_device_ = make_device();
-    if (host_controller_device_ == nullptr) {
-        return -1;
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+    if (!devices_.empty()) {
+        std::ignore = refresh_locked();
     }
+}
 
-    devices_.resize(get_number_of_ports(underlying_device()));
-    viu::_assert(devices_.size() != 0);
+auto port_manager::reserve(const usb_device_speed speed)
+    -> std::expected<lease, viu::vhci::error>
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
 
-    number_of_controllers_ = count_controllers();
-    if (number_of_controllers_ <= 0) {
-        return -1;
+    if (!open_locked()) {
+        return std::unexpected{viu::vhci::error::unavailable};
     }
 
-    return refresh_status();
+    return reserve_locked(hub_for(speed));
 }
 
-auto driver::get_free_port(const usb_device_speed speed) const
-    -> std::expected<std::uint8_t, viu::vhci::error>
+auto port_manager::reserve(
+    const usb_device_speed speed,
+    const std::size_t count
+) -> std::expected<std::vector<lease>, viu::vhci::error>
 {
-    const auto hub_speed{
-        (speed == usb_device_speed::USB_SPEED_SUPER ||
-         speed == usb_device_speed::USB_SPEED_SUPER_PLUS)
-            ? hub_speed::HUB_SPEED_SUPER
-            : hub_speed::HUB_SPEED_HIGH
-    };
+    auto leases = std::vector<lease>{};
+    auto failure = std::optional<viu::vhci::error>{};
+
+    {
+        [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
 
-    const auto free_device =
-        std::ranges::find_if(devices_, [&](const auto& device) {
-            return (device.hub == hub_speed) && (device.status == VDEV_ST_NULL);
-        });
+        if (!open_locked()) {
+            return std::unexpected{viu::vhci::error::unavailable};
+        }
+
+        leases.reserve(count);
+        while (std::size(leases) < count) {
+            auto port_lease = reserve_locked(hub_for(speed));
+            if (!port_lease.has_value()) {
+                failure = port_lease.error();
+                break;
+            }
 
-    if (free_device != std::cend(devices_)) {
-        return (*free_device).port;
+            leases.push_back(std::move(*port_lease));
+        }
+    }
+
+    // Leases release their port under the lock, drop them after it.
+    if (failure.has_value()) {
+        leases.clear();
+        return std::unexpected{*failure};
     }
 
-    return std::unexpected{viu::vhci::error::no_free_port};
+    return leases;
 }
 
-auto driver::attach_device(
-    const std::uint8_t port,
+auto port_manager::attach(
+    const lease& port_lease,
     const int sockfd,
     const std::uint32_t devid,
     const std::uint32_t speed
-) const
+) -> int
 {
-    const char* path{};
-    sd_device_get_syspath(underlying_device(), &path);
-    if (path == nullptr) {
-        return -1;
-    }
+    viu::_assert(port_lease.manager_ == this);
 
-    const auto attach_attr_path = std::format("{}/attach", path);
-    const auto attribute_value = viu::format::make_string(
-        port,
+    const auto attribute_value = std::format(
+        "{} {} {} {}",
+        port_lease.port(),
         sockfd,
         devid,
-        std::min(
-            static_cast<std::uint32_t>(usb_device_speed::USB_SPEED_SUPER),
-            speed
-        )
+        static_cast<std::uint32_t>(clamp(static_cast<usb_device_speed>(speed)))
+    );
+
+    const auto result = write_sysfs_attribute(
+        syspath_ / "attach",
+        attribute_value
     );
 
-    write_sysfs_attribute(attach_attr_path, attribute_value);
+    if (result == 0) {
+        mark_used(port_lease.port());
+    }
 
-    return 0;
+    return result;
 }
 
-driver::driver()
+auto port_manager::detach(const lease& port_lease) -> int
 {
-    auto usbip_result = open();
-    viu::_assert(usbip_result == 0);
+    viu::_assert(port_lease.manager_ == this);
+
+    return write_sysfs_attribute(
+        syspath_ / "detach",
+        std::format("{}", port_lease.port())
+    );
+}
+
+void port_manager::mark_used(const port_type port)
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+    if (port < std::size(devices_)) {
+        devices_[port].status = VDEV_ST_NOTASSIGNED;
+    }
+}
+
+void port_manager::release(const port_type port) noexcept
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+    if (port < std::size(devices_)) {
+        devices_[port].reserved = false;
+    }
+}
+
+auto port_manager::supports_super_plus() -> bool
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+    return open_locked() && super_plus_;
+}
+
+auto port_manager::clamp(const usb_device_speed speed) -> usb_device_speed
+{
+    const auto max_speed = supports_super_plus()
+                               ? usb_device_speed::USB_SPEED_SUPER_PLUS
+                               : usb_device_speed::USB_SPEED_SUPER;
+
+    return std::min(speed, max_speed);
+}
+
+auto port_manager::speed_of(const port_type port) const
+    -> std::optional<usb_device_speed>
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+
+    if (port >= std::size(devices_)) {
+        return std::nullopt;
+    }
+
+    const auto& device = devices_[port];
+    if (device.status == VDEV_ST_NULL || device.speed == 0) {
+        return std::nullopt;
+    }
+
+    return static_cast<usb_device_speed>(device.speed);
+}
+
+auto port_manager::utilization() const -> port_utilization
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{mutex_};
+
+    auto usage = port_utilization{.controllers = number_of_controllers_};
+    for (const auto& device : devices_) {
+        const auto used = device.status != VDEV_ST_NULL || device.reserved;
+        if (device.hub == hub_speed::HUB_SPEED_HIGH) {
+            ++usage.high_speed_ports;
+            usage.high_speed_used += used ? 1 : 0;
+        } else {
+            ++usage.super_speed_ports;
+            usage.super_speed_used += used ? 1 : 0;
+        }
+
+        usage.reserved += device.reserved ? 1 : 0;
+    }
+
+    return usage;
+}
+
+using viu::vhci::driver;
+
+driver::driver() { viu::_assert(port_manager::instance().is_available()); }
+
+void driver::read(boost::asio::streambuf& buffer, const std::size_t size)
+{
+    usbip_socket_.read(buffer, size);
+}
+
+void driver::write(boost::asio::streambuf& buffer, const std::size_t size)
+{
+    usbip_socket_.write(buffer, size);
+}
+
+void driver::request_stop() { usbip_socket_.shutdown(); }
+
+void driver::detach()
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{state_mutex_};
+    if (!port_lease_) {
+        return;
+    }
+
+    // ENODEV: the host already dropped the device, e.g. `usbip detach`.
+    const auto result = port_manager::instance().detach(port_lease_);
+    if (result != 0 && result != ENODEV && result != EINVAL) {
+        throw std::system_error{result, std::generic_category(), "vhci detach"};
+    }
+
+    port_lease_ = port_manager::lease{};
+    attached_speed_ = usb_device_speed::USB_SPEED_UNKNOWN;
+}
+
+void driver::reconnect() { usbip_socket_.reconnect(); }
+
+auto driver::link_speed() const -> std::optional<usb_device_speed>
+{
+    [[maybe_unused]] const std::lock_guard<std::mutex> _{state_mutex_};
+    if (!port_lease_) {
+        return std::nullopt;
+    }
+
+    const auto reported = port_manager::instance().speed_of(port_lease_.port());
+    return reported.value_or(attached_speed_);
 }
 
 void driver::attach(const std::uint32_t speed, const std::uint8_t device_id)
 {
-    while (true) {
-        const auto speed_enum = driver::to_speed_enum(speed);
-        const auto usbip_port = get_free_port(speed_enum);
-        viu::_assert(usbip_port.has_value());
+    attach(speed, device_id, port_manager::lease{});
+}
+
+void driver::attach(
+    const std::uint32_t speed,
+    const std::uint8_t device_id,
+    port_manager::lease port_lease
+)
+{
+    auto& ports = port_manager::instance();
+    const auto speed_enum = driver::to_speed_enum(speed);
+
+    for (auto attempt = 0; attempt < max_attach_attempts; ++attempt) {
+        if (!port_lease) {
+            auto reserved = ports.reserve(speed_enum);
+            if (!reserved.has_value()) {
+                throw std::runtime_error("No free vhci port");
+            }
+
+            port_lease = std::move(*reserved);
+        }
 
-        auto usbip_result = attach_device(
-            usbip_port.value(),
+        const auto result = ports.attach(
+            port_lease,
             usbip_socket_.fd(),
             device_id,
             static_cast<std::uint32_t>(speed_enum)
         );
 
-        if (usbip_result < 0) {
-            viu::_assert(errno == EBUSY);
-            continue;
+        if (result == 0) {
+            [[maybe_unused]] const std::lock_guard<std::mutex> _{
+                state_mutex_
+            };
+            port_lease_ = std::move(port_lease);
+            attached_speed_ = ports.clamp(speed_enum);
+            return;
+        }
+
+        // The port was taken behind our back, e.g. by usbip(8).
+        if (result != EBUSY) {
+            throw std::system_error{
+                result,
+                std::generic_category(),
+                "vhci attach"
+            };
         }
 
-        break;
+        ports.mark_used(port_lease.port());
+        port_lease = port_manager::lease{};
     }
+
+    throw std::runtime_error("Failed to find a usable vhci port");
 }